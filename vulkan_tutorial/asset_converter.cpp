@@ -0,0 +1,322 @@
+﻿// asset_converter.cpp : offline tool that packs vertex and index streams and textures into
+// a .vkasset file laid out exactly as AssetFile uploads it, so the runtime never repacks.
+
+#include "asset_format.h"
+#include <vulkan/vulkan.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+struct PendingSection {
+	AssetSection section;
+	std::vector<uint8_t> data;
+};
+
+struct BlockFormat {
+	VkFormat format;
+	uint32_t blockBytes;
+};
+
+static uint64_t alignSize(uint64_t size, uint64_t alignment)
+{
+	return (size + alignment - 1) / alignment * alignment;
+}
+
+static std::vector<uint8_t> readFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open " + path);
+	}
+	std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(data.data()), data.size());
+	return data;
+}
+
+static AssetSection makeSection(const std::string& name, AssetSectionType type)
+{
+	if (name.empty() || name.size() >= maxAssetNameLength) {
+		throw std::runtime_error("section name must be 1 to " + std::to_string(maxAssetNameLength - 1) + " characters");
+	}
+	AssetSection section{};
+	memcpy(section.name, name.c_str(), name.size());
+	section.type = type;
+	return section;
+}
+
+//appends one level at the next aligned offset of the section's data
+static void appendLevel(PendingSection& pending, uint32_t level, const uint8_t* data, size_t size)
+{
+	size_t offset = static_cast<size_t>(alignSize(pending.data.size(), assetSectionAlignment));
+	pending.section.mipOffsets[level] = offset;
+	pending.data.resize(offset + size);
+	memcpy(pending.data.data() + offset, data, size);
+}
+
+static PendingSection packVertices(const std::string& name, const std::string& path, uint32_t stride)
+{
+	PendingSection pending{ makeSection(name, AssetSectionType::VertexStream), readFile(path) };
+	if (stride == 0 || pending.data.size() % stride != 0) {
+		throw std::runtime_error(path + " is not a whole number of " + std::to_string(stride) + " byte vertices");
+	}
+	pending.section.stride = stride;
+	pending.section.count = static_cast<uint32_t>(pending.data.size() / stride);
+	return pending;
+}
+
+static PendingSection packIndices(const std::string& name, const std::string& path, const std::string& indexType)
+{
+	PendingSection pending{ makeSection(name, AssetSectionType::IndexStream), readFile(path) };
+	if (indexType == "uint16") {
+		pending.section.format = VK_INDEX_TYPE_UINT16;
+		pending.section.stride = 2;
+	}
+	else if (indexType == "uint32") {
+		pending.section.format = VK_INDEX_TYPE_UINT32;
+		pending.section.stride = 4;
+	}
+	else {
+		throw std::runtime_error("unknown index type " + indexType);
+	}
+	if (pending.data.size() % pending.section.stride != 0) {
+		throw std::runtime_error(path + " is not a whole number of indices");
+	}
+	pending.section.count = static_cast<uint32_t>(pending.data.size() / pending.section.stride);
+	return pending;
+}
+
+//binary ppm (P6, 8 bit) expanded to rgba, the only uncompressed input the tool reads
+static std::vector<uint8_t> readPpm(const std::string& path, uint32_t& width, uint32_t& height)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open " + path);
+	}
+	auto readToken = [&]() {
+		std::string token;
+		while (file >> token && token[0] == '#') {
+			std::getline(file, token);
+		}
+		return token;
+	};
+	if (readToken() != "P6") {
+		throw std::runtime_error(path + " is not a binary ppm");
+	}
+	width = static_cast<uint32_t>(std::stoul(readToken()));
+	height = static_cast<uint32_t>(std::stoul(readToken()));
+	if (readToken() != "255" || width == 0 || height == 0) {
+		throw std::runtime_error(path + " is not an 8 bit ppm");
+	}
+	file.get();
+
+	std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+	if (!file.read(reinterpret_cast<char*>(rgb.data()), rgb.size())) {
+		throw std::runtime_error(path + " is truncated");
+	}
+	std::vector<uint8_t> rgba(static_cast<size_t>(width) * height * 4);
+	for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+		memcpy(&rgba[i * 4], &rgb[i * 3], 3);
+		rgba[i * 4 + 3] = 255;
+	}
+	return rgba;
+}
+
+//2x2 box filter on the encoded values, odd edges repeat their last texel
+static std::vector<uint8_t> downsample(const std::vector<uint8_t>& source, uint32_t width, uint32_t height)
+{
+	uint32_t levelWidth = std::max(width / 2, 1u);
+	uint32_t levelHeight = std::max(height / 2, 1u);
+	std::vector<uint8_t> level(static_cast<size_t>(levelWidth) * levelHeight * 4);
+	for (uint32_t y = 0; y < levelHeight; y++) {
+		uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+		for (uint32_t x = 0; x < levelWidth; x++) {
+			uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+			for (uint32_t c = 0; c < 4; c++) {
+				uint32_t sum = source[(static_cast<size_t>(y0) * width + x0) * 4 + c] +
+					source[(static_cast<size_t>(y0) * width + x1) * 4 + c] +
+					source[(static_cast<size_t>(y1) * width + x0) * 4 + c] +
+					source[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+				level[(static_cast<size_t>(y) * levelWidth + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+	return level;
+}
+
+static PendingSection packTexture(const std::string& name, const std::string& path, bool generateMips)
+{
+	PendingSection pending{ makeSection(name, AssetSectionType::Texture), {} };
+	uint32_t width, height;
+	std::vector<uint8_t> level = readPpm(path, width, height);
+
+	uint32_t levelCount = 1;
+	if (generateMips) {
+		while (levelCount < maxAssetMipLevels && std::max(width, height) >> levelCount > 0) {
+			levelCount++;
+		}
+	}
+	pending.section.format = VK_FORMAT_R8G8B8A8_SRGB;
+	pending.section.stride = 4;
+	pending.section.width = width;
+	pending.section.height = height;
+	pending.section.mipLevels = levelCount;
+	pending.section.arrayLayers = 1;
+
+	for (uint32_t i = 0; i < levelCount; i++) {
+		appendLevel(pending, i, level.data(), level.size());
+		if (i + 1 < levelCount) {
+			level = downsample(level, std::max(width >> i, 1u), std::max(height >> i, 1u));
+		}
+	}
+	return pending;
+}
+
+//block compressed data produced by another encoder, levels tightly packed level 0 first
+static PendingSection packCompressed(const std::string& name, const std::string& path, const std::string& formatName,
+	uint32_t width, uint32_t height, uint32_t levelCount)
+{
+	static const std::map<std::string, BlockFormat> formats = {
+		{ "bc1", { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 8 } },
+		{ "bc1_srgb", { VK_FORMAT_BC1_RGBA_SRGB_BLOCK, 8 } },
+		{ "bc3", { VK_FORMAT_BC3_UNORM_BLOCK, 16 } },
+		{ "bc3_srgb", { VK_FORMAT_BC3_SRGB_BLOCK, 16 } },
+		{ "bc4", { VK_FORMAT_BC4_UNORM_BLOCK, 8 } },
+		{ "bc5", { VK_FORMAT_BC5_UNORM_BLOCK, 16 } },
+		{ "bc7", { VK_FORMAT_BC7_UNORM_BLOCK, 16 } },
+		{ "bc7_srgb", { VK_FORMAT_BC7_SRGB_BLOCK, 16 } },
+	};
+	auto it = formats.find(formatName);
+	if (it == formats.end()) {
+		throw std::runtime_error("unknown compressed format " + formatName);
+	}
+	if (width == 0 || height == 0 || levelCount == 0 || levelCount > maxAssetMipLevels) {
+		throw std::runtime_error("invalid size or level count for " + path);
+	}
+
+	PendingSection pending{ makeSection(name, AssetSectionType::Texture), {} };
+	pending.section.format = it->second.format;
+	pending.section.stride = it->second.blockBytes;
+	pending.section.width = width;
+	pending.section.height = height;
+	pending.section.mipLevels = levelCount;
+	pending.section.arrayLayers = 1;
+
+	std::vector<uint8_t> source = readFile(path);
+	size_t read = 0;
+	for (uint32_t i = 0; i < levelCount; i++) {
+		size_t blocksWide = (std::max(width >> i, 1u) + 3) / 4;
+		size_t blocksHigh = (std::max(height >> i, 1u) + 3) / 4;
+		size_t size = blocksWide * blocksHigh * it->second.blockBytes;
+		if (read + size > source.size()) {
+			throw std::runtime_error(path + " is too small for " + std::to_string(levelCount) + " levels");
+		}
+		appendLevel(pending, i, source.data() + read, size);
+		read += size;
+	}
+	return pending;
+}
+
+//header, then the index, then each section on an aligned offset with zero padding between
+static void writeAssetFile(const std::string& path, std::vector<PendingSection>& pendingSections)
+{
+	AssetFileHeader header{};
+	header.magic = assetMagic;
+	header.version = assetVersion;
+	header.sectionCount = static_cast<uint32_t>(pendingSections.size());
+	header.indexOffset = sizeof(AssetFileHeader);
+
+	uint64_t offset = header.indexOffset + pendingSections.size() * sizeof(AssetSection);
+	for (PendingSection& pending : pendingSections) {
+		offset = alignSize(offset, assetSectionAlignment);
+		pending.section.offset = offset;
+		pending.section.size = pending.data.size();
+		offset += pending.data.size();
+	}
+	header.fileSize = offset;
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to create " + path);
+	}
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const PendingSection& pending : pendingSections) {
+		file.write(reinterpret_cast<const char*>(&pending.section), sizeof(AssetSection));
+	}
+	const char padding[assetSectionAlignment] = {};
+	for (const PendingSection& pending : pendingSections) {
+		file.write(padding, static_cast<std::streamsize>(pending.section.offset - static_cast<uint64_t>(file.tellp())));
+		file.write(reinterpret_cast<const char*>(pending.data.data()), pending.data.size());
+	}
+	if (!file) {
+		throw std::runtime_error("failed to write " + path);
+	}
+}
+
+static void printUsage()
+{
+	std::cerr << "usage: vulkan_asset_converter -o out.vkasset [--no-mips, for the textures after it]\n"
+		"  --vertices name file stride\n"
+		"  --indices name file uint16|uint32\n"
+		"  --texture name image.ppm\n"
+		"  --compressed name file bc1|bc1_srgb|bc3|bc3_srgb|bc4|bc5|bc7|bc7_srgb width height levels\n";
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		std::string outputPath;
+		bool generateMips = true;
+		std::vector<PendingSection> sections;
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "-o" && i + 1 < argc) {
+				outputPath = argv[++i];
+			}
+			else if (arg == "--no-mips") {
+				generateMips = false;
+			}
+			else if (arg == "--vertices" && i + 3 < argc) {
+				sections.push_back(packVertices(argv[i + 1], argv[i + 2], static_cast<uint32_t>(std::stoul(argv[i + 3]))));
+				i += 3;
+			}
+			else if (arg == "--indices" && i + 3 < argc) {
+				sections.push_back(packIndices(argv[i + 1], argv[i + 2], argv[i + 3]));
+				i += 3;
+			}
+			else if (arg == "--texture" && i + 2 < argc) {
+				sections.push_back(packTexture(argv[i + 1], argv[i + 2], generateMips));
+				i += 2;
+			}
+			else if (arg == "--compressed" && i + 6 < argc) {
+				sections.push_back(packCompressed(argv[i + 1], argv[i + 2], argv[i + 3],
+					static_cast<uint32_t>(std::stoul(argv[i + 4])), static_cast<uint32_t>(std::stoul(argv[i + 5])),
+					static_cast<uint32_t>(std::stoul(argv[i + 6]))));
+				i += 6;
+			}
+			else {
+				printUsage();
+				return EXIT_FAILURE;
+			}
+		}
+		if (outputPath.empty() || sections.empty()) {
+			printUsage();
+			return EXIT_FAILURE;
+		}
+
+		writeAssetFile(outputPath, sections);
+		std::cerr << "[Vulkan Log] : wrote " << sections.size() << " sections to " << outputPath << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
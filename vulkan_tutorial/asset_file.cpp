@@ -0,0 +1,251 @@
+﻿// asset_file.cpp : file mapping, index validation and the staging copies
+//
+
+#include "asset_file.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//the formats the converter writes, 4x4 blocks for block compressed ones, single texels
+//for the rest
+static uint32_t blockExtent(uint32_t format)
+{
+	return format >= static_cast<uint32_t>(VK_FORMAT_BC1_RGB_UNORM_BLOCK) &&
+		format <= static_cast<uint32_t>(VK_FORMAT_BC7_SRGB_BLOCK) ? 4 : 1;
+}
+
+//rows are rows of blocks, a level holds its layers one after another
+struct AssetLevelLayout {
+	uint32_t width;
+	uint32_t height;
+	uint32_t blockRows;
+	uint64_t rowBytes;
+	uint64_t layerBytes;
+};
+
+static AssetLevelLayout levelLayout(const AssetSection& section, uint32_t level)
+{
+	uint32_t block = blockExtent(section.format);
+	AssetLevelLayout layout;
+	layout.width = std::max(section.width >> level, 1u);
+	layout.height = std::max(section.height >> level, 1u);
+	layout.blockRows = (layout.height + block - 1) / block;
+	layout.rowBytes = static_cast<uint64_t>((layout.width + block - 1) / block) * section.stride;
+	layout.layerBytes = layout.rowBytes * layout.blockRows;
+	return layout;
+}
+
+void AssetFile::open(const std::string& path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+		FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("failed to open asset file " + path);
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (view == nullptr) {
+		if (mapping != nullptr) {
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("failed to map asset file " + path);
+	}
+	fileHandle = file;
+	mappingHandle = mapping;
+	mappedSize = static_cast<uint64_t>(fileSize.QuadPart);
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		throw std::runtime_error("failed to open asset file " + path);
+	}
+	struct stat status;
+	void* view = MAP_FAILED;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+	}
+	//the mapping keeps the file referenced on its own
+	::close(file);
+	if (view == MAP_FAILED) {
+		throw std::runtime_error("failed to map asset file " + path);
+	}
+	mappedSize = static_cast<uint64_t>(status.st_size);
+	//sections are mostly read front to back, let the kernel read ahead aggressively
+	madvise(view, static_cast<size_t>(mappedSize), MADV_SEQUENTIAL);
+#endif
+	mapped = static_cast<const uint8_t*>(view);
+
+	//everything below only looks at the header and the index, a broken file is closed
+	//again before any of its section data has been paged in
+	auto reject = [&](const char* reason) {
+		close();
+		throw std::runtime_error("invalid asset file " + path + ": " + reason);
+	};
+	if (mappedSize < sizeof(AssetFileHeader)) {
+		reject("too small for the header");
+	}
+	header = reinterpret_cast<const AssetFileHeader*>(mapped);
+	if (header->magic != assetMagic) {
+		reject("not a vkasset file");
+	}
+	if (header->version != assetVersion) {
+		reject("unsupported version");
+	}
+	if (header->fileSize != mappedSize) {
+		reject("size does not match the header");
+	}
+	if (header->indexOffset % alignof(AssetSection) != 0 || header->indexOffset > mappedSize ||
+		header->sectionCount > (mappedSize - header->indexOffset) / sizeof(AssetSection)) {
+		reject("section index out of range");
+	}
+	sections = reinterpret_cast<const AssetSection*>(mapped + header->indexOffset);
+
+	for (uint32_t i = 0; i < header->sectionCount; i++) {
+		const AssetSection& section = sections[i];
+		if (memchr(section.name, '\0', maxAssetNameLength) == nullptr) {
+			reject("section name is not terminated");
+		}
+		if (section.offset % assetSectionAlignment != 0 || section.offset > mappedSize ||
+			section.size > mappedSize - section.offset) {
+			reject("section data out of range");
+		}
+		if (section.type == AssetSectionType::Texture) {
+			if (section.mipLevels == 0 || section.mipLevels > maxAssetMipLevels || section.arrayLayers == 0) {
+				reject("texture has no levels or too many");
+			}
+			//bounds that keep the level sizes below from overflowing, far past any device limit
+			if (section.width == 0 || section.height == 0 || section.width > 65536 || section.height > 65536 ||
+				section.stride == 0 || section.stride > 256) {
+				reject("texture size or texel size out of range");
+			}
+			for (uint32_t level = 0; level < section.mipLevels; level++) {
+				uint64_t end = level + 1 < section.mipLevels ? section.mipOffsets[level + 1] : section.size;
+				if (section.mipOffsets[level] % assetSectionAlignment != 0 || section.mipOffsets[level] >= end ||
+					end > section.size ||
+					levelLayout(section, level).layerBytes > (end - section.mipOffsets[level]) / section.arrayLayers) {
+					reject("texture levels out of range");
+				}
+			}
+		}
+	}
+}
+
+void AssetFile::close()
+{
+	if (mapped == nullptr) {
+		return;
+	}
+
+#ifdef _WIN32
+	UnmapViewOfFile(mapped);
+	CloseHandle(mappingHandle);
+	CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	munmap(const_cast<uint8_t*>(mapped), static_cast<size_t>(mappedSize));
+#endif
+	mapped = nullptr;
+	mappedSize = 0;
+	header = nullptr;
+	sections = nullptr;
+}
+
+const AssetSection* AssetFile::findSection(const std::string& name) const
+{
+	for (uint32_t i = 0; i < getSectionCount(); i++) {
+		if (name == sections[i].name) {
+			return &sections[i];
+		}
+	}
+	return nullptr;
+}
+
+void AssetFile::uploadBuffer(UploadManager& uploadManager, const AssetSection& section, VkBuffer dstBuffer,
+	VkDeviceSize dstOffset)
+{
+	if (section.type != AssetSectionType::VertexStream && section.type != AssetSectionType::IndexStream) {
+		throw std::runtime_error(std::string("asset section ") + section.name + " is not a buffer stream");
+	}
+
+	//half the ring per piece, so a reservation can always be met once older copies drain
+	VkDeviceSize pieceSize = std::max<VkDeviceSize>(uploadManager.getRingSize() / 2, assetSectionAlignment);
+	const uint8_t* data = getData(section);
+	for (VkDeviceSize copied = 0; copied < section.size; copied += pieceSize) {
+		VkDeviceSize size = std::min(pieceSize, section.size - copied);
+		StagingRange range = uploadManager.reserve(size, assetSectionAlignment);
+		//the only copy the data makes on the cpu, page faults on the mapping are the file read
+		memcpy(range.mapped, data + copied, static_cast<size_t>(size));
+		uploadManager.copyToBuffer(range, dstBuffer, dstOffset + copied);
+	}
+}
+
+void AssetFile::uploadImage(UploadManager& uploadManager, const AssetSection& section, VkImage dstImage,
+	VkImageLayout finalLayout)
+{
+	if (section.type != AssetSectionType::Texture) {
+		throw std::runtime_error(std::string("asset section ") + section.name + " is not a texture");
+	}
+
+	//pieces of at most half the ring like uploadBuffer, whole layers when they fit and
+	//bands of block rows when a single layer does not
+	VkDeviceSize pieceSize = std::max<VkDeviceSize>(uploadManager.getRingSize() / 2, assetSectionAlignment);
+	VkDeviceSize alignment = std::lcm(assetSectionAlignment, static_cast<VkDeviceSize>(section.stride));
+	uint32_t block = blockExtent(section.format);
+	auto copyPiece = [&](const uint8_t* source, VkDeviceSize size, const VkBufferImageCopy& region) {
+		StagingRange range = uploadManager.reserve(size, alignment);
+		memcpy(range.mapped, source, static_cast<size_t>(size));
+		uploadManager.copyToImage(range, dstImage, region, finalLayout);
+	};
+
+	const uint8_t* data = getData(section);
+	for (uint32_t level = 0; level < section.mipLevels; level++) {
+		AssetLevelLayout layout = levelLayout(section, level);
+		const uint8_t* levelData = data + section.mipOffsets[level];
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+
+		if (layout.layerBytes <= pieceSize) {
+			uint32_t layersPerPiece = static_cast<uint32_t>(std::min<VkDeviceSize>(pieceSize / layout.layerBytes, section.arrayLayers));
+			for (uint32_t layer = 0; layer < section.arrayLayers; layer += layersPerPiece) {
+				uint32_t layerCount = std::min(layersPerPiece, section.arrayLayers - layer);
+				region.imageSubresource.baseArrayLayer = layer;
+				region.imageSubresource.layerCount = layerCount;
+				region.imageExtent = { layout.width, layout.height, 1 };
+				copyPiece(levelData + layer * layout.layerBytes, layout.layerBytes * layerCount, region);
+			}
+			continue;
+		}
+
+		if (layout.rowBytes > pieceSize) {
+			throw std::runtime_error(std::string("asset section ") + section.name + " has rows wider than the staging ring");
+		}
+		uint32_t rowsPerPiece = static_cast<uint32_t>(pieceSize / layout.rowBytes);
+		for (uint32_t layer = 0; layer < section.arrayLayers; layer++) {
+			for (uint32_t row = 0; row < layout.blockRows; row += rowsPerPiece) {
+				uint32_t rowCount = std::min(rowsPerPiece, layout.blockRows - row);
+				region.imageSubresource.baseArrayLayer = layer;
+				region.imageSubresource.layerCount = 1;
+				//a band ends on a block boundary or, for the last one, at the edge of the level
+				region.imageOffset = { 0, static_cast<int32_t>(row * block), 0 };
+				region.imageExtent = { layout.width, std::min(rowCount * block, layout.height - row * block), 1 };
+				copyPiece(levelData + layer * layout.layerBytes + row * layout.rowBytes, layout.rowBytes * rowCount, region);
+			}
+		}
+	}
+}
@@ -0,0 +1,51 @@
+﻿// asset_file.h : a mapped .vkasset file whose sections are copied from the mapping
+// straight into the upload manager's staging ring, with nothing parsed or repacked.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include "asset_format.h"
+#include "upload_manager.h"
+
+class AssetFile {
+public:
+	AssetFile() = default;
+	AssetFile(const AssetFile&) = delete;
+	AssetFile& operator=(const AssetFile&) = delete;
+	~AssetFile() { close(); }
+
+	//maps the file read only and checks the header and the section index against its
+	//size, the section data itself is only paged in when it is uploaded
+	void open(const std::string& path);
+	void close();
+	bool isOpen() const { return mapped != nullptr; }
+
+	uint32_t getSectionCount() const { return header != nullptr ? header->sectionCount : 0; }
+	const AssetSection& getSection(uint32_t index) const { return sections[index]; }
+	//nullptr when there is no section of that name
+	const AssetSection* findSection(const std::string& name) const;
+	//the section's bytes inside the mapping, valid until close
+	const uint8_t* getData(const AssetSection& section) const { return mapped + section.offset; }
+
+	//queue copies of the section into dstBuffer, sections larger than the staging ring
+	//go out in several pieces. flush the upload manager to submit them
+	void uploadBuffer(UploadManager& uploadManager, const AssetSection& section, VkBuffer dstBuffer,
+		VkDeviceSize dstOffset = 0);
+	//copies every level and layer of the image, which must match the section's size,
+	//format and levels and is left in finalLayout. levels larger than the staging ring
+	//go out in bands of rows
+	void uploadImage(UploadManager& uploadManager, const AssetSection& section, VkImage dstImage,
+		VkImageLayout finalLayout);
+
+private:
+	const uint8_t* mapped = nullptr;
+	uint64_t mappedSize = 0;
+	const AssetFileHeader* header = nullptr;
+	const AssetSection* sections = nullptr;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
@@ -0,0 +1,59 @@
+﻿// asset_format.h : on disk layout of .vkasset files, shared by the runtime loader and the
+// offline converter. every struct is read straight out of the mapped file.
+
+#pragma once
+
+#include <cstdint>
+
+//"VKAS" in file order
+const uint32_t assetMagic = 0x53414B56;
+const uint32_t assetVersion = 1;
+//section data and texture levels start on this boundary, which satisfies the buffer
+//offset alignment of any copy and keeps every staging copy a straight memcpy
+const uint64_t assetSectionAlignment = 256;
+const uint32_t maxAssetMipLevels = 15;
+const uint32_t maxAssetNameLength = 64;
+
+enum class AssetSectionType : uint32_t {
+	//vertices already laid out as the pipeline reads them
+	VertexStream = 1,
+	IndexStream = 2,
+	//every level of the mip chain, level 0 first, in the layout vkCmdCopyBufferToImage
+	//expects with bufferRowLength and bufferImageHeight 0, block compressed or not
+	Texture = 3
+};
+
+struct AssetFileHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t sectionCount;
+	uint32_t reserved;
+	//checked against the file, a truncated copy is rejected before anything is read
+	uint64_t fileSize;
+	//the AssetSection index, sectionCount entries
+	uint64_t indexOffset;
+};
+static_assert(sizeof(AssetFileHeader) == 32, "the header is read from the file as is");
+
+struct AssetSection {
+	//null terminated
+	char name[maxAssetNameLength];
+	AssetSectionType type;
+	//VkFormat of a texture, VkIndexType of an index stream, unused for vertices
+	uint32_t format;
+	//bytes per vertex or index
+	uint32_t stride;
+	//vertices or indices
+	uint32_t count;
+	uint32_t width;
+	uint32_t height;
+	uint32_t mipLevels;
+	uint32_t arrayLayers;
+	//from the start of the file, a multiple of assetSectionAlignment
+	uint64_t offset;
+	uint64_t size;
+	//from offset, each level holds all array layers and is aligned like the section
+	uint64_t mipOffsets[maxAssetMipLevels];
+	uint32_t reserved[6];
+};
+static_assert(sizeof(AssetSection) == 256, "sections are indexed by stride in the file");
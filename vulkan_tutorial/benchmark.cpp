@@ -0,0 +1,747 @@
+﻿// benchmark.cpp : headless benchmark scenarios, results are written as json so a run can
+// be compared against a stored baseline. For reproducible numbers run it on lavapipe,
+// either with VK_ICD_FILENAMES set or with --icd pointing at lvp_icd.x86_64.json.
+
+#include "vulkan_tutorial.h"
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+
+//every host allocation made through operator new, sampled around each scenario
+static std::atomic<uint64_t> hostAllocationCount{ 0 };
+
+void* operator new(std::size_t size)
+{
+	hostAllocationCount.fetch_add(1, std::memory_order_relaxed);
+	if (void* pointer = std::malloc(size > 0 ? size : 1)) {
+		return pointer;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept
+{
+	std::free(pointer);
+}
+
+struct BenchmarkOptions {
+	//frames rendered per scenario, or per step of the scaling scenarios
+	uint32_t frames = 300;
+	uint32_t startupRuns = 5;
+	uint32_t swapChainRebuilds = 30;
+	VkDeviceSize uploadBytesPerFrame = 8ull * 1024 * 1024;
+	std::vector<uint32_t> drawCounts = { 1, 100, 1000, 10000 };
+	std::vector<uint32_t> dispatchGroups = { 1, 64, 1024, 16384 };
+	std::string shaderDir = BENCHMARK_SHADER_DIR;
+	//kept apart from the application's cache so benchmark runs do not warm it up
+	std::string pipelineCachePath = "benchmark_pipeline_cache.bin";
+	//empty writes the report to stdout
+	std::string outputPath;
+	//empty runs every scenario
+	std::set<std::string> scenarios;
+};
+
+struct SampleStatistics {
+	double mean = 0.0;
+	double p50 = 0.0;
+	double p99 = 0.0;
+	double max = 0.0;
+};
+
+struct ScenarioResult {
+	std::string name;
+	//what each sample measures, e.g. frame_ms
+	std::string sampleName = "frame_ms";
+	std::vector<double> samples;
+	std::vector<std::pair<std::string, double>> metrics;
+	uint64_t hostAllocations = 0;
+	MemoryStatistics memory;
+	//reason the scenario could not run, empty when it did
+	std::string skipped;
+};
+
+struct BenchmarkReport {
+	std::string deviceName;
+	std::string driverName;
+	std::string driverInfo;
+	std::vector<ScenarioResult> scenarios;
+};
+
+static double elapsedMilliseconds(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static SampleStatistics computeStatistics(std::vector<double> samples)
+{
+	SampleStatistics statistics;
+	if (samples.empty()) {
+		return statistics;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (double sample : samples) {
+		sum += sample;
+	}
+	//nearest rank percentiles, no interpolation
+	auto percentile = [&samples](double fraction) {
+		return samples[static_cast<size_t>(fraction * (samples.size() - 1) + 0.5)];
+	};
+	statistics.mean = sum / samples.size();
+	statistics.p50 = percentile(0.50);
+	statistics.p99 = percentile(0.99);
+	statistics.max = samples.back();
+	return statistics;
+}
+
+static VkApplicationConfig benchmarkConfig(const BenchmarkOptions& options)
+{
+	VkApplicationConfig config;
+	config.headless = true;
+	config.swapChainPolicy.presentPolicy = PresentPolicy::LowestLatency;
+	config.pipelineCachePath = options.pipelineCachePath;
+	return config;
+}
+
+static void describeDevice(VkApplication& app, BenchmarkReport& report)
+{
+	VkPhysicalDeviceDriverProperties driverProperties{};
+	driverProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DRIVER_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2{};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &driverProperties;
+	vkGetPhysicalDeviceProperties2(app.getPhysicalDevice(), &properties2);
+	report.deviceName = properties2.properties.deviceName;
+	report.driverName = driverProperties.driverName;
+	report.driverInfo = driverProperties.driverInfo;
+}
+
+//renders frameCount frames, one cpu frame time sample each
+static void renderFrames(VkApplication& app, uint32_t frameCount, ScenarioResult& result)
+{
+	result.samples.reserve(result.samples.size() + frameCount);
+	uint64_t allocationsBefore = hostAllocationCount.load();
+	for (uint32_t i = 0; i < frameCount; i++) {
+		auto frameStart = std::chrono::steady_clock::now();
+		app.renderFrame();
+		result.samples.push_back(elapsedMilliseconds(frameStart));
+	}
+	result.hostAllocations += hostAllocationCount.load() - allocationsBefore;
+	result.memory = app.getMemoryAllocator().getStatistics();
+}
+
+static bool readShader(const BenchmarkOptions& options, const std::string& name, std::vector<char>& code)
+{
+	std::ifstream file(options.shaderDir + "/" + name, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		return false;
+	}
+	code.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(code.data(), code.size());
+	return static_cast<bool>(file);
+}
+
+static VkShaderModule createShaderModule(VkDevice device, const std::vector<char>& code)
+{
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size();
+	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	VkShaderModule shaderModule;
+	if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shader module");
+	}
+	return shaderModule;
+}
+
+//time to first frame over several cold starts, with the initVulkan phases averaged
+static void runStartup(const BenchmarkOptions& options, BenchmarkReport& report)
+{
+	ScenarioResult result;
+	result.name = "startup";
+	result.sampleName = "first_frame_ms";
+	//keyed by name, phases that run in parallel are appended in the order they finish,
+	//which differs between runs
+	std::map<std::string, double> phaseTotals;
+	double startupTotal = 0.0;
+	uint64_t allocationsBefore = hostAllocationCount.load();
+	for (uint32_t run = 0; run < options.startupRuns; run++) {
+		auto runStart = std::chrono::steady_clock::now();
+		VkApplication app(600, 800, "vulkan_benchmark", benchmarkConfig(options));
+		app.init();
+		app.renderFrame();
+		result.samples.push_back(elapsedMilliseconds(runStart));
+
+		startupTotal += app.getStartupTime();
+		for (const auto& phase : app.getStartupPhases()) {
+			phaseTotals[phase.first] += phase.second;
+		}
+		describeDevice(app, report);
+		result.memory = app.getMemoryAllocator().getStatistics();
+		app.shutdown();
+	}
+	result.hostAllocations = hostAllocationCount.load() - allocationsBefore;
+
+	//phases overlap where initVulkan runs them in parallel, init_ms is the wall clock time
+	result.metrics.emplace_back("init_ms", startupTotal / options.startupRuns);
+	for (const auto& phase : phaseTotals) {
+		result.metrics.emplace_back(phase.first + "_ms", phase.second / options.startupRuns);
+	}
+	report.scenarios.push_back(result);
+}
+
+static void runSwapChain(const BenchmarkOptions& options, BenchmarkReport& report)
+{
+	ScenarioResult result;
+	result.name = "swapchain_recreate";
+	result.sampleName = "recreate_ms";
+	VkApplication app(600, 800, "vulkan_benchmark", benchmarkConfig(options));
+	app.init();
+	describeDevice(app, report);
+	app.renderFrame();
+
+	uint64_t allocationsBefore = hostAllocationCount.load();
+	for (uint32_t i = 0; i < options.swapChainRebuilds; i++) {
+		auto rebuildStart = std::chrono::steady_clock::now();
+		if (!app.rebuildSwapChain()) {
+			result.skipped = "no headless surface, rendering into offscreen images";
+			break;
+		}
+		result.samples.push_back(elapsedMilliseconds(rebuildStart));
+		//lets the retired swapchain be released the way it would be after a resize
+		app.renderFrame();
+	}
+	result.hostAllocations = hostAllocationCount.load() - allocationsBefore;
+	result.memory = app.getMemoryAllocator().getStatistics();
+	app.shutdown();
+	report.scenarios.push_back(result);
+}
+
+static void runUpload(const BenchmarkOptions& options, BenchmarkReport& report)
+{
+	ScenarioResult result;
+	result.name = "upload_throughput";
+	VkApplication app(600, 800, "vulkan_benchmark", benchmarkConfig(options));
+	app.init();
+	describeDevice(app, report);
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = options.uploadBytesPerFrame;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer buffer;
+	MemoryAllocation allocation;
+	app.getMemoryAllocator().createBuffer(bufferInfo, MemoryUsage::GpuOnly, buffer, allocation);
+	std::vector<uint8_t> data(static_cast<size_t>(options.uploadBytesPerFrame), 0x5a);
+
+	//every frame queues one upload, drawFrame flushes it and waits on the transfer timeline
+	result.samples.reserve(options.frames);
+	uint64_t allocationsBefore = hostAllocationCount.load();
+	auto runStart = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < options.frames; i++) {
+		auto frameStart = std::chrono::steady_clock::now();
+		app.getUploadManager().uploadBuffer(buffer, 0, data.data(), options.uploadBytesPerFrame);
+		app.renderFrame();
+		result.samples.push_back(elapsedMilliseconds(frameStart));
+	}
+	vkDeviceWaitIdle(app.getDevice());
+	double seconds = elapsedMilliseconds(runStart) / 1000.0;
+	result.hostAllocations = hostAllocationCount.load() - allocationsBefore;
+	result.memory = app.getMemoryAllocator().getStatistics();
+
+	double mebibytes = static_cast<double>(options.uploadBytesPerFrame) * options.frames / (1024.0 * 1024.0);
+	result.metrics.emplace_back("bytes_per_frame", static_cast<double>(options.uploadBytesPerFrame));
+	result.metrics.emplace_back("mib_per_second", mebibytes / seconds);
+
+	app.getMemoryAllocator().destroyBuffer(buffer, allocation);
+	app.shutdown();
+	report.scenarios.push_back(result);
+}
+
+//one small triangle per draw inside a render pass, recorded in parallel on the workers
+static void runDrawCalls(const BenchmarkOptions& options, BenchmarkReport& report)
+{
+	std::vector<char> vertexCode, fragmentCode;
+	if (!readShader(options, "bench.vert.spv", vertexCode) || !readShader(options, "bench.frag.spv", fragmentCode)) {
+		ScenarioResult result;
+		result.name = "draw_calls";
+		result.skipped = "shaders not found in " + options.shaderDir;
+		report.scenarios.push_back(result);
+		return;
+	}
+
+	VkApplication app(600, 800, "vulkan_benchmark", benchmarkConfig(options));
+	app.init();
+	describeDevice(app, report);
+	VkDevice device = app.getDevice();
+	//draws and dispatches are recorded through the driver's entry points directly
+	const DeviceDispatch* dispatch = &app.getDeviceDispatch();
+	const VkExtent2D extent = { 512, 512 };
+	const VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = format;
+	imageInfo.extent = { extent.width, extent.height, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	VkImage image;
+	MemoryAllocation imageMemory;
+	app.getMemoryAllocator().createImage(imageInfo, MemoryUsage::GpuOnly, image, imageMemory);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+	VkImageView imageView;
+	if (vkCreateImageView(device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark image view");
+	}
+
+	VkAttachmentDescription colorAttachment{};
+	colorAttachment.format = format;
+	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+	//consecutive frames render into the same image
+	VkSubpassDependency dependency{};
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	VkRenderPassCreateInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = 1;
+	renderPassInfo.pAttachments = &colorAttachment;
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &dependency;
+	VkRenderPass renderPass;
+	if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark render pass");
+	}
+
+	VkFramebufferCreateInfo framebufferInfo{};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = renderPass;
+	framebufferInfo.attachmentCount = 1;
+	framebufferInfo.pAttachments = &imageView;
+	framebufferInfo.width = extent.width;
+	framebufferInfo.height = extent.height;
+	framebufferInfo.layers = 1;
+	VkFramebuffer framebuffer;
+	if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &framebuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark framebuffer");
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRange.size = 2 * sizeof(float);
+	VkPipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
+	VkPipelineLayout pipelineLayout;
+	if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark pipeline layout");
+	}
+
+	VkShaderModule vertexModule = createShaderModule(device, vertexCode);
+	VkShaderModule fragmentModule = createShaderModule(device, fragmentCode);
+	VkPipelineShaderStageCreateInfo stages[2]{};
+	stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	stages[0].module = vertexModule;
+	stages[0].pName = "main";
+	stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	stages[1].module = fragmentModule;
+	stages[1].pName = "main";
+	VkPipelineVertexInputStateCreateInfo vertexInput{};
+	vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPipelineViewportStateCreateInfo viewportState{};
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+	VkPipelineRasterizationStateCreateInfo rasterizer{};
+	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizer.cullMode = VK_CULL_MODE_NONE;
+	rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+	rasterizer.lineWidth = 1.0f;
+	VkPipelineMultisampleStateCreateInfo multisampling{};
+	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkPipelineColorBlendAttachmentState blendAttachment{};
+	blendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+		VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+	VkPipelineColorBlendStateCreateInfo colorBlend{};
+	colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlend.attachmentCount = 1;
+	colorBlend.pAttachments = &blendAttachment;
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicState{};
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.dynamicStateCount = 2;
+	dynamicState.pDynamicStates = dynamicStates;
+	VkGraphicsPipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineInfo.stageCount = 2;
+	pipelineInfo.pStages = stages;
+	pipelineInfo.pVertexInputState = &vertexInput;
+	pipelineInfo.pInputAssemblyState = &inputAssembly;
+	pipelineInfo.pViewportState = &viewportState;
+	pipelineInfo.pRasterizationState = &rasterizer;
+	pipelineInfo.pMultisampleState = &multisampling;
+	pipelineInfo.pColorBlendState = &colorBlend;
+	pipelineInfo.pDynamicState = &dynamicState;
+	pipelineInfo.layout = pipelineLayout;
+	pipelineInfo.renderPass = renderPass;
+	pipelineInfo.subpass = 0;
+	VkPipeline pipeline = app.getPipelineManager().createGraphicsPipeline(pipelineInfo);
+	vkDestroyShaderModule(device, fragmentModule, nullptr);
+	vkDestroyShaderModule(device, vertexModule, nullptr);
+
+	//the draws are split into one task per worker, rebuilt for every draw count
+	std::vector<RecordTask> drawTasks;
+	app.addFrameCallback([&](VkCommandBuffer commandBuffer, uint32_t) {
+		VkClearValue clearValue{};
+		VkRenderPassBeginInfo beginInfo{};
+		beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+		beginInfo.renderPass = renderPass;
+		beginInfo.framebuffer = framebuffer;
+		beginInfo.renderArea.extent = extent;
+		beginInfo.clearValueCount = 1;
+		beginInfo.pClearValues = &clearValue;
+		dispatch->vkCmdBeginRenderPass(commandBuffer, &beginInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		VkCommandBufferInheritanceInfo inheritance{};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.renderPass = renderPass;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = framebuffer;
+		app.getParallelRecorder().record(commandBuffer, drawTasks, inheritance);
+		dispatch->vkCmdEndRenderPass(commandBuffer);
+	});
+
+	uint32_t taskCount = std::max(1u, app.getJobSystem().getWorkerCount());
+	for (uint32_t drawCount : options.drawCounts) {
+		drawTasks.clear();
+		for (uint32_t task = 0; task < taskCount; task++) {
+			uint32_t first = drawCount * task / taskCount;
+			uint32_t last = drawCount * (task + 1) / taskCount;
+			drawTasks.push_back([=](VkCommandBuffer commandBuffer, uint32_t) {
+				dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.0f, 1.0f };
+				VkRect2D scissor = { { 0, 0 }, extent };
+				dispatch->vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+				dispatch->vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+				for (uint32_t draw = first; draw < last; draw++) {
+					//spread the triangles over a 100x100 grid so they do not all overlap
+					float offset[2] = { (draw % 100) / 50.0f - 0.99f, (draw / 100 % 100) / 50.0f - 0.99f };
+					dispatch->vkCmdPushConstants(commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(offset), offset);
+					dispatch->vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+				}
+			});
+		}
+
+		ScenarioResult result;
+		result.name = "draw_calls_" + std::to_string(drawCount);
+		renderFrames(app, options.frames, result);
+		result.metrics.emplace_back("draws_per_frame", drawCount);
+		result.metrics.emplace_back("record_tasks", taskCount);
+		report.scenarios.push_back(result);
+	}
+
+	vkDeviceWaitIdle(device);
+	app.getPipelineManager().destroyPipeline(pipeline);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyFramebuffer(device, framebuffer, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+	vkDestroyImageView(device, imageView, nullptr);
+	app.getMemoryAllocator().destroyImage(image, imageMemory);
+	app.shutdown();
+}
+
+//one dispatch per frame over a storage buffer, scaled by workgroup count
+static void runComputeDispatch(const BenchmarkOptions& options, BenchmarkReport& report)
+{
+	std::vector<char> computeCode;
+	if (!readShader(options, "bench.comp.spv", computeCode)) {
+		ScenarioResult result;
+		result.name = "compute_dispatch";
+		result.skipped = "shaders not found in " + options.shaderDir;
+		report.scenarios.push_back(result);
+		return;
+	}
+
+	VkApplication app(600, 800, "vulkan_benchmark", benchmarkConfig(options));
+	app.init();
+	describeDevice(app, report);
+	VkDevice device = app.getDevice();
+	const DeviceDispatch* dispatch = &app.getDeviceDispatch();
+	//matches local_size_x in bench.comp
+	const uint32_t groupSize = 64;
+	uint32_t maxGroups = *std::max_element(options.dispatchGroups.begin(), options.dispatchGroups.end());
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = static_cast<VkDeviceSize>(maxGroups) * groupSize * sizeof(uint32_t);
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	VkBuffer buffer;
+	MemoryAllocation allocation;
+	app.getMemoryAllocator().createBuffer(bufferInfo, MemoryUsage::GpuOnly, buffer, allocation);
+
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	VkDescriptorSetLayoutCreateInfo setLayoutInfo{};
+	setLayoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	setLayoutInfo.bindingCount = 1;
+	setLayoutInfo.pBindings = &binding;
+	VkDescriptorSetLayout setLayout;
+	if (vkCreateDescriptorSetLayout(device, &setLayoutInfo, nullptr, &setLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 };
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	VkDescriptorPool descriptorPool;
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo setInfo{};
+	setInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	setInfo.descriptorPool = descriptorPool;
+	setInfo.descriptorSetCount = 1;
+	setInfo.pSetLayouts = &setLayout;
+	VkDescriptorSet descriptorSet;
+	if (vkAllocateDescriptorSets(device, &setInfo, &descriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate benchmark descriptor set");
+	}
+	VkDescriptorBufferInfo descriptorBuffer = { buffer, 0, VK_WHOLE_SIZE };
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = 0;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &descriptorBuffer;
+	vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+	VkPipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &setLayout;
+	VkPipelineLayout pipelineLayout;
+	if (vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create benchmark pipeline layout");
+	}
+
+	VkShaderModule computeModule = createShaderModule(device, computeCode);
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = computeModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = pipelineLayout;
+	VkPipeline pipeline = app.getPipelineManager().createComputePipeline(pipelineInfo);
+	vkDestroyShaderModule(device, computeModule, nullptr);
+
+	uint32_t groupCount = 0;
+	app.addFrameRecordTask([&](VkCommandBuffer commandBuffer, uint32_t) {
+		dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+		dispatch->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+		dispatch->vkCmdDispatch(commandBuffer, groupCount, 1, 1);
+		//the next frame's dispatch reads and writes the same values
+		VkMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+		dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			0, 1, &barrier, 0, nullptr, 0, nullptr);
+	});
+
+	for (uint32_t groups : options.dispatchGroups) {
+		groupCount = groups;
+		ScenarioResult result;
+		result.name = "compute_dispatch_" + std::to_string(groups);
+		renderFrames(app, options.frames, result);
+		result.metrics.emplace_back("invocations_per_frame", static_cast<double>(groups) * groupSize);
+		report.scenarios.push_back(result);
+	}
+
+	vkDeviceWaitIdle(device);
+	app.getPipelineManager().destroyPipeline(pipeline);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, setLayout, nullptr);
+	app.getMemoryAllocator().destroyBuffer(buffer, allocation);
+	app.shutdown();
+}
+
+static void writeReport(std::ostream& out, const BenchmarkOptions& options, const BenchmarkReport& report)
+{
+	out << "{\n";
+	out << "  \"device\": \"" << report.deviceName << "\",\n";
+	out << "  \"driver\": \"" << report.driverName << "\",\n";
+	out << "  \"driver_info\": \"" << report.driverInfo << "\",\n";
+	out << "  \"frames\": " << options.frames << ",\n";
+	out << "  \"scenarios\": [";
+	for (size_t i = 0; i < report.scenarios.size(); i++) {
+		const ScenarioResult& result = report.scenarios[i];
+		out << (i > 0 ? "," : "") << "\n    { \"name\": \"" << result.name << "\"";
+		if (!result.skipped.empty()) {
+			out << ", \"skipped\": \"" << result.skipped << "\" }";
+			continue;
+		}
+
+		SampleStatistics statistics = computeStatistics(result.samples);
+		out << ", \"samples\": " << result.samples.size();
+		out << ", \"" << result.sampleName << "\": { \"mean\": " << statistics.mean << ", \"p50\": " << statistics.p50
+			<< ", \"p99\": " << statistics.p99 << ", \"max\": " << statistics.max << " }";
+		double perSample = result.samples.empty() ? 0.0 : static_cast<double>(result.hostAllocations) / result.samples.size();
+		out << ", \"host_allocations_per_sample\": " << perSample;
+		out << ", \"device_memory_objects\": " << result.memory.deviceMemoryCount;
+		out << ", \"sub_allocations\": " << result.memory.allocationCount;
+		out << ", \"reserved_bytes\": " << result.memory.reservedBytes;
+		for (const auto& metric : result.metrics) {
+			out << ", \"" << metric.first << "\": " << metric.second;
+		}
+		out << " }";
+	}
+	out << "\n  ]\n}\n";
+}
+
+static void setEnvironment(const char* name, const std::string& value)
+{
+#ifdef _WIN32
+	_putenv_s(name, value.c_str());
+#else
+	setenv(name, value.c_str(), 1);
+#endif
+}
+
+//--icd selects the driver manifest before the loader starts, --scenario may be repeated
+//and takes startup, swapchain, upload, draw or compute
+static BenchmarkOptions parseCommandLine(int argc, char** argv)
+{
+	BenchmarkOptions options;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--frames" && i + 1 < argc) {
+			options.frames = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		}
+		else if (arg == "--startup-runs" && i + 1 < argc) {
+			options.startupRuns = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		}
+		else if (arg == "--scenario" && i + 1 < argc) {
+			options.scenarios.insert(argv[++i]);
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			options.outputPath = argv[++i];
+		}
+		else if (arg == "--shader-dir" && i + 1 < argc) {
+			options.shaderDir = argv[++i];
+		}
+		else if (arg == "--pipeline-cache" && i + 1 < argc) {
+			options.pipelineCachePath = argv[++i];
+		}
+		else if (arg == "--icd" && i + 1 < argc) {
+			std::string manifest = argv[++i];
+			//older loaders only read the first, newer ones prefer the second
+			setEnvironment("VK_ICD_FILENAMES", manifest);
+			setEnvironment("VK_DRIVER_FILES", manifest);
+		}
+		else {
+			throw std::runtime_error("unknown benchmark argument " + arg);
+		}
+	}
+
+	return options;
+}
+
+int main(int argc, char** argv)
+{
+	try {
+		BenchmarkOptions options = parseCommandLine(argc, argv);
+		auto selected = [&options](const char* scenario) {
+			return options.scenarios.empty() || options.scenarios.count(scenario) > 0;
+		};
+
+		BenchmarkReport report;
+		if (selected("startup")) {
+			runStartup(options, report);
+		}
+		if (selected("swapchain")) {
+			runSwapChain(options, report);
+		}
+		if (selected("upload")) {
+			runUpload(options, report);
+		}
+		if (selected("draw")) {
+			runDrawCalls(options, report);
+		}
+		if (selected("compute")) {
+			runComputeDispatch(options, report);
+		}
+
+		if (options.outputPath.empty()) {
+			writeReport(std::cout, options, report);
+		}
+		else {
+			std::ofstream file(options.outputPath, std::ios::trunc);
+			writeReport(file, options, report);
+			if (!file) {
+				throw std::runtime_error("failed to write benchmark report " + options.outputPath);
+			}
+		}
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
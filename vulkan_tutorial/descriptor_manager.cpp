@@ -0,0 +1,256 @@
+﻿// descriptor_manager.cpp : the bindless descriptor set and its slot allocators
+//
+
+#include "descriptor_manager.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+void DescriptorSlotAllocator::init(uint32_t capacity)
+{
+	this->capacity = capacity;
+	nextUnused = 0;
+	freeSlots.clear();
+}
+
+uint32_t DescriptorSlotAllocator::allocate()
+{
+	if (!freeSlots.empty()) {
+		uint32_t slot = freeSlots.back();
+		freeSlots.pop_back();
+		return slot;
+	}
+	if (nextUnused == capacity) {
+		return invalidDescriptorSlot;
+	}
+
+	return nextUnused++;
+}
+
+void DescriptorSlotAllocator::free(uint32_t slot)
+{
+	freeSlots.push_back(slot);
+}
+
+void DescriptorManager::init(VkPhysicalDevice physicalDevice, VkDevice device, const DeviceDispatch& deviceDispatch,
+	uint32_t maxSampledImages, uint32_t maxStorageBuffers, uint32_t maxSamplers, const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+
+	VkPhysicalDeviceVulkan12Properties vulkan12Properties{};
+	vulkan12Properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2{};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &vulkan12Properties;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
+
+	//the set is visible to all stages, so both the per stage and the per set limits apply
+	maxSampledImages = std::min({ maxSampledImages, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		vulkan12Properties.maxDescriptorSetUpdateAfterBindSampledImages });
+	maxStorageBuffers = std::min({ maxStorageBuffers, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+		vulkan12Properties.maxDescriptorSetUpdateAfterBindStorageBuffers });
+	maxSamplers = std::min({ maxSamplers, vulkan12Properties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		vulkan12Properties.maxDescriptorSetUpdateAfterBindSamplers });
+	//some implementations also cap the sum of all resources in one stage
+	uint64_t totalResources = static_cast<uint64_t>(maxSampledImages) + maxStorageBuffers + maxSamplers;
+	if (totalResources > vulkan12Properties.maxPerStageUpdateAfterBindResources) {
+		double scale = static_cast<double>(vulkan12Properties.maxPerStageUpdateAfterBindResources) / totalResources;
+		maxSampledImages = static_cast<uint32_t>(maxSampledImages * scale);
+		maxStorageBuffers = static_cast<uint32_t>(maxStorageBuffers * scale);
+		maxSamplers = static_cast<uint32_t>(maxSamplers * scale);
+	}
+	sampledImageSlots.init(maxSampledImages);
+	storageBufferSlots.init(maxStorageBuffers);
+	samplerSlots.init(maxSamplers);
+
+	VkDescriptorSetLayoutBinding bindings[3]{};
+	bindings[0].binding = bindlessSampledImageBinding;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	bindings[0].descriptorCount = maxSampledImages;
+	bindings[1].binding = bindlessStorageBufferBinding;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = maxStorageBuffers;
+	bindings[2].binding = bindlessSamplerBinding;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	bindings[2].descriptorCount = maxSamplers;
+	//partially bound lets most slots stay empty, update unused while pending lets new
+	//slots be written while earlier frames that never touch them are still executing
+	VkDescriptorBindingFlags bindingFlags[3];
+	for (uint32_t i = 0; i < 3; i++) {
+		bindings[i].stageFlags = VK_SHADER_STAGE_ALL;
+		bindingFlags[i] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+			VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	}
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = 3;
+	bindingFlagsInfo.pBindingFlags = bindingFlags;
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = 3;
+	layoutInfo.pBindings = bindings;
+	if (vkCreateDescriptorSetLayout(vkDevice, &layoutInfo, allocationCallbacks, &setLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create bindless descriptor set layout");
+	}
+
+	VkDescriptorPoolSize poolSizes[3] = {
+		{ VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, maxSampledImages },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, maxStorageBuffers },
+		{ VK_DESCRIPTOR_TYPE_SAMPLER, maxSamplers }
+	};
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 3;
+	poolInfo.pPoolSizes = poolSizes;
+	if (vkCreateDescriptorPool(vkDevice, &poolInfo, allocationCallbacks, &descriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create bindless descriptor pool");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = descriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &setLayout;
+	if (vkAllocateDescriptorSets(vkDevice, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate bindless descriptor set");
+	}
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_ALL;
+	pushConstantRange.size = bindlessPushConstantSize;
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &setLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (vkCreatePipelineLayout(vkDevice, &pipelineLayoutInfo, allocationCallbacks, &pipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create bindless pipeline layout");
+	}
+}
+
+void DescriptorManager::destroy()
+{
+	vkDestroyPipelineLayout(vkDevice, pipelineLayout, allocationCallbacks);
+	//the set goes away with its pool
+	vkDestroyDescriptorPool(vkDevice, descriptorPool, allocationCallbacks);
+	vkDestroyDescriptorSetLayout(vkDevice, setLayout, allocationCallbacks);
+	retiredSlots.clear();
+}
+
+DescriptorSlotAllocator& DescriptorManager::slotsFor(DescriptorType type)
+{
+	switch (type) {
+	case DescriptorType::SampledImage:
+		return sampledImageSlots;
+	case DescriptorType::StorageBuffer:
+		return storageBufferSlots;
+	case DescriptorType::Sampler:
+	default:
+		return samplerSlots;
+	}
+}
+
+uint32_t DescriptorManager::allocateSlot(DescriptorType type, const char* typeName)
+{
+	uint32_t slot = slotsFor(type).allocate();
+	if (slot == invalidDescriptorSlot) {
+		throw std::runtime_error(std::string("out of bindless ") + typeName + " slots");
+	}
+	return slot;
+}
+
+uint32_t DescriptorManager::registerSampledImage(VkImageView imageView, VkImageLayout layout)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	uint32_t slot = allocateSlot(DescriptorType::SampledImage, "sampled image");
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageView = imageView;
+	imageInfo.imageLayout = layout;
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = bindlessSampledImageBinding;
+	write.dstArrayElement = slot;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+	write.pImageInfo = &imageInfo;
+	dispatch->vkUpdateDescriptorSets(vkDevice, 1, &write, 0, nullptr);
+	return slot;
+}
+
+uint32_t DescriptorManager::registerStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	uint32_t slot = allocateSlot(DescriptorType::StorageBuffer, "storage buffer");
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = bindlessStorageBufferBinding;
+	write.dstArrayElement = slot;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.pBufferInfo = &bufferInfo;
+	dispatch->vkUpdateDescriptorSets(vkDevice, 1, &write, 0, nullptr);
+	return slot;
+}
+
+uint32_t DescriptorManager::registerSampler(VkSampler sampler)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	uint32_t slot = allocateSlot(DescriptorType::Sampler, "sampler");
+	VkDescriptorImageInfo samplerInfo{};
+	samplerInfo.sampler = sampler;
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = descriptorSet;
+	write.dstBinding = bindlessSamplerBinding;
+	write.dstArrayElement = slot;
+	write.descriptorCount = 1;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+	write.pImageInfo = &samplerInfo;
+	dispatch->vkUpdateDescriptorSets(vkDevice, 1, &write, 0, nullptr);
+	return slot;
+}
+
+void DescriptorManager::release(DescriptorType type, uint32_t slot, uint64_t retireSerial)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	retiredSlots.push_back({ type, slot, retireSerial });
+}
+
+void DescriptorManager::releaseSlots(uint64_t completedSerial)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	auto it = retiredSlots.begin();
+	while (it != retiredSlots.end()) {
+		if (completedSerial >= it->retireSerial) {
+			slotsFor(it->type).free(it->slot);
+			it = retiredSlots.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void DescriptorManager::bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint)
+{
+	dispatch->vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+}
+
+uint32_t DescriptorManager::getUsedCount(DescriptorType type)
+{
+	std::lock_guard<std::mutex> lock(descriptorMutex);
+	return slotsFor(type).getUsedCount();
+}
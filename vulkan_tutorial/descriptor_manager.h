@@ -0,0 +1,95 @@
+﻿// descriptor_manager.h : one update-after-bind descriptor set holding every sampled image,
+// storage buffer and sampler, shaders index into its arrays with slots passed as push constants.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "device_dispatch.h"
+
+//binding numbers shared with shaders/bindless.glsl
+const uint32_t bindlessSampledImageBinding = 0;
+const uint32_t bindlessStorageBufferBinding = 1;
+const uint32_t bindlessSamplerBinding = 2;
+//size of the push constant block in the shared pipeline layout, 128 bytes is the
+//smallest maxPushConstantsSize an implementation may report
+const uint32_t bindlessPushConstantSize = 128;
+const uint32_t invalidDescriptorSlot = UINT32_MAX;
+
+enum class DescriptorType {
+	SampledImage,
+	StorageBuffer,
+	Sampler
+};
+
+//hands out the array elements of one binding, freed slots are reused before new ones
+class DescriptorSlotAllocator {
+public:
+	void init(uint32_t capacity);
+	//invalidDescriptorSlot once every slot is in use
+	uint32_t allocate();
+	void free(uint32_t slot);
+	uint32_t getCapacity() const { return capacity; }
+	uint32_t getUsedCount() const { return nextUnused - static_cast<uint32_t>(freeSlots.size()); }
+
+private:
+	uint32_t capacity = 0;
+	//slots at and above this index have never been handed out
+	uint32_t nextUnused = 0;
+	std::vector<uint32_t> freeSlots;
+};
+
+class DescriptorManager {
+public:
+	//the capacities are clamped to the device's update-after-bind limits
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, const DeviceDispatch& deviceDispatch,
+		uint32_t maxSampledImages, uint32_t maxStorageBuffers, uint32_t maxSamplers,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+
+	//each returns the slot shaders index the matching array with, the descriptor is
+	//written right away and visible to every command buffer submitted afterwards
+	uint32_t registerSampledImage(VkImageView imageView, VkImageLayout layout);
+	uint32_t registerStorageBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+	uint32_t registerSampler(VkSampler sampler);
+	//frames up to retireSerial may still read the slot, it is handed out again only
+	//after releaseSlots has been called with a completed serial at least that high
+	void release(DescriptorType type, uint32_t slot, uint64_t retireSerial);
+	void releaseSlots(uint64_t completedSerial);
+
+	//binds the set as set 0 of the shared layout, bind state is not inherited so every
+	//secondary command buffer that draws or dispatches has to call this itself
+	void bind(VkCommandBuffer commandBuffer, VkPipelineBindPoint bindPoint);
+	VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+	//the bindless set plus bindlessPushConstantSize bytes visible to all stages, pipelines
+	//created with it are layout compatible so one bind covers all of them
+	VkPipelineLayout getPipelineLayout() const { return pipelineLayout; }
+	uint32_t getUsedCount(DescriptorType type);
+
+private:
+	struct RetiredSlot {
+		DescriptorType type;
+		uint32_t slot;
+		uint64_t retireSerial;
+	};
+
+	DescriptorSlotAllocator& slotsFor(DescriptorType type);
+	uint32_t allocateSlot(DescriptorType type, const char* typeName);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+	VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+	DescriptorSlotAllocator sampledImageSlots;
+	DescriptorSlotAllocator storageBufferSlots;
+	DescriptorSlotAllocator samplerSlots;
+	std::vector<RetiredSlot> retiredSlots;
+	//vkUpdateDescriptorSets needs the set externally synchronized, registration may
+	//happen from the worker threads
+	std::mutex descriptorMutex;
+};
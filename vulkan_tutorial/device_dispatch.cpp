@@ -0,0 +1,46 @@
+﻿// device_dispatch.cpp : loads the dispatch table through vkGetDeviceProcAddr
+//
+
+#include "device_dispatch.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+void DeviceDispatch::load(VkDevice device, const std::vector<const char*>& extensions)
+{
+	std::string missing;
+	auto loadFunction = [&](const char* name, const char* extension) {
+		PFN_vkVoidFunction function = vkGetDeviceProcAddr(device, name);
+		if (function == nullptr) {
+			missing += std::string(missing.empty() ? "" : ", ") + name + " (" + extension + ")";
+		}
+		return function;
+	};
+	auto enabled = [&](const char* extension) {
+		return std::any_of(extensions.begin(), extensions.end(),
+			[extension](const char* name) { return strcmp(name, extension) == 0; });
+	};
+
+	*this = DeviceDispatch{};
+#define VKAPP_LOAD_FUNCTION(name) name = reinterpret_cast<PFN_##name>(loadFunction(#name, extension));
+	const char* extension = "core";
+	VKAPP_DEVICE_FUNCTIONS(VKAPP_LOAD_FUNCTION)
+	extension = VK_KHR_SWAPCHAIN_EXTENSION_NAME;
+	if (enabled(extension)) {
+		VKAPP_SWAPCHAIN_FUNCTIONS(VKAPP_LOAD_FUNCTION)
+	}
+	extension = VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
+	if (enabled(extension)) {
+		VKAPP_SYNCHRONIZATION2_FUNCTIONS(VKAPP_LOAD_FUNCTION)
+	}
+	extension = VK_KHR_PRESENT_WAIT_EXTENSION_NAME;
+	if (enabled(extension)) {
+		VKAPP_PRESENT_WAIT_FUNCTIONS(VKAPP_LOAD_FUNCTION)
+	}
+#undef VKAPP_LOAD_FUNCTION
+
+	if (!missing.empty()) {
+		throw std::runtime_error("device is missing " + missing);
+	}
+}
@@ -0,0 +1,73 @@
+﻿// device_dispatch.h : device level entry points loaded straight from the driver, so the
+// commands recorded and submitted every frame skip the loader's trampolines.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+//called per frame or per command, core up to Vulkan 1.2
+#define VKAPP_DEVICE_FUNCTIONS(X) \
+	X(vkQueueSubmit) \
+	X(vkWaitForFences) \
+	X(vkResetFences) \
+	X(vkWaitSemaphores) \
+	X(vkGetSemaphoreCounterValue) \
+	X(vkResetCommandPool) \
+	X(vkAllocateCommandBuffers) \
+	X(vkBeginCommandBuffer) \
+	X(vkEndCommandBuffer) \
+	X(vkUpdateDescriptorSets) \
+	X(vkGetQueryPoolResults) \
+	X(vkCmdPipelineBarrier) \
+	X(vkCmdBeginRenderPass) \
+	X(vkCmdEndRenderPass) \
+	X(vkCmdExecuteCommands) \
+	X(vkCmdBindPipeline) \
+	X(vkCmdBindDescriptorSets) \
+	X(vkCmdBindVertexBuffers) \
+	X(vkCmdBindIndexBuffer) \
+	X(vkCmdPushConstants) \
+	X(vkCmdSetViewport) \
+	X(vkCmdSetScissor) \
+	X(vkCmdDraw) \
+	X(vkCmdDrawIndexed) \
+	X(vkCmdDrawIndexedIndirectCount) \
+	X(vkCmdDispatch) \
+	X(vkCmdFillBuffer) \
+	X(vkCmdCopyBuffer) \
+	X(vkCmdCopyBufferToImage) \
+	X(vkCmdCopyImageToBuffer) \
+	X(vkCmdClearColorImage) \
+	X(vkCmdResetQueryPool) \
+	X(vkCmdWriteTimestamp) \
+	X(vkCmdBeginQuery) \
+	X(vkCmdEndQuery)
+
+//VK_KHR_swapchain
+#define VKAPP_SWAPCHAIN_FUNCTIONS(X) \
+	X(vkAcquireNextImageKHR) \
+	X(vkQueuePresentKHR)
+
+//VK_KHR_synchronization2
+#define VKAPP_SYNCHRONIZATION2_FUNCTIONS(X) \
+	X(vkCmdPipelineBarrier2KHR)
+
+//VK_KHR_present_wait
+#define VKAPP_PRESENT_WAIT_FUNCTIONS(X) \
+	X(vkWaitForPresentKHR)
+
+//one per device, filled once by load and only read afterwards, so any thread may call
+//through it. functions of extensions the device was not created with stay null
+struct DeviceDispatch {
+#define VKAPP_DECLARE_FUNCTION(name) PFN_##name name = nullptr;
+	VKAPP_DEVICE_FUNCTIONS(VKAPP_DECLARE_FUNCTION)
+	VKAPP_SWAPCHAIN_FUNCTIONS(VKAPP_DECLARE_FUNCTION)
+	VKAPP_SYNCHRONIZATION2_FUNCTIONS(VKAPP_DECLARE_FUNCTION)
+	VKAPP_PRESENT_WAIT_FUNCTIONS(VKAPP_DECLARE_FUNCTION)
+#undef VKAPP_DECLARE_FUNCTION
+
+	//extensions is what vkCreateDevice was given. throws naming every function the driver
+	//did not return, rather than leaving a null pointer for the first call to find
+	void load(VkDevice device, const std::vector<const char*>& extensions);
+};
@@ -0,0 +1,85 @@
+﻿// device_features.cpp : feature chain query and comparison
+//
+
+#include "device_features.h"
+#include <cstddef>
+#include <cstring>
+
+//past sType and pNext every feature struct is nothing but VkBool32 members,
+//so they can be compared as plain arrays from the first feature to the end of the
+//last one. sizeof would also count the tail padding 64 bit builds add after an odd
+//number of members, which is not guaranteed to be zero
+template <typename FeatureStruct>
+static bool containsFeatures(const FeatureStruct& available, const FeatureStruct& required, size_t firstFeatureOffset,
+	size_t lastFeatureOffset)
+{
+	size_t count = (lastFeatureOffset - firstFeatureOffset) / sizeof(VkBool32) + 1;
+	auto availableFeatures = reinterpret_cast<const VkBool32*>(reinterpret_cast<const char*>(&available) + firstFeatureOffset);
+	auto requiredFeatures = reinterpret_cast<const VkBool32*>(reinterpret_cast<const char*>(&required) + firstFeatureOffset);
+	for (size_t i = 0; i < count; i++) {
+		if (requiredFeatures[i] && !availableFeatures[i]) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+VkPhysicalDeviceFeatures2* DeviceFeatureChain::link()
+{
+	void* next = nullptr;
+	if (hasPresentWait) {
+		presentWait.pNext = next;
+		presentId.pNext = &presentWait;
+		next = &presentId;
+	}
+	if (hasSynchronization2) {
+		synchronization2.pNext = next;
+		next = &synchronization2;
+	}
+	features2.pNext = &vulkan11;
+	vulkan11.pNext = &vulkan12;
+	vulkan12.pNext = next;
+	return &features2;
+}
+
+bool DeviceFeatureChain::contains(const DeviceFeatureChain& required) const
+{
+	return containsFeatures(features2.features, required.features2.features, 0,
+			offsetof(VkPhysicalDeviceFeatures, inheritedQueries)) &&
+		containsFeatures(vulkan11, required.vulkan11, offsetof(VkPhysicalDeviceVulkan11Features, storageBuffer16BitAccess),
+			offsetof(VkPhysicalDeviceVulkan11Features, shaderDrawParameters)) &&
+		containsFeatures(vulkan12, required.vulkan12, offsetof(VkPhysicalDeviceVulkan12Features, samplerMirrorClampToEdge),
+			offsetof(VkPhysicalDeviceVulkan12Features, subgroupBroadcastDynamicId)) &&
+		(!required.synchronization2.synchronization2 || synchronization2.synchronization2) &&
+		(!required.presentId.presentId || presentId.presentId) &&
+		(!required.presentWait.presentWait || presentWait.presentWait);
+}
+
+DeviceFeatureChain DeviceFeatureChain::query(VkPhysicalDevice device, const std::vector<VkExtensionProperties>& extensions)
+{
+	DeviceFeatureChain chain;
+	bool hasPresentId = false;
+	for (const auto& extension : extensions) {
+		if (strcmp(extension.extensionName, VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME) == 0) {
+			chain.hasSynchronization2 = true;
+		}
+		else if (strcmp(extension.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0) {
+			hasPresentId = true;
+		}
+		else if (strcmp(extension.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0) {
+			chain.hasPresentWait = true;
+		}
+	}
+	chain.hasPresentWait = chain.hasPresentWait && hasPresentId;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+	if (properties.apiVersion >= VK_API_VERSION_1_2) {
+		vkGetPhysicalDeviceFeatures2(device, chain.link());
+	}
+	else {
+		vkGetPhysicalDeviceFeatures(device, &chain.features2.features);
+	}
+
+	return chain;
+}
@@ -0,0 +1,29 @@
+﻿// device_features.h : the feature structs handed to vkGetPhysicalDeviceFeatures2 and
+// vkCreateDevice, one chain type describes both what a device supports and what we enable.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct DeviceFeatureChain {
+	VkPhysicalDeviceFeatures2 features2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+	VkPhysicalDeviceVulkan11Features vulkan11{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES };
+	VkPhysicalDeviceVulkan12Features vulkan12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR };
+	VkPhysicalDevicePresentIdFeaturesKHR presentId{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR };
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWait{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR };
+	//extension structs are only chained when the device exposes the extension,
+	//for an enabled chain that extension has to be enabled as well
+	bool hasSynchronization2 = false;
+	//VK_KHR_present_id and VK_KHR_present_wait, one is no use without the other
+	bool hasPresentWait = false;
+
+	//the pNext pointers are rebuilt on every call so the chain survives being copied
+	VkPhysicalDeviceFeatures2* link();
+	//true when every feature set in required is set here as well
+	bool contains(const DeviceFeatureChain& required) const;
+
+	//a device below 1.2 only fills in the 1.0 features, the rest stays VK_FALSE
+	static DeviceFeatureChain query(VkPhysicalDevice device, const std::vector<VkExtensionProperties>& extensions);
+};
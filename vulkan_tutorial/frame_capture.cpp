@@ -0,0 +1,300 @@
+﻿// frame_capture.cpp : readback copies, the slot ring and the ppm and y4m writers
+//
+
+#include "frame_capture.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+
+void FrameCapture::init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+	const std::string& path, CaptureFormat format, uint32_t ringSize, uint32_t frameRate)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocator = &allocator;
+	this->path = path;
+	this->format = format;
+	this->frameRate = std::max(frameRate, 1u);
+	//the buffers are created by the first frame that uses them, sized to that frame
+	slots.resize(std::max(ringSize, 1u));
+	nextSlot = 0;
+	stopping = false;
+	writer = std::thread(&FrameCapture::write, this);
+}
+
+void FrameCapture::destroy()
+{
+	if (!writer.joinable()) {
+		return;
+	}
+
+	collect(UINT64_MAX);
+	{
+		std::lock_guard<std::mutex> lock(slotMutex);
+		stopping = true;
+	}
+	writeCondition.notify_one();
+	writer.join();
+
+	for (auto& slot : slots) {
+		if (slot.buffer != VK_NULL_HANDLE) {
+			allocator->destroyBuffer(slot.buffer, slot.allocation);
+		}
+	}
+	slots.clear();
+	vkDevice = VK_NULL_HANDLE;
+}
+
+bool FrameCapture::supportsFormat(VkFormat format)
+{
+	return format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB ||
+		format == VK_FORMAT_R8G8B8A8_UNORM || format == VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+void FrameCapture::record(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout finalLayout, VkFormat format,
+	VkExtent2D extent, uint64_t frameSerial)
+{
+	//slots are taken strictly in ring order, so frames reach the writer in order and a
+	//slow disk shows up as dropped frames instead of a stalled frame loop
+	Slot* slot = nullptr;
+	if (isEnabled()) {
+		std::lock_guard<std::mutex> lock(slotMutex);
+		if (slots[nextSlot].state == SlotState::Free) {
+			slot = &slots[nextSlot];
+			slot->state = SlotState::Pending;
+			slot->frameSerial = frameSerial;
+			nextSlot = (nextSlot + 1) % static_cast<uint32_t>(slots.size());
+			statistics.capturedFrames++;
+		}
+		else {
+			statistics.droppedFrames++;
+		}
+	}
+
+	VkBufferMemoryBarrier toHost{};
+	uint32_t bufferBarrierCount = 0;
+	if (slot != nullptr) {
+		//a free slot's last copy has completed and been written, so its buffer can be
+		//replaced right away when the size changed
+		VkDeviceSize size = static_cast<VkDeviceSize>(extent.width) * extent.height * 4;
+		if (slot->size != size) {
+			if (slot->buffer != VK_NULL_HANDLE) {
+				allocator->destroyBuffer(slot->buffer, slot->allocation);
+			}
+			VkBufferCreateInfo bufferInfo{};
+			bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+			bufferInfo.size = size;
+			bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+			bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			//host visible and coherent, mapped for as long as the buffer lives
+			allocator->createBuffer(bufferInfo, MemoryUsage::GpuToCpu, slot->buffer, slot->allocation);
+			slot->size = size;
+		}
+		slot->extent = extent;
+		slot->swapRedBlue = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+
+		//the frame's last barrier already made the image visible to transfer reads
+		VkBufferImageCopy region{};
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.layerCount = 1;
+		region.imageExtent = { extent.width, extent.height, 1 };
+		dispatch->vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot->buffer, 1, &region);
+
+		//makes the copy visible to the host once the frame's fence has signaled
+		toHost.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		toHost.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		toHost.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		toHost.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toHost.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		toHost.buffer = slot->buffer;
+		toHost.size = VK_WHOLE_SIZE;
+		bufferBarrierCount = 1;
+	}
+
+	//a dropped frame still has to reach finalLayout. reads need no availability, the
+	//transition only waits for the copy
+	VkImageMemoryBarrier toFinal{};
+	toFinal.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toFinal.srcAccessMask = 0;
+	toFinal.dstAccessMask = 0;
+	toFinal.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	toFinal.newLayout = finalLayout;
+	toFinal.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toFinal.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toFinal.image = image;
+	toFinal.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	toFinal.subresourceRange.levelCount = 1;
+	toFinal.subresourceRange.layerCount = 1;
+	uint32_t imageBarrierCount = finalLayout != VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL ? 1 : 0;
+	if (bufferBarrierCount + imageBarrierCount > 0) {
+		dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+			bufferBarrierCount, &toHost, imageBarrierCount, &toFinal);
+	}
+}
+
+void FrameCapture::collect(uint64_t completedSerial)
+{
+	if (!isEnabled()) {
+		return;
+	}
+
+	bool queued = false;
+	{
+		std::lock_guard<std::mutex> lock(slotMutex);
+		std::vector<uint32_t> ready;
+		for (uint32_t i = 0; i < slots.size(); i++) {
+			if (slots[i].state == SlotState::Pending && slots[i].frameSerial <= completedSerial) {
+				ready.push_back(i);
+			}
+		}
+		std::sort(ready.begin(), ready.end(),
+			[this](uint32_t a, uint32_t b) { return slots[a].frameSerial < slots[b].frameSerial; });
+		for (uint32_t index : ready) {
+			slots[index].state = SlotState::Writing;
+			writeQueue.push_back(index);
+		}
+		queued = !ready.empty();
+	}
+	if (queued) {
+		writeCondition.notify_one();
+	}
+}
+
+CaptureStatistics FrameCapture::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(slotMutex);
+	return statistics;
+}
+
+void FrameCapture::write()
+{
+	std::unique_lock<std::mutex> lock(slotMutex);
+	while (true) {
+		writeCondition.wait(lock, [this]() { return stopping || !writeQueue.empty(); });
+		//destroy queues everything still pending before stopping, so that gets written too
+		if (writeQueue.empty()) {
+			break;
+		}
+		Slot& slot = slots[writeQueue.front()];
+		writeQueue.pop_front();
+
+		//the slot is the writer's until it is marked free again, the mapped memory is read
+		//in place instead of being copied out on the frame loop's thread
+		lock.unlock();
+		const uint8_t* pixels = static_cast<const uint8_t*>(slot.allocation.mapped);
+		uint64_t bytes = format == CaptureFormat::Ppm ? writePpm(slot, pixels) : writeY4m(slot, pixels);
+		if (bytes == 0 && !reportedFailure) {
+			std::cerr << "[Vulkan Log] : failed to write frame capture to " << path << std::endl;
+			reportedFailure = true;
+		}
+		lock.lock();
+
+		slot.state = SlotState::Free;
+		if (bytes > 0) {
+			statistics.writtenFrames++;
+			statistics.writtenBytes += bytes;
+		}
+	}
+	stream.close();
+}
+
+uint64_t FrameCapture::writePpm(const Slot& slot, const uint8_t* pixels)
+{
+	//numbered by frame serial, gaps in the sequence are dropped frames
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), "_%06llu.ppm", static_cast<unsigned long long>(slot.frameSerial));
+	std::ofstream file(path + suffix, std::ios::binary | std::ios::trunc);
+	if (!file) {
+		return 0;
+	}
+
+	std::string header = "P6\n" + std::to_string(slot.extent.width) + " " + std::to_string(slot.extent.height) + "\n255\n";
+	file << header;
+	uint32_t red = slot.swapRedBlue ? 2 : 0;
+	uint32_t blue = slot.swapRedBlue ? 0 : 2;
+	pixelBuffer.resize(static_cast<size_t>(slot.extent.width) * 3);
+	for (uint32_t y = 0; y < slot.extent.height; y++) {
+		const uint8_t* row = pixels + static_cast<size_t>(y) * slot.extent.width * 4;
+		for (uint32_t x = 0; x < slot.extent.width; x++) {
+			pixelBuffer[x * 3 + 0] = row[x * 4 + red];
+			pixelBuffer[x * 3 + 1] = row[x * 4 + 1];
+			pixelBuffer[x * 3 + 2] = row[x * 4 + blue];
+		}
+		file.write(reinterpret_cast<const char*>(pixelBuffer.data()), pixelBuffer.size());
+	}
+	return file ? header.size() + pixelBuffer.size() * slot.extent.height : 0;
+}
+
+uint64_t FrameCapture::writeY4m(const Slot& slot, const uint8_t* pixels)
+{
+	uint32_t width = slot.extent.width;
+	uint32_t height = slot.extent.height;
+	//a y4m stream has one frame size, after a resize the frames go to a new stream,
+	//capture_1.y4m next to capture.y4m and so on
+	if (!stream.is_open() || width != streamExtent.width || height != streamExtent.height) {
+		stream.close();
+		std::string name = path;
+		if (streamIndex > 0) {
+			size_t dot = path.find_last_of('.');
+			size_t separator = path.find_last_of("/\\");
+			if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+				dot = path.size();
+			}
+			name = path.substr(0, dot) + "_" + std::to_string(streamIndex) + path.substr(dot);
+		}
+		streamIndex++;
+		streamExtent = slot.extent;
+		stream.open(name, std::ios::binary | std::ios::trunc);
+		//full range bt.601, which is what C420jpeg means to ffmpeg
+		stream << "YUV4MPEG2 W" << width << " H" << height << " F" << frameRate << ":1 Ip A1:1 C420jpeg\n";
+	}
+	if (!stream) {
+		return 0;
+	}
+
+	uint32_t red = slot.swapRedBlue ? 2 : 0;
+	uint32_t blue = slot.swapRedBlue ? 0 : 2;
+	uint32_t chromaWidth = (width + 1) / 2;
+	uint32_t chromaHeight = (height + 1) / 2;
+	size_t lumaSize = static_cast<size_t>(width) * height;
+	size_t chromaSize = static_cast<size_t>(chromaWidth) * chromaHeight;
+	pixelBuffer.resize(lumaSize + chromaSize * 2);
+	uint8_t* lumaPlane = pixelBuffer.data();
+	uint8_t* uPlane = lumaPlane + lumaSize;
+	uint8_t* vPlane = uPlane + chromaSize;
+
+	for (uint32_t y = 0; y < height; y++) {
+		const uint8_t* row = pixels + static_cast<size_t>(y) * width * 4;
+		for (uint32_t x = 0; x < width; x++) {
+			int r = row[x * 4 + red], g = row[x * 4 + 1], b = row[x * 4 + blue];
+			lumaPlane[static_cast<size_t>(y) * width + x] = static_cast<uint8_t>((77 * r + 150 * g + 29 * b + 128) >> 8);
+		}
+	}
+	//chroma is the average of each 2x2 block, the last row and column repeat on odd sizes
+	for (uint32_t cy = 0; cy < chromaHeight; cy++) {
+		for (uint32_t cx = 0; cx < chromaWidth; cx++) {
+			int r = 0, g = 0, b = 0;
+			for (uint32_t dy = 0; dy < 2; dy++) {
+				for (uint32_t dx = 0; dx < 2; dx++) {
+					uint32_t x = std::min(cx * 2 + dx, width - 1);
+					uint32_t y = std::min(cy * 2 + dy, height - 1);
+					const uint8_t* pixel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+					r += pixel[red];
+					g += pixel[1];
+					b += pixel[blue];
+				}
+			}
+			r /= 4;
+			g /= 4;
+			b /= 4;
+			size_t index = static_cast<size_t>(cy) * chromaWidth + cx;
+			uPlane[index] = static_cast<uint8_t>(std::clamp(((-43 * r - 85 * g + 128 * b + 128) >> 8) + 128, 0, 255));
+			vPlane[index] = static_cast<uint8_t>(std::clamp(((128 * r - 107 * g - 21 * b + 128) >> 8) + 128, 0, 255));
+		}
+	}
+
+	stream << "FRAME\n";
+	stream.write(reinterpret_cast<const char*>(pixelBuffer.data()), pixelBuffer.size());
+	return stream ? pixelBuffer.size() + 6 : 0;
+}
@@ -0,0 +1,105 @@
+﻿// frame_capture.h : copies every finished frame into a ring of mapped readback buffers
+// and streams them to disk from a writer thread, without the frame loop waiting on either.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "memory_allocator.h"
+#include "device_dispatch.h"
+
+enum class CaptureFormat {
+	//one binary rgb file per frame, path_000001.ppm and so on
+	Ppm,
+	//a single uncompressed YUV4MPEG2 4:2:0 stream, playable and encodable by ffmpeg
+	Y4m
+};
+
+struct CaptureStatistics {
+	uint64_t capturedFrames = 0;
+	//frames skipped because every readback buffer was still waiting for the gpu or the disk
+	uint64_t droppedFrames = 0;
+	uint64_t writtenFrames = 0;
+	uint64_t writtenBytes = 0;
+};
+
+class FrameCapture {
+public:
+	//ringSize readback buffers are kept, enough for the frames in flight plus the frames
+	//queued for the writer, anything beyond that is dropped rather than waited for.
+	//frameRate only goes into the y4m header
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+		const std::string& path, CaptureFormat format, uint32_t ringSize, uint32_t frameRate);
+	//writes out every frame already collected, the device must be idle
+	void destroy();
+	bool isEnabled() const { return writer.joinable(); }
+	//false for formats other than 8 bit rgba or bgra
+	static bool supportsFormat(VkFormat format);
+
+	//copies image into a free readback buffer, recorded at the end of the frame's command
+	//buffer. the frame must leave the image in TRANSFER_SRC_OPTIMAL behind a barrier to
+	//transfer reads, it is moved to finalLayout afterwards, also when the frame is dropped
+	void record(VkCommandBuffer commandBuffer, VkImage image, VkImageLayout finalLayout, VkFormat format,
+		VkExtent2D extent, uint64_t frameSerial);
+	//hands the frames whose serial completed to the writer
+	void collect(uint64_t completedSerial);
+
+	CaptureStatistics getStatistics();
+
+private:
+	enum class SlotState {
+		Free,
+		//copy recorded, waiting for the frame to complete
+		Pending,
+		//with the writer, which frees it once the frame is on disk
+		Writing
+	};
+
+	struct Slot {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation allocation;
+		VkDeviceSize size = 0;
+		VkExtent2D extent{};
+		//bgra byte order, otherwise rgba
+		bool swapRedBlue = false;
+		uint64_t frameSerial = 0;
+		SlotState state = SlotState::Free;
+	};
+
+	void write();
+	//both return the bytes written, 0 when the file could not be written
+	uint64_t writePpm(const Slot& slot, const uint8_t* pixels);
+	uint64_t writeY4m(const Slot& slot, const uint8_t* pixels);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	MemoryAllocator* allocator = nullptr;
+	std::string path;
+	CaptureFormat format = CaptureFormat::Y4m;
+	uint32_t frameRate = 60;
+
+	//slot states and the writer queue, the buffers of a Writing slot belong to the writer
+	std::mutex slotMutex;
+	std::condition_variable writeCondition;
+	std::vector<Slot> slots;
+	uint32_t nextSlot = 0;
+	std::deque<uint32_t> writeQueue;
+	bool stopping = false;
+	CaptureStatistics statistics;
+
+	//writer thread only
+	std::thread writer;
+	std::ofstream stream;
+	VkExtent2D streamExtent{};
+	uint32_t streamIndex = 0;
+	//the converted frame, or one row of it for ppm
+	std::vector<uint8_t> pixelBuffer;
+	bool reportedFailure = false;
+};
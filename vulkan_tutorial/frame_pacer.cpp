@@ -0,0 +1,121 @@
+﻿// frame_pacer.cpp : queued frame limit, frame rate cap and latency samples
+//
+
+#include "frame_pacer.h"
+#include <algorithm>
+#include <thread>
+
+//a minimized or occluded window may hold presentation back indefinitely, after this
+//long a frame is given up on and the next one starts anyway
+static const uint64_t queuedFrameTimeout = 1000000000ull;
+
+void FramePacer::init(VkDevice device, const DeviceDispatch& deviceDispatch, VkSemaphore graphicsTimeline,
+	double maxFrameRate, uint32_t maxQueuedFrames)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->graphicsTimeline = graphicsTimeline;
+	this->maxQueuedFrames = maxQueuedFrames;
+	//null unless the device was created with VK_KHR_present_wait
+	waitForPresent = dispatch->vkWaitForPresentKHR;
+	statistics.presentWait = waitForPresent != nullptr;
+	if (maxFrameRate > 0.0) {
+		framePeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(1.0 / maxFrameRate));
+	}
+	nextFrameTime = std::chrono::steady_clock::now();
+	inputTime = nextFrameTime;
+}
+
+void FramePacer::setSwapChain(VkSwapchainKHR swapChain, uint64_t firstPresentId)
+{
+	vkSwapChain = swapChain;
+	this->firstPresentId = firstPresentId;
+}
+
+bool FramePacer::waitFrame(const PendingFrame& frame, uint64_t timeout)
+{
+	if (waitForPresent != nullptr && vkSwapChain != VK_NULL_HANDLE && frame.serial >= firstPresentId) {
+		VkResult result = waitForPresent(vkDevice, vkSwapChain, frame.serial, timeout);
+		if (result == VK_SUCCESS || result == VK_SUBOPTIMAL_KHR) {
+			return true;
+		}
+		if (result == VK_TIMEOUT) {
+			return false;
+		}
+		//out of date or lost, the frame will never be presented, completion is the best left
+	}
+
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &graphicsTimeline;
+	waitInfo.pValues = &frame.graphicsValue;
+	return dispatch->vkWaitSemaphores(vkDevice, &waitInfo, timeout) == VK_SUCCESS;
+}
+
+void FramePacer::addSample(const PendingFrame& frame)
+{
+	double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame.inputTime).count();
+	statistics.samples++;
+	latencySum += latency;
+	statistics.averageLatency = latencySum / statistics.samples;
+	statistics.maxLatency = std::max(statistics.maxLatency, latency);
+	statistics.lastLatency = latency;
+}
+
+void FramePacer::beginFrame(uint64_t frameSerial)
+{
+	if (vkDevice == VK_NULL_HANDLE) {
+		return;
+	}
+
+	auto waitStart = std::chrono::steady_clock::now();
+	//frames that would leave more than maxQueuedFrames ahead of this one are waited for,
+	//the newer ones are only checked. a frame found done without waiting finished some
+	//time since the last check, so its sample may run long by up to a frame
+	while (!pending.empty()) {
+		const PendingFrame& frame = pending.front();
+		bool limit = maxQueuedFrames > 0 && frame.serial + maxQueuedFrames < frameSerial;
+		if (waitFrame(frame, limit ? queuedFrameTimeout : 0)) {
+			addSample(frame);
+		}
+		else if (!limit) {
+			break;
+		}
+		pending.pop_front();
+	}
+
+	//sleeping before input is read keeps the cap from adding to the latency
+	if (framePeriod.count() > 0) {
+		auto now = std::chrono::steady_clock::now();
+		if (now < nextFrameTime) {
+			std::this_thread::sleep_until(nextFrameTime);
+		}
+		//a late frame starts the schedule over instead of rushing the next ones to catch up
+		nextFrameTime = std::max(nextFrameTime, now) + framePeriod;
+	}
+	statistics.pacingWait += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
+}
+
+void FramePacer::frameSubmitted(uint64_t frameSerial, uint64_t graphicsValue)
+{
+	if (vkDevice == VK_NULL_HANDLE) {
+		return;
+	}
+
+	pending.push_back({ frameSerial, graphicsValue, inputTime });
+}
+
+void FramePacer::chainPresentId(VkPresentInfoKHR& presentInfo, uint64_t frameSerial)
+{
+	if (waitForPresent == nullptr) {
+		return;
+	}
+
+	presentId = frameSerial;
+	presentIdInfo.swapchainCount = 1;
+	presentIdInfo.pPresentIds = &presentId;
+	presentIdInfo.pNext = presentInfo.pNext;
+	presentInfo.pNext = &presentIdInfo;
+}
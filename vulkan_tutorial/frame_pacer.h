@@ -0,0 +1,77 @@
+﻿// frame_pacer.h : caps the frame rate and how many frames wait for presentation, and
+// measures how long input sampled at the start of a frame takes to reach the screen.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include "device_dispatch.h"
+
+struct FramePacingStatistics {
+	//frames whose latency was observed
+	uint64_t samples = 0;
+	double averageLatency = 0.0;
+	double maxLatency = 0.0;
+	double lastLatency = 0.0;
+	//milliseconds spent in beginFrame waiting on queued frames or the frame rate cap
+	double pacingWait = 0.0;
+	//true when latency ends at presentation, false when it ends when the gpu finished
+	//the frame, which is all the timeline fallback can observe
+	bool presentWait = false;
+};
+
+class FramePacer {
+public:
+	//presentation is waited on when the device was created with VK_KHR_present_id and
+	//VK_KHR_present_wait, without them the graphics timeline stands in for it.
+	//maxFrameRate 0 leaves the rate to the present mode, maxQueuedFrames 0 only limits
+	//the queue to the frames in flight
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, VkSemaphore graphicsTimeline, double maxFrameRate,
+		uint32_t maxQueuedFrames);
+	//ids only grow within a swapchain, frames from before firstPresentId belonged to the
+	//previous one and are waited on through the timeline
+	void setSwapChain(VkSwapchainKHR swapChain, uint64_t firstPresentId);
+
+	//call before input is polled, waits until at most maxQueuedFrames frames are still
+	//ahead of the screen and for the frame rate cap, then collects finished latencies
+	void beginFrame(uint64_t frameSerial);
+	//right after glfwPollEvents, the start of the frame's latency
+	void markInput() { inputTime = std::chrono::steady_clock::now(); }
+	//graphicsValue is what the frame's submission signals on the graphics timeline
+	void frameSubmitted(uint64_t frameSerial, uint64_t graphicsValue);
+	//adds the frame's present id to presentInfo when presentation can be waited on,
+	//presentInfo keeps pointing into the pacer until the next call
+	void chainPresentId(VkPresentInfoKHR& presentInfo, uint64_t frameSerial);
+
+	const FramePacingStatistics& getStatistics() const { return statistics; }
+
+private:
+	struct PendingFrame {
+		uint64_t serial;
+		uint64_t graphicsValue;
+		std::chrono::steady_clock::time_point inputTime;
+	};
+
+	//timeout 0 only checks, true once the frame is on screen or, without present wait, done
+	bool waitFrame(const PendingFrame& frame, uint64_t timeout);
+	void addSample(const PendingFrame& frame);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	VkSemaphore graphicsTimeline = VK_NULL_HANDLE;
+	PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+	VkSwapchainKHR vkSwapChain = VK_NULL_HANDLE;
+	uint64_t firstPresentId = 0;
+	std::chrono::steady_clock::duration framePeriod{ 0 };
+	std::chrono::steady_clock::time_point nextFrameTime;
+	uint32_t maxQueuedFrames = 0;
+	std::chrono::steady_clock::time_point inputTime;
+	//submitted frames whose latency has not been observed yet, oldest first
+	std::deque<PendingFrame> pending;
+	VkPresentIdKHR presentIdInfo{ VK_STRUCTURE_TYPE_PRESENT_ID_KHR };
+	uint64_t presentId = 0;
+	double latencySum = 0.0;
+	FramePacingStatistics statistics;
+};
@@ -0,0 +1,293 @@
+﻿// gpu_culling.cpp : the culling compute pass and the buffers it reads and writes
+//
+
+#include "gpu_culling.h"
+#include <cstring>
+#include <stdexcept>
+#include <glm/geometric.hpp>
+
+//matches the push constant block of shaders/cull.comp
+struct CullPushConstants {
+	uint32_t paramsSlot;
+	uint32_t boundingSphereSlot;
+	uint32_t meshIndexSlot;
+	uint32_t meshSlot;
+	uint32_t drawCommandSlot;
+	uint32_t drawCountSlot;
+};
+
+void GpuCulling::init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+	UploadManager& uploadManager, DescriptorManager& descriptorManager, PipelineManager& pipelineManager,
+	ShaderManager& shaderManager, const std::vector<uint32_t>& queueFamilies, uint32_t computeFamily, bool asyncCompute,
+	uint32_t framesInFlight, uint32_t maxInstances, uint32_t maxMeshes,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+	this->allocator = &allocator;
+	this->uploadManager = &uploadManager;
+	this->descriptorManager = &descriptorManager;
+	this->pipelineManager = &pipelineManager;
+	this->shaderManager = &shaderManager;
+	this->queueFamilies = queueFamilies;
+	this->asyncCompute = asyncCompute;
+	this->maxInstances = maxInstances;
+	this->maxMeshes = maxMeshes;
+
+	createPipeline();
+
+	createBuffer(maxInstances * sizeof(glm::vec4), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		MemoryUsage::GpuOnly, boundingSphereBuffer, boundingSphereAllocation);
+	createBuffer(maxInstances * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		MemoryUsage::GpuOnly, meshIndexBuffer, meshIndexAllocation);
+	createBuffer(maxMeshes * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		MemoryUsage::GpuOnly, meshBuffer, meshAllocation);
+	boundingSphereSlot = descriptorManager.registerStorageBuffer(boundingSphereBuffer, 0, VK_WHOLE_SIZE);
+	meshIndexSlot = descriptorManager.registerStorageBuffer(meshIndexBuffer, 0, VK_WHOLE_SIZE);
+	meshSlot = descriptorManager.registerStorageBuffer(meshBuffer, 0, VK_WHOLE_SIZE);
+
+	//every frame in flight compacts into its own buffers, the pass for the next frame
+	//may run while the previous frame's draws still read theirs
+	frames.resize(framesInFlight);
+	for (auto& frame : frames) {
+		createBuffer(maxInstances * sizeof(VkDrawIndexedIndirectCommand),
+			VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+			MemoryUsage::GpuOnly, frame.drawCommandBuffer, frame.drawCommandAllocation);
+		createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			MemoryUsage::GpuOnly, frame.drawCountBuffer, frame.drawCountAllocation);
+		createBuffer(sizeof(CullParams), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+			MemoryUsage::CpuToGpu, frame.paramsBuffer, frame.paramsAllocation);
+		frame.drawCommandSlot = descriptorManager.registerStorageBuffer(frame.drawCommandBuffer, 0, VK_WHOLE_SIZE);
+		frame.drawCountSlot = descriptorManager.registerStorageBuffer(frame.drawCountBuffer, 0, VK_WHOLE_SIZE);
+		frame.paramsSlot = descriptorManager.registerStorageBuffer(frame.paramsBuffer, 0, VK_WHOLE_SIZE);
+
+		if (asyncCompute) {
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			poolInfo.queueFamilyIndex = computeFamily;
+			if (vkCreateCommandPool(vkDevice, &poolInfo, allocationCallbacks, &frame.commandPool) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create culling command pool");
+			}
+			VkCommandBufferAllocateInfo allocInfo{};
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = frame.commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+			allocInfo.commandBufferCount = 1;
+			if (dispatch->vkAllocateCommandBuffers(vkDevice, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate culling command buffer");
+			}
+		}
+	}
+
+	params.occlusionViewProjection = glm::mat4(1.0f);
+	params.depthPyramidSlot = invalidDescriptorSlot;
+	params.depthSamplerSlot = invalidDescriptorSlot;
+}
+
+void GpuCulling::destroy()
+{
+	if (vkDevice == VK_NULL_HANDLE) {
+		return;
+	}
+
+	for (auto& frame : frames) {
+		if (frame.commandPool != VK_NULL_HANDLE) {
+			vkDestroyCommandPool(vkDevice, frame.commandPool, allocationCallbacks);
+		}
+		allocator->destroyBuffer(frame.drawCommandBuffer, frame.drawCommandAllocation);
+		allocator->destroyBuffer(frame.drawCountBuffer, frame.drawCountAllocation);
+		allocator->destroyBuffer(frame.paramsBuffer, frame.paramsAllocation);
+	}
+	frames.clear();
+	allocator->destroyBuffer(boundingSphereBuffer, boundingSphereAllocation);
+	allocator->destroyBuffer(meshIndexBuffer, meshIndexAllocation);
+	allocator->destroyBuffer(meshBuffer, meshAllocation);
+	//destroy runs with the device idle, nothing can still be bound to it
+	shaderManager->destroyPipeline(pipeline, 0);
+	vkDevice = VK_NULL_HANDLE;
+}
+
+void GpuCulling::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+	VkBuffer& buffer, MemoryAllocation& allocation)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	if (queueFamilies.size() > 1) {
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+		bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+	}
+	else {
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	}
+	allocator->createBuffer(bufferInfo, memoryUsage, buffer, allocation);
+}
+
+void GpuCulling::createPipeline()
+{
+	//rebuilt on the shader watcher thread whenever cull.comp changes, so it only
+	//captures what lives as long as the application
+	VkPipelineLayout layout = descriptorManager->getPipelineLayout();
+	PipelineManager* manager = pipelineManager;
+	pipeline = shaderManager->createPipeline({ "cull.comp" }, [layout, manager](const std::vector<VkShaderModule>& modules) {
+		VkComputePipelineCreateInfo pipelineInfo{};
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+		pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		pipelineInfo.stage.module = modules[0];
+		pipelineInfo.stage.pName = "main";
+		pipelineInfo.layout = layout;
+		return manager->createComputePipeline(pipelineInfo);
+	});
+}
+
+void GpuCulling::setMeshes(const CullMesh* meshes, uint32_t count)
+{
+	if (count > maxMeshes) {
+		throw std::runtime_error("culling mesh count exceeds maxCullMeshes");
+	}
+
+	std::vector<VkDrawIndexedIndirectCommand> commands(count);
+	for (uint32_t i = 0; i < count; i++) {
+		commands[i].indexCount = meshes[i].indexCount;
+		commands[i].instanceCount = 1;
+		commands[i].firstIndex = meshes[i].firstIndex;
+		commands[i].vertexOffset = meshes[i].vertexOffset;
+		commands[i].firstInstance = 0;
+	}
+	//createBuffer shares these across every family that uses them, so uploads skip the
+	//ownership transfer, which is invalid for concurrent buffers without synchronization2
+	waitForReaders();
+	uploadManager->uploadBuffer(meshBuffer, 0, commands.data(), commands.size() * sizeof(VkDrawIndexedIndirectCommand),
+		true);
+}
+
+void GpuCulling::setInstances(const glm::vec4* boundingSpheres, const uint32_t* meshIndices, uint32_t count)
+{
+	if (count > maxInstances) {
+		throw std::runtime_error("culling instance count exceeds maxCullInstances");
+	}
+
+	params.instanceCount = count;
+	waitForReaders();
+	uploadManager->uploadBuffer(boundingSphereBuffer, 0, boundingSpheres, count * sizeof(glm::vec4), true);
+	uploadManager->uploadBuffer(meshIndexBuffer, 0, meshIndices, count * sizeof(uint32_t), true);
+}
+
+void GpuCulling::updateBoundingSpheres(uint32_t firstInstance, const glm::vec4* boundingSpheres, uint32_t count)
+{
+	if (firstInstance + count > params.instanceCount) {
+		throw std::runtime_error("bounding sphere update past the last instance");
+	}
+	waitForReaders();
+	uploadManager->uploadBuffer(boundingSphereBuffer, firstInstance * sizeof(glm::vec4), boundingSpheres,
+		count * sizeof(glm::vec4), true);
+}
+
+void GpuCulling::waitForReaders()
+{
+	//the buffers are shared by every frame in flight, only an execution dependency on
+	//the readers is needed since the copies overwrite whatever they read
+	if (lastReader.value > 0) {
+		uploadManager->waitBeforeCopies(lastReader);
+	}
+}
+
+void GpuCulling::setCamera(const glm::mat4& viewProjection)
+{
+	//Gribb/Hartmann plane extraction, vulkan clip space has 0 <= z <= w
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++) {
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+	}
+	params.frustumPlanes[0] = rows[3] + rows[0];
+	params.frustumPlanes[1] = rows[3] - rows[0];
+	params.frustumPlanes[2] = rows[3] + rows[1];
+	params.frustumPlanes[3] = rows[3] - rows[1];
+	params.frustumPlanes[4] = rows[2];
+	params.frustumPlanes[5] = rows[3] - rows[2];
+	for (auto& plane : params.frustumPlanes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+}
+
+void GpuCulling::setDepthPyramid(uint32_t imageSlot, uint32_t samplerSlot, uint32_t width, uint32_t height,
+	uint32_t mipLevels, const glm::mat4& pyramidViewProjection)
+{
+	params.occlusionViewProjection = pyramidViewProjection;
+	params.pyramidSize = glm::vec4(static_cast<float>(width), static_cast<float>(height), static_cast<float>(mipLevels), 0.0f);
+	params.depthPyramidSlot = imageSlot;
+	params.depthSamplerSlot = samplerSlot;
+	params.occlusionEnabled = 1;
+}
+
+void GpuCulling::recordPass(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	FrameResources& frame = frames[frameIndex];
+	//the frame's fence was waited on before recording, nothing reads the old parameters
+	memcpy(frame.paramsAllocation.mapped, &params, sizeof(CullParams));
+
+	dispatch->vkCmdFillBuffer(commandBuffer, frame.drawCountBuffer, 0, sizeof(uint32_t), 0);
+	VkMemoryBarrier clearBarrier{};
+	clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0, 1, &clearBarrier, 0, nullptr, 0, nullptr);
+
+	CullPushConstants constants{ frame.paramsSlot, boundingSphereSlot, meshIndexSlot, meshSlot,
+		frame.drawCommandSlot, frame.drawCountSlot };
+	dispatch->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, shaderManager->getPipeline(pipeline));
+	descriptorManager->bind(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE);
+	dispatch->vkCmdPushConstants(commandBuffer, descriptorManager->getPipelineLayout(), VK_SHADER_STAGE_ALL, 0,
+		sizeof(CullPushConstants), &constants);
+	dispatch->vkCmdDispatch(commandBuffer, (params.instanceCount + cullWorkgroupSize - 1) / cullWorkgroupSize, 1, 1);
+}
+
+void GpuCulling::record(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	recordPass(commandBuffer, frameIndex);
+
+	VkMemoryBarrier drawBarrier{};
+	drawBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	drawBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	drawBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+	dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+		0, 1, &drawBarrier, 0, nullptr, 0, nullptr);
+}
+
+uint64_t GpuCulling::submit(uint32_t frameIndex, TimelineQueue& computeQueue, const std::vector<TimelineWait>& waits)
+{
+	FrameResources& frame = frames[frameIndex];
+	dispatch->vkResetCommandPool(vkDevice, frame.commandPool, 0);
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (dispatch->vkBeginCommandBuffer(frame.commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording culling command buffer");
+	}
+	recordPass(frame.commandBuffer, frameIndex);
+	if (dispatch->vkEndCommandBuffer(frame.commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record culling command buffer");
+	}
+
+	//the timeline signal and the graphics wait on it form the memory dependency
+	//between the compute writes and the indirect reads
+	return computeQueue.submit({ frame.commandBuffer }, waits);
+}
+
+void GpuCulling::drawIndirect(VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+	FrameResources& frame = frames[frameIndex];
+	dispatch->vkCmdDrawIndexedIndirectCount(commandBuffer, frame.drawCommandBuffer, 0, frame.drawCountBuffer, 0,
+		params.instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+}
+
+void GpuCulling::frameSubmitted(VkSemaphore graphicsTimeline, uint64_t graphicsValue)
+{
+	lastReader = { graphicsTimeline, graphicsValue, VK_PIPELINE_STAGE_TRANSFER_BIT };
+}
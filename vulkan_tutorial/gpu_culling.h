@@ -0,0 +1,146 @@
+﻿// gpu_culling.h : frustum and occlusion culling of instance bounding spheres in a compute
+// pass that compacts the survivors into an indirect draw buffer, no per object cpu work.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+#include <cstdint>
+#include <vector>
+#include "memory_allocator.h"
+#include "timeline_queue.h"
+#include "upload_manager.h"
+#include "pipeline_manager.h"
+#include "shader_manager.h"
+#include "descriptor_manager.h"
+#include "device_dispatch.h"
+
+//threads per workgroup of shaders/cull.comp
+const uint32_t cullWorkgroupSize = 64;
+
+//the part of a VkDrawIndexedIndirectCommand that depends on the mesh, the culling pass
+//fills in instanceCount and firstInstance for every instance that survives
+struct CullMesh {
+	uint32_t indexCount = 0;
+	uint32_t firstIndex = 0;
+	int32_t vertexOffset = 0;
+};
+
+//matches CullParams in shaders/cull.comp, rewritten every frame
+struct CullParams {
+	glm::mat4 occlusionViewProjection;
+	//inward facing, normalized, a sphere is outside when its distance is below -radius
+	glm::vec4 frustumPlanes[6];
+	//width, height and mip count of the depth pyramid
+	glm::vec4 pyramidSize;
+	uint32_t depthPyramidSlot;
+	uint32_t depthSamplerSlot;
+	uint32_t instanceCount;
+	uint32_t occlusionEnabled;
+};
+
+//the rendering side of the draw call is left to the caller: bind a pipeline created with
+//DescriptorManager::getPipelineLayout, the index and vertex buffers and the bindless set,
+//then call drawIndirect, gl_InstanceIndex is the index of the instance being drawn
+class GpuCulling {
+public:
+	//queueFamilies lists every family that touches the buffers, they are created
+	//concurrent so async compute needs no ownership transfers
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+		UploadManager& uploadManager, DescriptorManager& descriptorManager, PipelineManager& pipelineManager,
+		ShaderManager& shaderManager, const std::vector<uint32_t>& queueFamilies, uint32_t computeFamily, bool asyncCompute,
+		uint32_t framesInFlight, uint32_t maxInstances, uint32_t maxMeshes,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+	bool isEnabled() const { return vkDevice != VK_NULL_HANDLE; }
+	//true when the pass is submitted to its own compute queue instead of being recorded
+	//into the frame's graphics command buffer
+	bool usesAsyncCompute() const { return asyncCompute; }
+	bool usesOcclusion() const { return params.occlusionEnabled != 0; }
+
+	//instance data is stored structure of arrays, one buffer per attribute, so the
+	//culling pass only streams the bounds and mesh indices it actually reads.
+	//the copies go through the upload manager and wait for the last frame passed to
+	//frameSubmitted, so they may be queued at any point between frames
+	void setMeshes(const CullMesh* meshes, uint32_t count);
+	void setInstances(const glm::vec4* boundingSpheres, const uint32_t* meshIndices, uint32_t count);
+	void updateBoundingSpheres(uint32_t firstInstance, const glm::vec4* boundingSpheres, uint32_t count);
+	//the frustum planes are extracted from the matrix, which maps to vulkan clip space
+	void setCamera(const glm::mat4& viewProjection);
+	//a depth pyramid rendered with pyramidViewProjection, usually last frame's, each texel
+	//holding the farthest depth of the texels it covers, slots come from the descriptor
+	//manager and the sampler should clamp to edge and use nearest filtering
+	void setDepthPyramid(uint32_t imageSlot, uint32_t samplerSlot, uint32_t width, uint32_t height,
+		uint32_t mipLevels, const glm::mat4& pyramidViewProjection);
+	void disableOcclusion() { params.occlusionEnabled = 0; }
+
+	//records the pass into the graphics command buffer, followed by the barrier that
+	//makes the draw buffers visible to indirect draws
+	void record(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	//records the pass into the frame's own command buffer and submits it after waits,
+	//graphics must wait on the returned value at the draw indirect stage
+	uint64_t submit(uint32_t frameIndex, TimelineQueue& computeQueue, const std::vector<TimelineWait>& waits);
+	//draws whatever survived culling in the frame, inside a render pass
+	void drawIndirect(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	//graphicsValue is what the frame's submission signals on the graphics timeline, the
+	//frame draws after its culling pass so reaching it means both stopped reading
+	void frameSubmitted(VkSemaphore graphicsTimeline, uint64_t graphicsValue);
+
+	//slots of the instance buffers, for vertex shaders that look up per instance data
+	uint32_t getBoundingSphereSlot() const { return boundingSphereSlot; }
+	uint32_t getMeshIndexSlot() const { return meshIndexSlot; }
+	uint32_t getInstanceCount() const { return params.instanceCount; }
+
+private:
+	struct FrameResources {
+		VkBuffer drawCommandBuffer = VK_NULL_HANDLE;
+		MemoryAllocation drawCommandAllocation;
+		VkBuffer drawCountBuffer = VK_NULL_HANDLE;
+		MemoryAllocation drawCountAllocation;
+		//host visible, written right before the pass is recorded
+		VkBuffer paramsBuffer = VK_NULL_HANDLE;
+		MemoryAllocation paramsAllocation;
+		uint32_t drawCommandSlot = invalidDescriptorSlot;
+		uint32_t drawCountSlot = invalidDescriptorSlot;
+		uint32_t paramsSlot = invalidDescriptorSlot;
+		//only created for async compute
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	};
+
+	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memoryUsage,
+		VkBuffer& buffer, MemoryAllocation& allocation);
+	void createPipeline();
+	void recordPass(VkCommandBuffer commandBuffer, uint32_t frameIndex);
+	//orders the next copies into the shared buffers after the frames reading them
+	void waitForReaders();
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	MemoryAllocator* allocator = nullptr;
+	UploadManager* uploadManager = nullptr;
+	DescriptorManager* descriptorManager = nullptr;
+	PipelineManager* pipelineManager = nullptr;
+	ShaderManager* shaderManager = nullptr;
+	std::vector<uint32_t> queueFamilies;
+	bool asyncCompute = false;
+	uint32_t maxInstances = 0;
+	uint32_t maxMeshes = 0;
+	ShaderPipeline pipeline = invalidShaderPipeline;
+
+	VkBuffer boundingSphereBuffer = VK_NULL_HANDLE;
+	MemoryAllocation boundingSphereAllocation;
+	VkBuffer meshIndexBuffer = VK_NULL_HANDLE;
+	MemoryAllocation meshIndexAllocation;
+	VkBuffer meshBuffer = VK_NULL_HANDLE;
+	MemoryAllocation meshAllocation;
+	uint32_t boundingSphereSlot = invalidDescriptorSlot;
+	uint32_t meshIndexSlot = invalidDescriptorSlot;
+	uint32_t meshSlot = invalidDescriptorSlot;
+	std::vector<FrameResources> frames;
+	CullParams params{};
+	//the last submitted frame, value 0 until one reads the instance buffers
+	TimelineWait lastReader{};
+};
@@ -0,0 +1,280 @@
+﻿// gpu_profiler.cpp : timestamp and pipeline statistics queries rotated per frame in flight
+//
+
+#include "gpu_profiler.h"
+#include <stdexcept>
+
+static const char* const statisticNames[profilerStatisticCount] = {
+	"ia_vertices", "ia_primitives", "vs_invocations", "clip_primitives", "fs_invocations", "cs_invocations"
+};
+
+void GpuProfiler::init(VkPhysicalDevice physicalDevice, VkDevice device, const DeviceDispatch& deviceDispatch, uint32_t queueFamily,
+	uint32_t framesInFlight, uint32_t maxScopes, bool pipelineStatistics, const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+	this->maxScopes = maxScopes;
+
+	VkPhysicalDeviceProperties vkDeviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &vkDeviceProperties);
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+	uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+	//a queue without valid timestamp bits cannot be profiled at all
+	if (validBits == 0 || vkDeviceProperties.limits.timestampPeriod == 0.0f) {
+		enabled = false;
+		return;
+	}
+	enabled = true;
+	statisticsEnabled = pipelineStatistics;
+	//timestampPeriod is the number of nanoseconds per timestamp tick
+	timestampPeriod = vkDeviceProperties.limits.timestampPeriod;
+	timestampMask = validBits >= 64 ? ~0ull : ((1ull << validBits) - 1);
+
+	slots.resize(framesInFlight);
+	for (auto& slot : slots) {
+		VkQueryPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		poolInfo.queryCount = maxScopes * 2;
+		if (vkCreateQueryPool(vkDevice, &poolInfo, allocationCallbacks, &slot.timestampPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timestamp query pool");
+		}
+		if (statisticsEnabled) {
+			poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+			poolInfo.queryCount = maxScopes;
+			poolInfo.pipelineStatistics = profilerStatisticFlags;
+			if (vkCreateQueryPool(vkDevice, &poolInfo, allocationCallbacks, &slot.statisticsPool) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create pipeline statistics query pool");
+			}
+		}
+	}
+}
+
+void GpuProfiler::destroy()
+{
+	for (auto& slot : slots) {
+		vkDestroyQueryPool(vkDevice, slot.timestampPool, allocationCallbacks);
+		if (slot.statisticsPool != VK_NULL_HANDLE) {
+			vkDestroyQueryPool(vkDevice, slot.statisticsPool, allocationCallbacks);
+		}
+	}
+	slots.clear();
+
+	if (output.is_open()) {
+		if (outputFormat == ProfileFormat::ChromeTrace) {
+			output << "\n]}\n";
+		}
+		output.close();
+	}
+}
+
+bool GpuProfiler::openOutput(const std::string& path, ProfileFormat format)
+{
+	output.open(path, std::ios::trunc);
+	if (!output.is_open()) {
+		return false;
+	}
+
+	outputFormat = format;
+	if (format == ProfileFormat::Csv) {
+		output << "frame,scope,cpu_ms,gpu_ms";
+		for (const char* statisticName : statisticNames) {
+			output << "," << statisticName;
+		}
+		output << "\n";
+	}
+	else if (format == ProfileFormat::ChromeTrace) {
+		output << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		firstTraceEvent = true;
+	}
+
+	return true;
+}
+
+void GpuProfiler::collectFrame(uint32_t frameIndex)
+{
+	if (!enabled) {
+		return;
+	}
+	FrameSlot& slot = slots[frameIndex];
+	if (!slot.recorded) {
+		return;
+	}
+	slot.recorded = false;
+
+	ProfileFrameResult frame;
+	frame.frameNumber = slot.frameNumber;
+	frame.cpuMilliseconds = slot.cpuMilliseconds;
+	frame.cpuStartMicroseconds = slot.cpuStartMicroseconds;
+
+	uint32_t scopeCount = static_cast<uint32_t>(slot.scopes.size());
+	if (scopeCount > 0) {
+		//no WAIT flag, the fence already guarantees the results, availability is
+		//still requested so a scope that was never ended is skipped instead of read
+		std::vector<uint64_t> timestamps(scopeCount * 2 * 2);
+		dispatch->vkGetQueryPoolResults(vkDevice, slot.timestampPool, 0, scopeCount * 2, timestamps.size() * sizeof(uint64_t),
+			timestamps.data(), 2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+		std::vector<uint64_t> statistics;
+		if (statisticsEnabled) {
+			statistics.resize(scopeCount * (profilerStatisticCount + 1));
+			dispatch->vkGetQueryPoolResults(vkDevice, slot.statisticsPool, 0, scopeCount, statistics.size() * sizeof(uint64_t),
+				statistics.data(), (profilerStatisticCount + 1) * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+		}
+
+		for (uint32_t i = 0; i < scopeCount; i++) {
+			uint64_t begin = timestamps[i * 4] & timestampMask;
+			uint64_t end = timestamps[i * 4 + 2] & timestampMask;
+			if (timestamps[i * 4 + 1] == 0 || timestamps[i * 4 + 3] == 0) {
+				continue;
+			}
+			if (firstTimestamp == 0) {
+				firstTimestamp = begin;
+			}
+
+			ProfileScopeResult scope;
+			scope.name = slot.scopes[i].name;
+			scope.gpuMilliseconds = static_cast<double>((end - begin) & timestampMask) * timestampPeriod / 1000000.0;
+			scope.gpuStartMicroseconds = static_cast<double>((begin - firstTimestamp) & timestampMask) * timestampPeriod / 1000.0;
+			if (slot.scopes[i].statistics) {
+				const uint64_t* values = &statistics[i * (profilerStatisticCount + 1)];
+				if (values[profilerStatisticCount] != 0) {
+					scope.hasStatistics = true;
+					for (uint32_t j = 0; j < profilerStatisticCount; j++) {
+						scope.statistics[j] = values[j];
+					}
+				}
+			}
+			frame.scopes.push_back(scope);
+		}
+	}
+
+	lastFrame = frame;
+	if (output.is_open()) {
+		writeFrame(frame);
+	}
+}
+
+void GpuProfiler::beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber)
+{
+	if (!enabled) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(scopeMutex);
+	recordingSlot = frameIndex;
+	FrameSlot& slot = slots[frameIndex];
+	slot.scopes.clear();
+	slot.frameNumber = frameNumber;
+	slot.recorded = true;
+	dispatch->vkCmdResetQueryPool(commandBuffer, slot.timestampPool, 0, maxScopes * 2);
+	if (slot.statisticsPool != VK_NULL_HANDLE) {
+		dispatch->vkCmdResetQueryPool(commandBuffer, slot.statisticsPool, 0, maxScopes);
+	}
+}
+
+void GpuProfiler::setCpuFrameTime(uint32_t frameIndex, double startMicroseconds, double milliseconds)
+{
+	if (!enabled) {
+		return;
+	}
+	slots[frameIndex].cpuStartMicroseconds = startMicroseconds;
+	slots[frameIndex].cpuMilliseconds = milliseconds;
+}
+
+uint32_t GpuProfiler::beginScope(VkCommandBuffer commandBuffer, const char* name, bool statistics)
+{
+	if (!enabled) {
+		return UINT32_MAX;
+	}
+
+	uint32_t scope;
+	VkQueryPool timestampPool, statisticsPool;
+	{
+		std::lock_guard<std::mutex> lock(scopeMutex);
+		FrameSlot& slot = slots[recordingSlot];
+		if (slot.scopes.size() >= maxScopes) {
+			return UINT32_MAX;
+		}
+		scope = static_cast<uint32_t>(slot.scopes.size());
+		slot.scopes.push_back({ name, statistics && statisticsEnabled });
+		timestampPool = slot.timestampPool;
+		statisticsPool = slot.statisticsPool;
+	}
+
+	dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, scope * 2);
+	if (statistics && statisticsEnabled) {
+		dispatch->vkCmdBeginQuery(commandBuffer, statisticsPool, scope, 0);
+	}
+	return scope;
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t scope)
+{
+	if (scope == UINT32_MAX) {
+		return;
+	}
+
+	VkQueryPool timestampPool, statisticsPool;
+	bool statistics;
+	{
+		std::lock_guard<std::mutex> lock(scopeMutex);
+		FrameSlot& slot = slots[recordingSlot];
+		timestampPool = slot.timestampPool;
+		statisticsPool = slot.statisticsPool;
+		statistics = slot.scopes[scope].statistics;
+	}
+
+	if (statistics) {
+		dispatch->vkCmdEndQuery(commandBuffer, statisticsPool, scope);
+	}
+	dispatch->vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, scope * 2 + 1);
+}
+
+void GpuProfiler::writeFrame(const ProfileFrameResult& frame)
+{
+	switch (outputFormat) {
+	case ProfileFormat::Csv:
+		output << frame.frameNumber << ",cpu_frame," << frame.cpuMilliseconds << ",\n";
+		for (const auto& scope : frame.scopes) {
+			output << frame.frameNumber << "," << scope.name << ",," << scope.gpuMilliseconds;
+			for (uint32_t j = 0; j < profilerStatisticCount; j++) {
+				output << ",";
+				if (scope.hasStatistics) {
+					output << scope.statistics[j];
+				}
+			}
+			output << "\n";
+		}
+		break;
+	case ProfileFormat::Json:
+		output << "{\"frame\":" << frame.frameNumber << ",\"cpu_ms\":" << frame.cpuMilliseconds << ",\"scopes\":[";
+		for (size_t i = 0; i < frame.scopes.size(); i++) {
+			const auto& scope = frame.scopes[i];
+			output << (i > 0 ? "," : "") << "{\"name\":\"" << scope.name << "\",\"gpu_ms\":" << scope.gpuMilliseconds;
+			if (scope.hasStatistics) {
+				for (uint32_t j = 0; j < profilerStatisticCount; j++) {
+					output << ",\"" << statisticNames[j] << "\":" << scope.statistics[j];
+				}
+			}
+			output << "}";
+		}
+		output << "]}\n";
+		break;
+	case ProfileFormat::ChromeTrace:
+		//complete events, the cpu and gpu timelines show up as two threads of one process
+		output << (firstTraceEvent ? "\n" : ",\n") << "{\"name\":\"frame " << frame.frameNumber
+			<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":\"cpu\",\"ts\":" << frame.cpuStartMicroseconds
+			<< ",\"dur\":" << frame.cpuMilliseconds * 1000.0 << "}";
+		firstTraceEvent = false;
+		for (const auto& scope : frame.scopes) {
+			output << ",\n{\"name\":\"" << scope.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":\"gpu\",\"ts\":"
+				<< scope.gpuStartMicroseconds << ",\"dur\":" << scope.gpuMilliseconds * 1000.0
+				<< ",\"args\":{\"frame\":" << frame.frameNumber << "}}";
+		}
+		break;
+	}
+}
@@ -0,0 +1,112 @@
+﻿// gpu_profiler.h : named gpu timing scopes, optional pipeline statistics and cpu frame
+// times, read back once the frame's fence has signaled and streamed to a csv, json or
+// chrome trace file.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "device_dispatch.h"
+
+enum class ProfileFormat {
+	//one row per scope per frame
+	Csv,
+	//one json object per frame, one frame per line
+	Json,
+	//chrome://tracing / perfetto event list
+	ChromeTrace
+};
+
+//the counters collected when pipeline statistics are enabled, in query result order
+const VkQueryPipelineStatisticFlags profilerStatisticFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+const uint32_t profilerStatisticCount = 6;
+
+struct ProfileScopeResult {
+	std::string name;
+	double gpuMilliseconds = 0.0;
+	//gpu start relative to the first timestamp ever collected, used by the trace export
+	double gpuStartMicroseconds = 0.0;
+	bool hasStatistics = false;
+	uint64_t statistics[profilerStatisticCount] = {};
+};
+
+struct ProfileFrameResult {
+	uint64_t frameNumber = 0;
+	double cpuMilliseconds = 0.0;
+	double cpuStartMicroseconds = 0.0;
+	std::vector<ProfileScopeResult> scopes;
+};
+
+class GpuProfiler {
+public:
+	//statistics need the pipelineStatisticsQuery feature enabled on the device
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, const DeviceDispatch& deviceDispatch, uint32_t queueFamily,
+		uint32_t framesInFlight, uint32_t maxScopes, bool pipelineStatistics,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+	bool isEnabled() const { return enabled; }
+
+	bool openOutput(const std::string& path, ProfileFormat format);
+
+	//reads the results the frame slot produced framesInFlight frames ago, only call after
+	//its fence has signaled so the query results are available without waiting
+	void collectFrame(uint32_t frameIndex);
+	//resets the slot's queries, recorded at the start of the frame's primary command buffer
+	void beginFrame(VkCommandBuffer commandBuffer, uint32_t frameIndex, uint64_t frameNumber);
+	//cpu time spent on the frame, kept with the slot until its gpu results come back
+	void setCpuFrameTime(uint32_t frameIndex, double startMicroseconds, double milliseconds);
+
+	//scopes may be opened from worker threads recording secondary command buffers,
+	//a scope must begin and end in the same command buffer
+	uint32_t beginScope(VkCommandBuffer commandBuffer, const char* name, bool statistics = false);
+	void endScope(VkCommandBuffer commandBuffer, uint32_t scope);
+
+	//results of the most recently collected frame
+	const ProfileFrameResult& getLastFrame() const { return lastFrame; }
+
+private:
+	struct ScopeRecord {
+		std::string name;
+		bool statistics;
+	};
+
+	struct FrameSlot {
+		VkQueryPool timestampPool = VK_NULL_HANDLE;
+		VkQueryPool statisticsPool = VK_NULL_HANDLE;
+		std::vector<ScopeRecord> scopes;
+		uint64_t frameNumber = 0;
+		double cpuStartMicroseconds = 0.0;
+		double cpuMilliseconds = 0.0;
+		bool recorded = false;
+	};
+
+	void writeFrame(const ProfileFrameResult& frame);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	bool enabled = false;
+	bool statisticsEnabled = false;
+	uint32_t maxScopes = 0;
+	double timestampPeriod = 1.0;
+	uint64_t timestampMask = ~0ull;
+	uint64_t firstTimestamp = 0;
+	std::vector<FrameSlot> slots;
+	uint32_t recordingSlot = 0;
+	std::mutex scopeMutex;
+	ProfileFrameResult lastFrame;
+
+	std::ofstream output;
+	ProfileFormat outputFormat = ProfileFormat::Csv;
+	bool firstTraceEvent = true;
+};
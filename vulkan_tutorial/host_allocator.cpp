@@ -0,0 +1,245 @@
+﻿// host_allocator.cpp : block headers, the thread local pools and the counters
+//
+
+#include "host_allocator.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+//sits right in front of every pointer handed to the driver, so frees and reallocations
+//find the size, scope and pool of a block without a lookup
+struct alignas(16) BlockHeader {
+	uint64_t size;
+	//from the start of the malloc'd block to the pointer handed out
+	uint32_t offset;
+	uint16_t sizeClass;
+	uint16_t scope;
+};
+static_assert(sizeof(BlockHeader) == 16, "the header has to keep the pointers after it 16 byte aligned");
+
+const uint16_t unpooledSizeClass = UINT16_MAX;
+//command and object scope allocations the driver makes while recording and creating
+//objects are mostly small, these are pooled in classes of 16 to 4096 bytes
+static const size_t smallestSizeClass = 16;
+static const uint16_t sizeClassCount = 9;
+//free blocks a thread keeps per size class before giving them back to malloc
+static const uint32_t maxCachedBlocks = 256;
+
+//blocks freed on a thread go to that thread's lists whichever thread allocated them,
+//they are plain malloc'd memory, so nothing ties them to their first owner
+struct ThreadCache {
+	struct FreeList {
+		void* head = nullptr;
+		uint32_t count = 0;
+	};
+	FreeList lists[sizeClassCount];
+
+	~ThreadCache()
+	{
+		for (auto& list : lists) {
+			while (list.head != nullptr) {
+				void* next = *static_cast<void**>(list.head);
+				std::free(list.head);
+				list.head = next;
+			}
+		}
+	}
+};
+static thread_local ThreadCache threadCache;
+
+static uint16_t sizeClassFor(size_t size)
+{
+	size_t classSize = smallestSizeClass;
+	for (uint16_t i = 0; i < sizeClassCount; i++, classSize <<= 1) {
+		if (size <= classSize) {
+			return i;
+		}
+	}
+	return unpooledSizeClass;
+}
+
+const VkAllocationCallbacks* HostAllocator::getCallbacks(const std::string& subsystem)
+{
+	std::lock_guard<std::mutex> lock(subsystemsMutex);
+	for (auto& entry : subsystems) {
+		if (entry.name == subsystem) {
+			return &entry.callbacks;
+		}
+	}
+
+	Subsystem& entry = subsystems.emplace_back(subsystem);
+	entry.callbacks.pUserData = &entry;
+	entry.callbacks.pfnAllocation = allocate;
+	entry.callbacks.pfnReallocation = reallocate;
+	entry.callbacks.pfnFree = release;
+	entry.callbacks.pfnInternalAllocation = notifyInternalAllocation;
+	entry.callbacks.pfnInternalFree = notifyInternalFree;
+	return &entry.callbacks;
+}
+
+std::vector<HostAllocatorStatistics> HostAllocator::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(subsystemsMutex);
+	std::vector<HostAllocatorStatistics> statistics;
+	for (const auto& entry : subsystems) {
+		HostAllocatorStatistics& subsystem = statistics.emplace_back();
+		subsystem.subsystem = entry.name;
+		for (uint32_t i = 0; i < hostAllocationScopeCount; i++) {
+			subsystem.scopes[i].allocations = entry.scopes[i].allocations.load();
+			subsystem.scopes[i].liveAllocations = entry.scopes[i].liveAllocations.load();
+			subsystem.scopes[i].bytes = entry.scopes[i].bytes.load();
+			subsystem.scopes[i].peakBytes = entry.scopes[i].peakBytes.load();
+			subsystem.scopes[i].pooledAllocations = entry.scopes[i].pooledAllocations.load();
+		}
+		subsystem.bytes = entry.bytes.load();
+		subsystem.peakBytes = entry.peakBytes.load();
+		subsystem.internalBytes = entry.internalBytes.load();
+	}
+	return statistics;
+}
+
+static void raisePeak(std::atomic<uint64_t>& peak, uint64_t bytes)
+{
+	uint64_t current = peak.load(std::memory_order_relaxed);
+	while (bytes > current && !peak.compare_exchange_weak(current, bytes, std::memory_order_relaxed)) {
+	}
+}
+
+void HostAllocator::addBytes(Subsystem& entry, ScopeCounters& counters, uint64_t size)
+{
+	raisePeak(counters.peakBytes, counters.bytes.fetch_add(size, std::memory_order_relaxed) + size);
+	raisePeak(entry.peakBytes, entry.bytes.fetch_add(size, std::memory_order_relaxed) + size);
+}
+
+void* HostAllocator::allocate(void* userData, size_t size, size_t alignment, VkSystemAllocationScope scope)
+{
+	if (size == 0) {
+		return nullptr;
+	}
+
+	uint16_t sizeClass = unpooledSizeClass;
+	if ((scope == VK_SYSTEM_ALLOCATION_SCOPE_COMMAND || scope == VK_SYSTEM_ALLOCATION_SCOPE_OBJECT) &&
+		alignment <= sizeof(BlockHeader)) {
+		sizeClass = sizeClassFor(size);
+	}
+
+	char* raw = nullptr;
+	uint32_t offset = sizeof(BlockHeader);
+	bool pooled = false;
+	if (sizeClass != unpooledSizeClass) {
+		ThreadCache::FreeList& list = threadCache.lists[sizeClass];
+		if (list.head != nullptr) {
+			raw = static_cast<char*>(list.head);
+			list.head = *static_cast<void**>(list.head);
+			list.count--;
+			pooled = true;
+		}
+		else {
+			raw = static_cast<char*>(std::malloc(sizeof(BlockHeader) + (smallestSizeClass << sizeClass)));
+		}
+	}
+	else {
+		//room for the header and for moving the pointer up to the requested alignment
+		alignment = std::max(alignment, sizeof(BlockHeader));
+		raw = static_cast<char*>(std::malloc(sizeof(BlockHeader) + alignment + size));
+		if (raw != nullptr) {
+			uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(BlockHeader) + alignment - 1) & ~(alignment - 1);
+			offset = static_cast<uint32_t>(aligned - reinterpret_cast<uintptr_t>(raw));
+		}
+	}
+	if (raw == nullptr) {
+		return nullptr;
+	}
+
+	char* memory = raw + offset;
+	BlockHeader* header = reinterpret_cast<BlockHeader*>(memory) - 1;
+	header->size = size;
+	header->offset = offset;
+	header->sizeClass = sizeClass;
+	header->scope = static_cast<uint16_t>(scope);
+
+	Subsystem& entry = *static_cast<Subsystem*>(userData);
+	ScopeCounters& counters = entry.scopes[scope];
+	counters.allocations.fetch_add(1, std::memory_order_relaxed);
+	counters.liveAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (pooled) {
+		counters.pooledAllocations.fetch_add(1, std::memory_order_relaxed);
+	}
+	addBytes(entry, counters, size);
+	return memory;
+}
+
+void* HostAllocator::reallocate(void* userData, void* original, size_t size, size_t alignment,
+	VkSystemAllocationScope scope)
+{
+	if (original == nullptr) {
+		return allocate(userData, size, alignment, scope);
+	}
+	if (size == 0) {
+		release(userData, original);
+		return nullptr;
+	}
+
+	BlockHeader* header = static_cast<BlockHeader*>(original) - 1;
+	//a pooled block has room up to its class size, growing within it moves nothing
+	if (header->sizeClass != unpooledSizeClass && header->scope == scope &&
+		size <= (smallestSizeClass << header->sizeClass)) {
+		Subsystem& entry = *static_cast<Subsystem*>(userData);
+		ScopeCounters& counters = entry.scopes[scope];
+		counters.allocations.fetch_add(1, std::memory_order_relaxed);
+		counters.pooledAllocations.fetch_add(1, std::memory_order_relaxed);
+		addBytes(entry, counters, size - header->size);
+		header->size = size;
+		return original;
+	}
+
+	//on failure the original has to stay valid, so it is only freed after the copy
+	void* memory = allocate(userData, size, alignment, scope);
+	if (memory == nullptr) {
+		return nullptr;
+	}
+	memcpy(memory, original, std::min<size_t>(header->size, size));
+	release(userData, original);
+	return memory;
+}
+
+void HostAllocator::release(void* userData, void* memory)
+{
+	if (memory == nullptr) {
+		return;
+	}
+
+	//read everything before a pooled block's header is reused as its free list link
+	BlockHeader* header = static_cast<BlockHeader*>(memory) - 1;
+	uint64_t size = header->size;
+	uint16_t sizeClass = header->sizeClass;
+	char* raw = static_cast<char*>(memory) - header->offset;
+	Subsystem& entry = *static_cast<Subsystem*>(userData);
+	ScopeCounters& counters = entry.scopes[header->scope];
+	counters.liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+	counters.bytes.fetch_sub(size, std::memory_order_relaxed);
+	entry.bytes.fetch_sub(size, std::memory_order_relaxed);
+
+	if (sizeClass != unpooledSizeClass) {
+		ThreadCache::FreeList& list = threadCache.lists[sizeClass];
+		if (list.count < maxCachedBlocks) {
+			*reinterpret_cast<void**>(raw) = list.head;
+			list.head = raw;
+			list.count++;
+			return;
+		}
+	}
+	std::free(raw);
+}
+
+void HostAllocator::notifyInternalAllocation(void* userData, size_t size, VkInternalAllocationType type,
+	VkSystemAllocationScope scope)
+{
+	static_cast<Subsystem*>(userData)->internalBytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void HostAllocator::notifyInternalFree(void* userData, size_t size, VkInternalAllocationType type,
+	VkSystemAllocationScope scope)
+{
+	static_cast<Subsystem*>(userData)->internalBytes.fetch_sub(size, std::memory_order_relaxed);
+}
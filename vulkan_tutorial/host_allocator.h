@@ -0,0 +1,80 @@
+﻿// host_allocator.h : VkAllocationCallbacks that count the driver's cpu allocations per
+// subsystem and allocation scope, short lived ones come from per thread size class pools.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//indexed by VkSystemAllocationScope, COMMAND through INSTANCE
+const uint32_t hostAllocationScopeCount = 5;
+
+struct HostScopeStatistics {
+	//every allocation and reallocation the driver asked for
+	uint64_t allocations = 0;
+	uint64_t liveAllocations = 0;
+	uint64_t bytes = 0;
+	uint64_t peakBytes = 0;
+	//allocations served from the thread local pools instead of malloc
+	uint64_t pooledAllocations = 0;
+};
+
+struct HostAllocatorStatistics {
+	std::string subsystem;
+	HostScopeStatistics scopes[hostAllocationScopeCount];
+	//across all scopes, the scopes peak at different times so their peaks do not add up
+	uint64_t bytes = 0;
+	uint64_t peakBytes = 0;
+	//executable memory the driver allocated itself and only reported
+	uint64_t internalBytes = 0;
+};
+
+//the callbacks may be called from any thread, including threads the driver owns
+class HostAllocator {
+public:
+	//one set of callbacks per subsystem name, the same name always returns the same
+	//pointer, which stays valid for the lifetime of the allocator
+	const VkAllocationCallbacks* getCallbacks(const std::string& subsystem);
+	std::vector<HostAllocatorStatistics> getStatistics();
+
+private:
+	struct ScopeCounters {
+		std::atomic<uint64_t> allocations{ 0 };
+		std::atomic<uint64_t> liveAllocations{ 0 };
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> peakBytes{ 0 };
+		std::atomic<uint64_t> pooledAllocations{ 0 };
+	};
+
+	struct Subsystem {
+		explicit Subsystem(const std::string& name) : name(name) {}
+		std::string name;
+		VkAllocationCallbacks callbacks{};
+		ScopeCounters scopes[hostAllocationScopeCount];
+		std::atomic<uint64_t> bytes{ 0 };
+		std::atomic<uint64_t> peakBytes{ 0 };
+		std::atomic<uint64_t> internalBytes{ 0 };
+	};
+
+	//adds size to the subsystem's and the scope's byte counts, wrapping for a shrink
+	static void addBytes(Subsystem& entry, ScopeCounters& counters, uint64_t size);
+
+	static VKAPI_ATTR void* VKAPI_CALL allocate(void* userData, size_t size, size_t alignment,
+		VkSystemAllocationScope scope);
+	static VKAPI_ATTR void* VKAPI_CALL reallocate(void* userData, void* original, size_t size, size_t alignment,
+		VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL release(void* userData, void* memory);
+	static VKAPI_ATTR void VKAPI_CALL notifyInternalAllocation(void* userData, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope);
+	static VKAPI_ATTR void VKAPI_CALL notifyInternalFree(void* userData, size_t size,
+		VkInternalAllocationType type, VkSystemAllocationScope scope);
+
+	std::mutex subsystemsMutex;
+	//a deque so the callbacks' pUserData never moves
+	std::deque<Subsystem> subsystems;
+};
@@ -0,0 +1,183 @@
+﻿// job_system.cpp : worker threads and parallel secondary command buffer recording
+//
+
+#include "job_system.h"
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+void JobSystem::init(uint32_t workerCount)
+{
+	if (workerCount == 0) {
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	stopping = false;
+	for (uint32_t i = 0; i < workerCount; i++) {
+		workers.emplace_back(&JobSystem::workerLoop, this, i);
+	}
+}
+
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		stopping = true;
+	}
+	jobAvailable.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	workers.clear();
+}
+
+void JobSystem::submit(std::function<void(uint32_t)> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobsMutex);
+		jobs.push_back(std::move(job));
+		pendingJobs++;
+	}
+	jobAvailable.notify_one();
+}
+
+void JobSystem::wait()
+{
+	std::unique_lock<std::mutex> lock(jobsMutex);
+	jobsDone.wait(lock, [this]() { return pendingJobs == 0; });
+}
+
+void JobSystem::workerLoop(uint32_t workerIndex)
+{
+	while (true) {
+		std::function<void(uint32_t)> job;
+		{
+			std::unique_lock<std::mutex> lock(jobsMutex);
+			jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (jobs.empty()) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		job(workerIndex);
+
+		{
+			std::lock_guard<std::mutex> lock(jobsMutex);
+			pendingJobs--;
+			if (pendingJobs == 0) {
+				jobsDone.notify_all();
+			}
+		}
+	}
+}
+
+void ParallelRecorder::init(VkDevice device, const DeviceDispatch& deviceDispatch, uint32_t queueFamily, uint32_t framesInFlight,
+	JobSystem& jobSystem, const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+	this->jobSystem = &jobSystem;
+	workerFrames.resize(framesInFlight);
+	for (auto& frame : workerFrames) {
+		frame.resize(jobSystem.getWorkerCount());
+		for (auto& workerFrame : frame) {
+			VkCommandPoolCreateInfo poolInfo{};
+			poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			poolInfo.queueFamilyIndex = queueFamily;
+			if (vkCreateCommandPool(vkDevice, &poolInfo, allocationCallbacks, &workerFrame.commandPool) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create worker command pool");
+			}
+		}
+	}
+}
+
+void ParallelRecorder::destroy()
+{
+	for (auto& frame : workerFrames) {
+		for (auto& workerFrame : frame) {
+			vkDestroyCommandPool(vkDevice, workerFrame.commandPool, allocationCallbacks);
+		}
+	}
+	workerFrames.clear();
+}
+
+void ParallelRecorder::beginFrame(uint32_t frameIndex)
+{
+	currentFrame = frameIndex;
+	//resetting the pool recycles all of its secondary buffers at once,
+	//they are handed out again by acquireSecondary
+	for (auto& workerFrame : workerFrames[currentFrame]) {
+		dispatch->vkResetCommandPool(vkDevice, workerFrame.commandPool, 0);
+		workerFrame.usedBuffers = 0;
+	}
+}
+
+VkCommandBuffer ParallelRecorder::acquireSecondary(WorkerFrame& workerFrame)
+{
+	if (workerFrame.usedBuffers == workerFrame.commandBuffers.size()) {
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = workerFrame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+		VkCommandBuffer commandBuffer;
+		if (dispatch->vkAllocateCommandBuffers(vkDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate secondary command buffer");
+		}
+		workerFrame.commandBuffers.push_back(commandBuffer);
+	}
+
+	return workerFrame.commandBuffers[workerFrame.usedBuffers++];
+}
+
+void ParallelRecorder::record(VkCommandBuffer primary, const std::vector<RecordTask>& tasks,
+	const VkCommandBufferInheritanceInfo& inheritance)
+{
+	if (tasks.empty()) {
+		return;
+	}
+
+	std::vector<VkCommandBuffer> secondaries(tasks.size(), VK_NULL_HANDLE);
+	std::mutex errorMutex;
+	std::exception_ptr firstError;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		jobSystem->submit([&, i](uint32_t workerIndex) {
+			try {
+				//only this worker ever touches its pool for the current frame
+				VkCommandBuffer commandBuffer = acquireSecondary(workerFrames[currentFrame][workerIndex]);
+				VkCommandBufferBeginInfo beginInfo{};
+				beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+				beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+				if (inheritance.renderPass != VK_NULL_HANDLE) {
+					beginInfo.flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+				}
+				beginInfo.pInheritanceInfo = &inheritance;
+				if (dispatch->vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+					throw std::runtime_error("failed to begin secondary command buffer");
+				}
+				tasks[i](commandBuffer, workerIndex);
+				if (dispatch->vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+					throw std::runtime_error("failed to record secondary command buffer");
+				}
+				secondaries[i] = commandBuffer;
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(errorMutex);
+				if (!firstError) {
+					firstError = std::current_exception();
+				}
+			}
+		});
+	}
+	jobSystem->wait();
+	if (firstError) {
+		std::rethrow_exception(firstError);
+	}
+
+	dispatch->vkCmdExecuteCommands(primary, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+}
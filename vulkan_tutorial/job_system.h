@@ -0,0 +1,75 @@
+﻿// job_system.h : a fixed pool of worker threads and the parallel command recorder
+// built on top of it, each worker records into command pools it owns exclusively.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "device_dispatch.h"
+
+class JobSystem {
+public:
+	//0 picks one worker per hardware thread minus the one running the frame loop
+	void init(uint32_t workerCount);
+	void shutdown();
+	uint32_t getWorkerCount() const { return static_cast<uint32_t>(workers.size()); }
+
+	//the job receives the index of the worker running it, which is stable for the
+	//lifetime of the job system and can be used to pick per thread resources
+	void submit(std::function<void(uint32_t)> job);
+	//blocks until every job submitted so far has finished
+	void wait();
+
+private:
+	void workerLoop(uint32_t workerIndex);
+
+	std::vector<std::thread> workers;
+	std::deque<std::function<void(uint32_t)>> jobs;
+	std::mutex jobsMutex;
+	std::condition_variable jobAvailable;
+	std::condition_variable jobsDone;
+	uint32_t pendingJobs = 0;
+	bool stopping = false;
+};
+
+//records into a secondary command buffer that has already been begun, the worker
+//index is passed along for callers that keep their own per thread state
+using RecordTask = std::function<void(VkCommandBuffer commandBuffer, uint32_t workerIndex)>;
+
+class ParallelRecorder {
+public:
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, uint32_t queueFamily, uint32_t framesInFlight,
+		JobSystem& jobSystem, const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+
+	//resets every worker pool of the frame, only call once its in flight fence has signaled
+	void beginFrame(uint32_t frameIndex);
+	//records each task into its own secondary command buffer on the worker threads and
+	//executes them from the primary buffer in task order, inside a render pass the
+	//inheritance info has to name it and the pass must use secondary command buffer contents
+	void record(VkCommandBuffer primary, const std::vector<RecordTask>& tasks,
+		const VkCommandBufferInheritanceInfo& inheritance);
+
+private:
+	//one pool per worker per frame in flight, so no pool is ever touched by two threads
+	struct WorkerFrame {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> commandBuffers;
+		uint32_t usedBuffers = 0;
+	};
+
+	VkCommandBuffer acquireSecondary(WorkerFrame& workerFrame);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	JobSystem* jobSystem = nullptr;
+	uint32_t currentFrame = 0;
+	std::vector<std::vector<WorkerFrame>> workerFrames;
+};
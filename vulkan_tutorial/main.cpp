@@ -0,0 +1,152 @@
+﻿// main.cpp : Defines the entry point for the application.
+//
+
+#include "vulkan_tutorial.h"
+
+//accepts latency, balanced, throughput or power
+static PresentPolicy parsePresentPolicy(const std::string& name) {
+	static const std::map<std::string, PresentPolicy> policies = {
+		{ "latency", PresentPolicy::LowestLatency },
+		{ "balanced", PresentPolicy::Balanced },
+		{ "throughput", PresentPolicy::Throughput },
+		{ "power", PresentPolicy::PowerSaving }
+	};
+	auto it = policies.find(name);
+	if (it == policies.end()) {
+		throw std::runtime_error("unknown present policy " + name);
+	}
+
+	return it->second;
+}
+
+//accepts off, errors or full
+static ValidationMode parseValidationMode(const std::string& name) {
+	static const std::map<std::string, ValidationMode> modes = {
+		{ "off", ValidationMode::Off },
+		{ "errors", ValidationMode::Errors },
+		{ "full", ValidationMode::Full }
+	};
+	auto it = modes.find(name);
+	if (it == modes.end()) {
+		throw std::runtime_error("unknown validation mode " + name);
+	}
+
+	return it->second;
+}
+
+static ProfileFormat parseProfileFormat(const std::string& name) {
+	static const std::map<std::string, ProfileFormat> formats = {
+		{ "csv", ProfileFormat::Csv },
+		{ "json", ProfileFormat::Json },
+		{ "trace", ProfileFormat::ChromeTrace }
+	};
+	auto it = formats.find(name);
+	if (it == formats.end()) {
+		throw std::runtime_error("unknown profile format " + name);
+	}
+
+	return it->second;
+}
+
+static CaptureFormat parseCaptureFormat(const std::string& name) {
+	static const std::map<std::string, CaptureFormat> formats = {
+		{ "ppm", CaptureFormat::Ppm },
+		{ "y4m", CaptureFormat::Y4m }
+	};
+	auto it = formats.find(name);
+	if (it == formats.end()) {
+		throw std::runtime_error("unknown capture format " + name);
+	}
+
+	return it->second;
+}
+
+//--headless renders without a display, e.g. on a render node or under lavapipe with
+//VK_ICD_FILENAMES pointing at lvp_icd.x86_64.json, --frames limits the run length
+static VkApplicationConfig parseCommandLine(int argc, char** argv) {
+	VkApplicationConfig config;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--headless") {
+			config.headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			config.frameCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--frames-in-flight" && i + 1 < argc) {
+			config.maxFramesInFlight = std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+		}
+		else if (arg == "--present-policy" && i + 1 < argc) {
+			config.swapChainPolicy.presentPolicy = parsePresentPolicy(argv[++i]);
+		}
+		else if (arg == "--swapchain-images" && i + 1 < argc) {
+			config.swapChainPolicy.imageCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--pipeline-cache" && i + 1 < argc) {
+			config.pipelineCachePath = argv[++i];
+		}
+		else if (arg == "--worker-threads" && i + 1 < argc) {
+			config.workerThreadCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--profile" && i + 1 < argc) {
+			config.profileOutputPath = argv[++i];
+		}
+		else if (arg == "--profile-format" && i + 1 < argc) {
+			config.profileFormat = parseProfileFormat(argv[++i]);
+		}
+		else if (arg == "--pipeline-statistics") {
+			config.pipelineStatistics = true;
+		}
+		else if (arg == "--device" && i + 1 < argc) {
+			config.deviceOverride = argv[++i];
+		}
+		else if (arg == "--shader-dir" && i + 1 < argc) {
+			config.shaderDirectory = argv[++i];
+		}
+		else if (arg == "--gpu-culling") {
+			config.gpuCulling = true;
+		}
+		else if (arg == "--hot-reload") {
+			config.hotReloadShaders = true;
+		}
+		else if (arg == "--shader-source-dir" && i + 1 < argc) {
+			config.shaderSourceDirectory = argv[++i];
+		}
+		else if (arg == "--validation" && i + 1 < argc) {
+			config.validationMode = parseValidationMode(argv[++i]);
+		}
+		else if (arg == "--fps-cap" && i + 1 < argc) {
+			config.maxFrameRate = std::stod(argv[++i]);
+		}
+		else if (arg == "--max-queued-frames" && i + 1 < argc) {
+			config.maxQueuedFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--no-host-allocator") {
+			config.trackHostAllocations = false;
+		}
+		else if (arg == "--capture" && i + 1 < argc) {
+			config.capturePath = argv[++i];
+		}
+		else if (arg == "--capture-format" && i + 1 < argc) {
+			config.captureFormat = parseCaptureFormat(argv[++i]);
+		}
+		else if (arg == "--capture-queue" && i + 1 < argc) {
+			config.maxQueuedCaptureFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+	}
+
+	return config;
+}
+
+int main(int argc, char** argv){
+	try {
+		VkApplication vkApp(600, 800, "vkapp", parseCommandLine(argc, argv));
+		vkApp.run();
+	}
+	catch (const std::exception& e) {
+		std::cerr << e.what() << std::endl;
+		return(EXIT_FAILURE);
+	}
+
+	return(EXIT_SUCCESS);
+}
\ No newline at end of file
@@ -0,0 +1,350 @@
+﻿// memory_allocator.cpp : block based device memory sub-allocator and per frame linear arenas
+//
+
+#include "memory_allocator.h"
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkPhysicalDevice = physicalDevice;
+	this->vkDevice = device;
+	this->allocationCallbacks = allocationCallbacks;
+	this->blockSize = blockSize;
+	vkGetPhysicalDeviceMemoryProperties(vkPhysicalDevice, &memProperties);
+	VkPhysicalDeviceProperties vkDeviceProperties;
+	vkGetPhysicalDeviceProperties(vkPhysicalDevice, &vkDeviceProperties);
+	maxMemoryAllocationCount = vkDeviceProperties.limits.maxMemoryAllocationCount;
+}
+
+void MemoryAllocator::destroy()
+{
+	for (auto& arena : frameArenas) {
+		destroyBuffer(arena.buffer, arena.allocation);
+	}
+	frameArenas.clear();
+
+	for (auto& block : blocks) {
+		if (block.memory != VK_NULL_HANDLE) {
+			//freeing the memory implicitly unmaps it
+			vkFreeMemory(vkDevice, block.memory, allocationCallbacks);
+		}
+	}
+	blocks.clear();
+	deviceMemoryCount = 0;
+}
+
+void MemoryAllocator::memoryFlagsForUsage(MemoryUsage usage, VkMemoryPropertyFlags& required, VkMemoryPropertyFlags& preferred)
+{
+	switch (usage) {
+	case MemoryUsage::GpuOnly:
+		required = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		preferred = 0;
+		break;
+	case MemoryUsage::CpuToGpu:
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		preferred = 0;
+		break;
+	case MemoryUsage::GpuToCpu:
+		//cached memory makes host reads of the results fast
+		required = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		preferred = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+		break;
+	}
+}
+
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred)
+{
+	//first look for a type with the preferred flags as well, then settle for the required ones
+	VkMemoryPropertyFlags passes[] = { required | preferred, required };
+	for (VkMemoryPropertyFlags properties : passes) {
+		for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+			if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+	}
+
+	throw std::runtime_error("failed to find a suitable memory type");
+}
+
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped)
+{
+	if (deviceMemoryCount >= maxMemoryAllocationCount) {
+		throw std::runtime_error("maxMemoryAllocationCount reached");
+	}
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(vkDevice, &allocInfo, allocationCallbacks, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory");
+	}
+	deviceMemoryCount++;
+
+	*mapped = nullptr;
+	//host visible memory is mapped once for its whole lifetime, mapping per use is slow
+	if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(vkDevice, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+			vkFreeMemory(vkDevice, memory, allocationCallbacks);
+			deviceMemoryCount--;
+			throw std::runtime_error("failed to map device memory");
+		}
+	}
+
+	return memory;
+}
+
+bool MemoryAllocator::allocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	//first fit, alignments reported by vulkan are always a power of two
+	for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+		VkDeviceSize alignedOffset = (it->first + alignment - 1) & ~(alignment - 1);
+		VkDeviceSize padding = alignedOffset - it->first;
+		if (padding + size > it->second) {
+			continue;
+		}
+
+		VkDeviceSize rangeOffset = it->first;
+		VkDeviceSize rangeSize = it->second;
+		block.freeRanges.erase(it);
+		//the alignment padding stays free and is merged back once a neighbour is released
+		if (padding > 0) {
+			block.freeRanges[rangeOffset] = padding;
+		}
+		VkDeviceSize tail = rangeSize - padding - size;
+		if (tail > 0) {
+			block.freeRanges[alignedOffset + size] = tail;
+		}
+
+		block.usedBytes += size;
+		block.allocationCount++;
+		offset = alignedOffset;
+		return true;
+	}
+
+	return false;
+}
+
+MemoryAllocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linearResource)
+{
+	VkMemoryPropertyFlags required, preferred;
+	memoryFlagsForUsage(usage, required, preferred);
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, required, preferred);
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	MemoryAllocation allocation{};
+	allocation.memoryType = memoryType;
+	allocation.size = requirements.size;
+
+	//anything larger than half a block would leave most of a fresh block unused
+	if (requirements.size > blockSize / 2) {
+		allocation.memory = allocateDeviceMemory(requirements.size, memoryType, &allocation.mapped);
+		allocation.blockIndex = dedicatedBlock;
+		dedicatedCount++;
+		dedicatedBytes += requirements.size;
+		return allocation;
+	}
+
+	uint32_t freeSlot = static_cast<uint32_t>(blocks.size());
+	for (uint32_t i = 0; i < blocks.size(); i++) {
+		MemoryBlock& block = blocks[i];
+		if (block.memory == VK_NULL_HANDLE) {
+			freeSlot = i;
+			continue;
+		}
+		if (block.memoryType != memoryType || block.linear != linearResource) {
+			continue;
+		}
+		if (allocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset)) {
+			allocation.memory = block.memory;
+			allocation.blockIndex = i;
+			if (block.mapped != nullptr) {
+				allocation.mapped = static_cast<char*>(block.mapped) + allocation.offset;
+			}
+			return allocation;
+		}
+	}
+
+	//no block had room, reserve a new one and reuse a released slot so indices stay stable
+	if (freeSlot == blocks.size()) {
+		blocks.emplace_back();
+	}
+	MemoryBlock& block = blocks[freeSlot];
+	block = MemoryBlock{};
+	block.memory = allocateDeviceMemory(blockSize, memoryType, &block.mapped);
+	block.size = blockSize;
+	block.memoryType = memoryType;
+	block.linear = linearResource;
+	block.freeRanges[0] = blockSize;
+	allocateFromBlock(block, requirements.size, requirements.alignment, allocation.offset);
+	allocation.memory = block.memory;
+	allocation.blockIndex = freeSlot;
+	if (block.mapped != nullptr) {
+		allocation.mapped = static_cast<char*>(block.mapped) + allocation.offset;
+	}
+
+	return allocation;
+}
+
+void MemoryAllocator::free(const MemoryAllocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	if (allocation.blockIndex == dedicatedBlock) {
+		vkFreeMemory(vkDevice, allocation.memory, allocationCallbacks);
+		deviceMemoryCount--;
+		dedicatedCount--;
+		dedicatedBytes -= allocation.size;
+		return;
+	}
+
+	MemoryBlock& block = blocks[allocation.blockIndex];
+	VkDeviceSize offset = allocation.offset;
+	VkDeviceSize size = allocation.size;
+
+	//merge with the free range right after and right before the released one
+	auto next = block.freeRanges.lower_bound(offset);
+	if (next != block.freeRanges.end() && offset + size == next->first) {
+		size += next->second;
+		next = block.freeRanges.erase(next);
+	}
+	if (next != block.freeRanges.begin()) {
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == offset) {
+			offset = prev->first;
+			size += prev->second;
+			block.freeRanges.erase(prev);
+		}
+	}
+	block.freeRanges[offset] = size;
+	block.usedBytes -= allocation.size;
+	block.allocationCount--;
+
+	if (block.allocationCount > 0) {
+		return;
+	}
+	//keep one empty block per memory type around so alternating
+	//allocate/free patterns do not hit vkAllocateMemory every time, this one only
+	//goes when another block of the same kind is already empty
+	for (uint32_t i = 0; i < blocks.size(); i++) {
+		if (i != allocation.blockIndex && blocks[i].memory != VK_NULL_HANDLE && blocks[i].allocationCount == 0 &&
+			blocks[i].memoryType == block.memoryType && blocks[i].linear == block.linear) {
+			vkFreeMemory(vkDevice, block.memory, allocationCallbacks);
+			deviceMemoryCount--;
+			block = MemoryBlock{};
+			return;
+		}
+	}
+}
+
+void MemoryAllocator::createBuffer(const VkBufferCreateInfo& bufferInfo, MemoryUsage usage, VkBuffer& buffer, MemoryAllocation& allocation)
+{
+	if (vkCreateBuffer(vkDevice, &bufferInfo, allocationCallbacks, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create buffer");
+	}
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(vkDevice, buffer, &memRequirements);
+	allocation = allocate(memRequirements, usage, true);
+	vkBindBufferMemory(vkDevice, buffer, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::createImage(const VkImageCreateInfo& imageInfo, MemoryUsage usage, VkImage& image, MemoryAllocation& allocation)
+{
+	if (vkCreateImage(vkDevice, &imageInfo, allocationCallbacks, &image) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create image");
+	}
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(vkDevice, image, &memRequirements);
+	allocation = allocate(memRequirements, usage, imageInfo.tiling == VK_IMAGE_TILING_LINEAR);
+	vkBindImageMemory(vkDevice, image, allocation.memory, allocation.offset);
+}
+
+void MemoryAllocator::destroyBuffer(VkBuffer buffer, const MemoryAllocation& allocation)
+{
+	vkDestroyBuffer(vkDevice, buffer, allocationCallbacks);
+	free(allocation);
+}
+
+void MemoryAllocator::destroyImage(VkImage image, const MemoryAllocation& allocation)
+{
+	vkDestroyImage(vkDevice, image, allocationCallbacks);
+	free(allocation);
+}
+
+void MemoryAllocator::createFrameArenas(uint32_t frameCount, VkDeviceSize arenaSize)
+{
+	frameArenas.resize(frameCount);
+	for (auto& arena : frameArenas) {
+		VkBufferCreateInfo bufferInfo{};
+		bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+		bufferInfo.size = arenaSize;
+		bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+		bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		createBuffer(bufferInfo, MemoryUsage::CpuToGpu, arena.buffer, arena.allocation);
+		arena.head = 0;
+	}
+}
+
+TransientAllocation MemoryAllocator::allocateTransient(uint32_t frameIndex, VkDeviceSize size, VkDeviceSize alignment)
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	FrameArena& arena = frameArenas[frameIndex];
+	VkDeviceSize offset = (arena.head + alignment - 1) & ~(alignment - 1);
+	if (offset + size > arena.allocation.size) {
+		throw std::runtime_error("frame arena exhausted");
+	}
+	arena.head = offset + size;
+
+	TransientAllocation transient;
+	transient.buffer = arena.buffer;
+	transient.offset = offset;
+	transient.mapped = static_cast<char*>(arena.allocation.mapped) + offset;
+	return transient;
+}
+
+void MemoryAllocator::resetFrameArena(uint32_t frameIndex)
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	frameArenas[frameIndex].head = 0;
+}
+
+MemoryStatistics MemoryAllocator::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(allocatorMutex);
+	MemoryStatistics stats;
+	stats.deviceMemoryCount = deviceMemoryCount;
+	VkDeviceSize totalFree = 0;
+	for (const auto& block : blocks) {
+		if (block.memory == VK_NULL_HANDLE) {
+			continue;
+		}
+		stats.reservedBytes += block.size;
+		stats.usedBytes += block.usedBytes;
+		stats.allocationCount += block.allocationCount;
+		for (const auto& range : block.freeRanges) {
+			totalFree += range.second;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+		}
+	}
+	stats.reservedBytes += dedicatedBytes;
+	stats.usedBytes += dedicatedBytes;
+	stats.allocationCount += dedicatedCount;
+	if (totalFree > 0) {
+		stats.fragmentation = 1.0f - static_cast<float>(stats.largestFreeRange) / static_cast<float>(totalFree);
+	}
+	for (const auto& arena : frameArenas) {
+		stats.transientBytes += arena.head;
+	}
+
+	return stats;
+}
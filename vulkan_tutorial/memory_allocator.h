@@ -0,0 +1,118 @@
+﻿// memory_allocator.h : device memory sub-allocation, every buffer and image
+// VkApplication creates gets its memory from here instead of vkAllocateMemory.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+//default size of the blocks reserved per memory type
+const VkDeviceSize defaultMemoryBlockSize = 64ull * 1024 * 1024;
+
+enum class MemoryUsage {
+	//device local memory the host never touches, render targets and static meshes
+	GpuOnly,
+	//host visible and coherent, used for staging and data written every frame
+	CpuToGpu,
+	//host visible, preferably cached, used to read results back
+	GpuToCpu
+};
+
+struct MemoryAllocation {
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	//persistent mapping of the range, nullptr when the memory is not host visible
+	void* mapped = nullptr;
+	uint32_t memoryType = 0;
+	//index into the block list, dedicatedBlock for allocations that own their memory
+	uint32_t blockIndex = 0;
+};
+
+//a slice of the current frame's linear arena, valid until the arena is reset
+struct TransientAllocation {
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	void* mapped = nullptr;
+};
+
+struct MemoryStatistics {
+	//live vkAllocateMemory allocations, bounded by maxMemoryAllocationCount
+	uint32_t deviceMemoryCount = 0;
+	//live sub-allocations handed out from blocks plus dedicated allocations
+	uint32_t allocationCount = 0;
+	VkDeviceSize reservedBytes = 0;
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize largestFreeRange = 0;
+	//0 when all free space in the blocks is one contiguous range, approaching 1 as it splinters
+	float fragmentation = 0.0f;
+	//bytes handed out from the frame arenas since their last reset
+	VkDeviceSize transientBytes = 0;
+};
+
+class MemoryAllocator {
+public:
+	static const uint32_t dedicatedBlock = UINT32_MAX;
+
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = defaultMemoryBlockSize,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+
+	//linear resources (buffers) and optimal images never share a block,
+	//which keeps bufferImageGranularity out of the offset math
+	MemoryAllocation allocate(const VkMemoryRequirements& requirements, MemoryUsage usage, bool linearResource);
+	void free(const MemoryAllocation& allocation);
+
+	void createBuffer(const VkBufferCreateInfo& bufferInfo, MemoryUsage usage, VkBuffer& buffer, MemoryAllocation& allocation);
+	void createImage(const VkImageCreateInfo& imageInfo, MemoryUsage usage, VkImage& image, MemoryAllocation& allocation);
+	void destroyBuffer(VkBuffer buffer, const MemoryAllocation& allocation);
+	void destroyImage(VkImage image, const MemoryAllocation& allocation);
+
+	//one bump allocated, persistently mapped arena per frame in flight
+	void createFrameArenas(uint32_t frameCount, VkDeviceSize arenaSize);
+	TransientAllocation allocateTransient(uint32_t frameIndex, VkDeviceSize size, VkDeviceSize alignment);
+	//only call once the gpu has finished the frame that last used the arena
+	void resetFrameArena(uint32_t frameIndex);
+
+	MemoryStatistics getStatistics();
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred);
+
+private:
+	struct MemoryBlock {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		void* mapped = nullptr;
+		uint32_t memoryType = 0;
+		bool linear = true;
+		//free ranges keyed by offset, neighbours are merged on free
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+		VkDeviceSize usedBytes = 0;
+		uint32_t allocationCount = 0;
+	};
+
+	struct FrameArena {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		MemoryAllocation allocation;
+		VkDeviceSize head = 0;
+	};
+
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, void** mapped);
+	bool allocateFromBlock(MemoryBlock& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void memoryFlagsForUsage(MemoryUsage usage, VkMemoryPropertyFlags& required, VkMemoryPropertyFlags& preferred);
+
+	VkPhysicalDevice vkPhysicalDevice = VK_NULL_HANDLE;
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	VkPhysicalDeviceMemoryProperties memProperties{};
+	uint32_t maxMemoryAllocationCount = 0;
+	VkDeviceSize blockSize = defaultMemoryBlockSize;
+	std::vector<MemoryBlock> blocks;
+	std::vector<FrameArena> frameArenas;
+	uint32_t deviceMemoryCount = 0;
+	uint32_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	std::mutex allocatorMutex;
+};
@@ -0,0 +1,148 @@
+﻿// object_cache.cpp : create info hashing and the view and sampler lifetimes
+//
+
+#include "object_cache.h"
+#include <stdexcept>
+#include <string>
+
+void ObjectCache::init(VkPhysicalDevice physicalDevice, VkDevice device,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->allocationCallbacks = allocationCallbacks;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	maxSamplerAllocationCount = properties.limits.maxSamplerAllocationCount;
+}
+
+void ObjectCache::destroy()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	for (const auto& entry : imageViews) {
+		vkDestroyImageView(vkDevice, entry.second, allocationCallbacks);
+	}
+	for (const auto& entry : samplers) {
+		vkDestroySampler(vkDevice, entry.second, allocationCallbacks);
+	}
+	for (const auto& retired : retiredImageViews) {
+		vkDestroyImageView(vkDevice, retired.imageView, allocationCallbacks);
+	}
+	imageViews.clear();
+	samplers.clear();
+	retiredImageViews.clear();
+}
+
+VkImageView ObjectCache::getImageView(const VkImageViewCreateInfo& createInfo)
+{
+	if (createInfo.pNext != nullptr) {
+		throw std::runtime_error("image view create info with a pNext chain cannot be cached");
+	}
+	ImageViewKey key;
+	memset(&key, 0, sizeof(key));
+	key.image = createInfo.image;
+	key.flags = createInfo.flags;
+	key.viewType = createInfo.viewType;
+	key.format = createInfo.format;
+	key.components = createInfo.components;
+	key.subresourceRange = createInfo.subresourceRange;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = imageViews.find(key);
+	if (it != imageViews.end()) {
+		statistics.hits++;
+		return it->second;
+	}
+
+	statistics.misses++;
+	VkImageView imageView;
+	if (vkCreateImageView(vkDevice, &createInfo, allocationCallbacks, &imageView) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create image view");
+	}
+	imageViews.emplace(key, imageView);
+	return imageView;
+}
+
+VkSampler ObjectCache::getSampler(const VkSamplerCreateInfo& createInfo)
+{
+	if (createInfo.pNext != nullptr) {
+		throw std::runtime_error("sampler create info with a pNext chain cannot be cached");
+	}
+	SamplerKey key;
+	memset(&key, 0, sizeof(key));
+	key.flags = createInfo.flags;
+	key.magFilter = createInfo.magFilter;
+	key.minFilter = createInfo.minFilter;
+	key.mipmapMode = createInfo.mipmapMode;
+	key.addressModeU = createInfo.addressModeU;
+	key.addressModeV = createInfo.addressModeV;
+	key.addressModeW = createInfo.addressModeW;
+	key.mipLodBias = createInfo.mipLodBias;
+	key.anisotropyEnable = createInfo.anisotropyEnable;
+	key.maxAnisotropy = createInfo.maxAnisotropy;
+	key.compareEnable = createInfo.compareEnable;
+	key.compareOp = createInfo.compareOp;
+	key.minLod = createInfo.minLod;
+	key.maxLod = createInfo.maxLod;
+	key.borderColor = createInfo.borderColor;
+	key.unnormalizedCoordinates = createInfo.unnormalizedCoordinates;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = samplers.find(key);
+	if (it != samplers.end()) {
+		statistics.hits++;
+		return it->second;
+	}
+
+	//past the limit creation may still succeed on some drivers and fail on others,
+	//failing here the same way everywhere is easier to track down
+	if (samplers.size() >= maxSamplerAllocationCount) {
+		throw std::runtime_error("sampler cache is full, maxSamplerAllocationCount is " +
+			std::to_string(maxSamplerAllocationCount));
+	}
+	statistics.misses++;
+	VkSampler sampler;
+	if (vkCreateSampler(vkDevice, &createInfo, allocationCallbacks, &sampler) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create sampler");
+	}
+	samplers.emplace(key, sampler);
+	return sampler;
+}
+
+void ObjectCache::releaseImage(VkImage image, uint64_t retireSerial)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto it = imageViews.begin();
+	while (it != imageViews.end()) {
+		if (it->first.image == image) {
+			retiredImageViews.push_back({ it->second, retireSerial });
+			it = imageViews.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void ObjectCache::releaseRetired(uint64_t completedSerial)
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	auto retired = retiredImageViews.begin();
+	while (retired != retiredImageViews.end()) {
+		if (completedSerial >= retired->retireSerial) {
+			vkDestroyImageView(vkDevice, retired->imageView, allocationCallbacks);
+			retired = retiredImageViews.erase(retired);
+		}
+		else {
+			++retired;
+		}
+	}
+}
+
+ObjectCacheStatistics ObjectCache::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	ObjectCacheStatistics current = statistics;
+	current.imageViewCount = static_cast<uint32_t>(imageViews.size());
+	current.samplerCount = static_cast<uint32_t>(samplers.size());
+	return current;
+}
@@ -0,0 +1,107 @@
+﻿// object_cache.h : image views and samplers deduplicated by their create info, one live
+// object per distinct description no matter how many textures or passes ask for it.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct ObjectCacheStatistics {
+	uint32_t imageViewCount = 0;
+	uint32_t samplerCount = 0;
+	//requests answered with an existing object
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+};
+
+//thread safe, views may be requested while descriptors are written on the workers
+class ObjectCache {
+public:
+	void init(VkPhysicalDevice physicalDevice, VkDevice device,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	//destroys every view and sampler, the device must be idle
+	void destroy();
+
+	//create infos with a pNext chain are not hashed and always throw, everything
+	//else returns the same handle for the same description
+	VkImageView getImageView(const VkImageViewCreateInfo& createInfo);
+	//samplers live until destroy, there are few distinct ones and the device caps
+	//how many may exist at once
+	VkSampler getSampler(const VkSamplerCreateInfo& createInfo);
+	//the views of image leave the cache right away, so a new image that reuses the
+	//handle gets views of its own, and are destroyed once releaseRetired sees
+	//retireSerial completed. call it when the image itself is destroyed or its
+	//swapchain is replaced
+	void releaseImage(VkImage image, uint64_t retireSerial);
+	void releaseRetired(uint64_t completedSerial);
+
+	ObjectCacheStatistics getStatistics();
+
+private:
+	//only the fields that describe the object, copied into zeroed storage so padding
+	//never takes part in the hash or the comparison
+	struct ImageViewKey {
+		VkImage image;
+		VkImageViewCreateFlags flags;
+		VkImageViewType viewType;
+		VkFormat format;
+		VkComponentMapping components;
+		VkImageSubresourceRange subresourceRange;
+	};
+
+	struct SamplerKey {
+		VkSamplerCreateFlags flags;
+		VkFilter magFilter;
+		VkFilter minFilter;
+		VkSamplerMipmapMode mipmapMode;
+		VkSamplerAddressMode addressModeU;
+		VkSamplerAddressMode addressModeV;
+		VkSamplerAddressMode addressModeW;
+		float mipLodBias;
+		VkBool32 anisotropyEnable;
+		float maxAnisotropy;
+		VkBool32 compareEnable;
+		VkCompareOp compareOp;
+		float minLod;
+		float maxLod;
+		VkBorderColor borderColor;
+		VkBool32 unnormalizedCoordinates;
+	};
+
+	//FNV-1a over the key's bytes
+	template <typename Key>
+	struct KeyHash {
+		size_t operator()(const Key& key) const {
+			const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&key);
+			uint64_t hash = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(Key); i++) {
+				hash ^= bytes[i];
+				hash *= 1099511628211ull;
+			}
+			return static_cast<size_t>(hash);
+		}
+	};
+
+	template <typename Key>
+	struct KeyEqual {
+		bool operator()(const Key& a, const Key& b) const { return memcmp(&a, &b, sizeof(Key)) == 0; }
+	};
+
+	struct RetiredImageView {
+		VkImageView imageView;
+		uint64_t retireSerial;
+	};
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	uint32_t maxSamplerAllocationCount = 0;
+	std::unordered_map<ImageViewKey, VkImageView, KeyHash<ImageViewKey>, KeyEqual<ImageViewKey>> imageViews;
+	std::unordered_map<SamplerKey, VkSampler, KeyHash<SamplerKey>, KeyEqual<SamplerKey>> samplers;
+	std::vector<RetiredImageView> retiredImageViews;
+	ObjectCacheStatistics statistics;
+	std::mutex cacheMutex;
+};
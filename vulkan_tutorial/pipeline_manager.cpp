@@ -0,0 +1,188 @@
+﻿// pipeline_manager.cpp : pipeline creation through a persistent VkPipelineCache
+//
+
+#include "pipeline_manager.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+void PipelineManager::prefetchCache(const std::string& cachePath)
+{
+	prefetchedPath = cachePath;
+	prefetchedData = std::async(std::launch::async, [cachePath]() {
+		return readCacheFile(cachePath);
+	});
+}
+
+void PipelineManager::init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& cachePath,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkPhysicalDevice = physicalDevice;
+	this->vkDevice = device;
+	this->allocationCallbacks = allocationCallbacks;
+	this->cachePath = cachePath;
+	vkGetPhysicalDeviceProperties(vkPhysicalDevice, &vkDeviceProperties);
+
+	std::vector<char> cacheData = loadCacheData();
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = cacheData.size();
+	cacheInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+	if (vkCreatePipelineCache(vkDevice, &cacheInfo, allocationCallbacks, &vkPipelineCache) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline cache");
+	}
+}
+
+void PipelineManager::destroy()
+{
+	saveCache();
+	for (auto pipeline : pipelines) {
+		vkDestroyPipeline(vkDevice, pipeline, allocationCallbacks);
+	}
+	pipelines.clear();
+	vkDestroyPipelineCache(vkDevice, vkPipelineCache, allocationCallbacks);
+	vkPipelineCache = VK_NULL_HANDLE;
+}
+
+std::vector<char> PipelineManager::readCacheFile(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		return {};
+	}
+	std::vector<char> data(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(data.data(), data.size());
+	if (!file) {
+		std::cerr << "[Vulkan Log] : failed to read pipeline cache " << path << std::endl;
+		return {};
+	}
+
+	return data;
+}
+
+std::vector<char> PipelineManager::loadCacheData()
+{
+	std::vector<char> data;
+	if (prefetchedData.valid() && prefetchedPath == cachePath) {
+		data = prefetchedData.get();
+	}
+	else {
+		data = readCacheFile(cachePath);
+	}
+	if (data.empty()) {
+		return {};
+	}
+	if (!isCacheCompatible(data)) {
+		std::cerr << "[Vulkan Log] : ignoring pipeline cache " << cachePath << ", it was written for another device or driver" << std::endl;
+		return {};
+	}
+
+	std::cerr << "[Vulkan Log] : loaded pipeline cache " << cachePath << " (" << data.size() << " bytes)" << std::endl;
+	return data;
+}
+
+bool PipelineManager::isCacheCompatible(const std::vector<char>& data)
+{
+	//the header is VkPipelineCacheHeaderVersionOne, read field by field since the
+	//blob carries no alignment guarantees
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+	if (data.size() < headerSize) {
+		return false;
+	}
+
+	uint32_t header[4];
+	memcpy(header, data.data(), sizeof(header));
+	uint8_t cacheUUID[VK_UUID_SIZE];
+	memcpy(cacheUUID, data.data() + 16, VK_UUID_SIZE);
+
+	return header[0] >= headerSize &&
+		header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+		header[2] == vkDeviceProperties.vendorID &&
+		header[3] == vkDeviceProperties.deviceID &&
+		memcmp(cacheUUID, vkDeviceProperties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+bool PipelineManager::saveCache()
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(vkDevice, vkPipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+		return false;
+	}
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(vkDevice, vkPipelineCache, &dataSize, data.data()) != VK_SUCCESS) {
+		return false;
+	}
+
+	//write next to the target and rename over it, the rename is atomic
+	std::string tempPath = cachePath + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), dataSize);
+		if (!file) {
+			std::cerr << "[Vulkan Log] : failed to write pipeline cache " << tempPath << std::endl;
+			return false;
+		}
+	}
+	std::error_code error;
+	std::filesystem::rename(tempPath, cachePath, error);
+	if (error) {
+		std::cerr << "[Vulkan Log] : failed to replace pipeline cache " << cachePath << " : " << error.message() << std::endl;
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	return true;
+}
+
+void PipelineManager::trackPipeline(VkPipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(pipelinesMutex);
+	pipelines.push_back(pipeline);
+}
+
+VkPipeline PipelineManager::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo)
+{
+	VkPipeline pipeline;
+	if (vkCreateGraphicsPipelines(vkDevice, vkPipelineCache, 1, &createInfo, allocationCallbacks, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create graphics pipeline");
+	}
+	trackPipeline(pipeline);
+	return pipeline;
+}
+
+VkPipeline PipelineManager::createComputePipeline(const VkComputePipelineCreateInfo& createInfo)
+{
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(vkDevice, vkPipelineCache, 1, &createInfo, allocationCallbacks, &pipeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute pipeline");
+	}
+	trackPipeline(pipeline);
+	return pipeline;
+}
+
+std::future<VkPipeline> PipelineManager::createGraphicsPipelineAsync(const VkGraphicsPipelineCreateInfo& createInfo)
+{
+	return std::async(std::launch::async, [this, createInfo]() {
+		return createGraphicsPipeline(createInfo);
+	});
+}
+
+std::future<VkPipeline> PipelineManager::createComputePipelineAsync(const VkComputePipelineCreateInfo& createInfo)
+{
+	return std::async(std::launch::async, [this, createInfo]() {
+		return createComputePipeline(createInfo);
+	});
+}
+
+void PipelineManager::destroyPipeline(VkPipeline pipeline)
+{
+	{
+		std::lock_guard<std::mutex> lock(pipelinesMutex);
+		pipelines.erase(std::remove(pipelines.begin(), pipelines.end(), pipeline), pipelines.end());
+	}
+	vkDestroyPipeline(vkDevice, pipeline, allocationCallbacks);
+}
@@ -0,0 +1,54 @@
+﻿// pipeline_manager.h : every graphics and compute pipeline is created through one
+// VkPipelineCache that is loaded from disk at startup and written back on shutdown.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//default location of the serialized pipeline cache, relative to the working directory
+const char* const defaultPipelineCachePath = "pipeline_cache.bin";
+
+class PipelineManager {
+public:
+	//starts reading the cache file on another thread before the device exists,
+	//init then validates and uses that data instead of reading the file itself
+	void prefetchCache(const std::string& cachePath);
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& cachePath,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	//writes the cache back to disk and destroys every pipeline it created
+	void destroy();
+	//the file is replaced atomically, a crash mid write never leaves a torn cache behind
+	bool saveCache();
+
+	VkPipeline createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& createInfo);
+	VkPipeline createComputePipeline(const VkComputePipelineCreateInfo& createInfo);
+	//compile on a worker thread, everything the create info points to (shader stages,
+	//layouts, state structs) has to stay alive until the future is ready
+	std::future<VkPipeline> createGraphicsPipelineAsync(const VkGraphicsPipelineCreateInfo& createInfo);
+	std::future<VkPipeline> createComputePipelineAsync(const VkComputePipelineCreateInfo& createInfo);
+	void destroyPipeline(VkPipeline pipeline);
+
+	VkPipelineCache getPipelineCache() const { return vkPipelineCache; }
+
+private:
+	static std::vector<char> readCacheFile(const std::string& path);
+	std::vector<char> loadCacheData();
+	bool isCacheCompatible(const std::vector<char>& data);
+	void trackPipeline(VkPipeline pipeline);
+
+	VkPhysicalDevice vkPhysicalDevice = VK_NULL_HANDLE;
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	VkPhysicalDeviceProperties vkDeviceProperties{};
+	std::string cachePath;
+	std::string prefetchedPath;
+	std::future<std::vector<char>> prefetchedData;
+	//the cache is internally synchronized, creation may run on any thread
+	VkPipelineCache vkPipelineCache = VK_NULL_HANDLE;
+	std::mutex pipelinesMutex;
+	std::vector<VkPipeline> pipelines;
+};
@@ -0,0 +1,636 @@
+﻿// render_graph.cpp : pass ordering, barrier derivation and transient image aliasing
+//
+
+#include "render_graph.h"
+#include <algorithm>
+#include <stdexcept>
+
+//only stage and access bits that exist in both synchronization apis are used, so
+//the fallback path can pass the low 32 bits straight to vkCmdPipelineBarrier
+struct AccessInfo {
+	VkPipelineStageFlags2KHR stages;
+	VkAccessFlags2KHR access;
+	VkImageLayout layout;
+	VkImageUsageFlags usage;
+	bool write;
+};
+
+static const VkPipelineStageFlags2KHR shaderStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR |
+	VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR;
+static const VkPipelineStageFlags2KHR depthStages = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR |
+	VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR;
+//the stages the frame's submission waits on the acquire semaphore with
+static const VkPipelineStageFlags2KHR acquireStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR |
+	VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR;
+
+static AccessInfo describeAccess(RenderGraphAccess access)
+{
+	switch (access) {
+	case RenderGraphAccess::ColorAttachmentWrite:
+		return { VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR,
+			VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true };
+	case RenderGraphAccess::DepthAttachmentWrite:
+		return { depthStages,
+			VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, true };
+	case RenderGraphAccess::DepthAttachmentRead:
+		return { depthStages, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR,
+			VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, false };
+	case RenderGraphAccess::SampledRead:
+		return { shaderStages, VK_ACCESS_2_SHADER_READ_BIT_KHR,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false };
+	case RenderGraphAccess::StorageRead:
+		return { shaderStages, VK_ACCESS_2_SHADER_READ_BIT_KHR,
+			VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false };
+	case RenderGraphAccess::StorageWrite:
+		return { shaderStages, VK_ACCESS_2_SHADER_READ_BIT_KHR | VK_ACCESS_2_SHADER_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true };
+	case RenderGraphAccess::TransferRead:
+		return { VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false };
+	case RenderGraphAccess::TransferWrite:
+		return { VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true };
+	case RenderGraphAccess::IndirectRead:
+	default:
+		return { VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT_KHR, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT_KHR,
+			VK_IMAGE_LAYOUT_UNDEFINED, 0, false };
+	}
+}
+
+RenderGraphPass& RenderGraphPass::access(RenderGraphResource resource, RenderGraphAccess access)
+{
+	accesses.push_back({ resource, access });
+	return *this;
+}
+
+void RenderGraph::init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+	this->allocator = &allocator;
+	synchronization2 = dispatch->vkCmdPipelineBarrier2KHR != nullptr;
+	swapChainResource = addResource("swapchain", ResourceKind::SwapChain);
+}
+
+void RenderGraph::destroy()
+{
+	retireTransientImages();
+	releaseRetired(UINT64_MAX);
+	resources.clear();
+	passes.clear();
+	executionOrder.clear();
+	passAccesses.clear();
+}
+
+RenderGraphResource RenderGraph::addResource(const std::string& name, ResourceKind kind)
+{
+	Resource resource;
+	resource.name = name;
+	resource.kind = kind;
+	resources.push_back(resource);
+	dirty = true;
+	return static_cast<RenderGraphResource>(resources.size() - 1);
+}
+
+RenderGraphResource RenderGraph::createImage(const std::string& name, const TransientImageDesc& desc)
+{
+	RenderGraphResource resource = addResource(name, ResourceKind::Transient);
+	resources[resource].desc = desc;
+	return resource;
+}
+
+RenderGraphResource RenderGraph::importImage(const std::string& name, VkImage image, VkImageView imageView,
+	VkFormat format, VkExtent2D extent, VkImageAspectFlags aspect, VkImageLayout layout)
+{
+	RenderGraphResource resource = addResource(name, ResourceKind::ImportedImage);
+	Resource& imported = resources[resource];
+	imported.image = image;
+	imported.imageView = imageView;
+	imported.desc.format = format;
+	imported.desc.aspect = aspect;
+	imported.extent = extent;
+	imported.importedLayout = layout;
+	imported.state.layout = layout;
+	return resource;
+}
+
+RenderGraphResource RenderGraph::importBuffer(const std::string& name, VkBuffer buffer)
+{
+	RenderGraphResource resource = addResource(name, ResourceKind::ImportedBuffer);
+	resources[resource].buffer = buffer;
+	return resource;
+}
+
+void RenderGraph::setSwapChain(const std::vector<VkImage>& images, const std::vector<VkImageView>& imageViews,
+	VkFormat format, VkExtent2D extent, bool presentable)
+{
+	swapChainImages = images;
+	swapChainImageViews = imageViews;
+	swapChainPresentable = presentable;
+	Resource& swapChain = resources[swapChainResource];
+	swapChain.desc.format = format;
+	swapChain.extent = extent;
+
+	if (extent.width != swapChainExtent.width || extent.height != swapChainExtent.height) {
+		swapChainExtent = extent;
+		for (const auto& resource : resources) {
+			if (resource.kind == ResourceKind::Transient && resource.desc.extent.width == 0) {
+				dirty = true;
+			}
+		}
+	}
+}
+
+RenderGraphPass& RenderGraph::addPass(const std::string& name, RenderGraphExecute execute)
+{
+	passes.emplace_back();
+	passes.back().name = name;
+	passes.back().execute = std::move(execute);
+	dirty = true;
+	return passes.back();
+}
+
+void RenderGraph::compile()
+{
+	//walking backwards, a pass is live when it has side effects, writes something that
+	//outlives the frame or writes something a live pass touches later
+	std::vector<bool> needed(resources.size(), false);
+	std::vector<uint32_t> livePasses;
+	for (uint32_t i = static_cast<uint32_t>(passes.size()); i-- > 0;) {
+		const RenderGraphPass& pass = passes[i];
+		bool live = pass.sideEffects;
+		for (const auto& access : pass.accesses) {
+			if (access.resource >= resources.size()) {
+				throw std::runtime_error("render graph pass " + pass.name + " uses an unknown resource");
+			}
+			if (describeAccess(access.access).write &&
+				(resources[access.resource].kind != ResourceKind::Transient || needed[access.resource])) {
+				live = true;
+			}
+		}
+		if (live) {
+			//attachment writes may load what was there before, so every resource a
+			//live pass touches keeps its earlier writers alive
+			for (const auto& access : pass.accesses) {
+				needed[access.resource] = true;
+			}
+			livePasses.push_back(i);
+		}
+	}
+	std::reverse(livePasses.begin(), livePasses.end());
+	statistics.passCount = static_cast<uint32_t>(livePasses.size());
+	statistics.culledPassCount = static_cast<uint32_t>(passes.size() - livePasses.size());
+
+	orderPasses(livePasses);
+
+	//one merged access per resource and pass, a pass touching a resource twice
+	//gets a single barrier covering both uses
+	passAccesses.assign(executionOrder.size(), {});
+	for (auto& resource : resources) {
+		resource.firstUse = UINT32_MAX;
+		resource.lastUse = 0;
+		resource.usage = 0;
+	}
+	for (uint32_t position = 0; position < executionOrder.size(); position++) {
+		const RenderGraphPass& pass = passes[executionOrder[position]];
+		for (const auto& access : pass.accesses) {
+			AccessInfo info = describeAccess(access.access);
+			Resource& resource = resources[access.resource];
+			auto merged = std::find_if(passAccesses[position].begin(), passAccesses[position].end(),
+				[&](const MergedAccess& existing) { return existing.resource == access.resource; });
+			if (merged == passAccesses[position].end()) {
+				passAccesses[position].push_back({ access.resource, info.stages, info.access, info.layout, info.write });
+			}
+			else {
+				if (resource.kind != ResourceKind::ImportedBuffer && merged->layout != info.layout) {
+					throw std::runtime_error("render graph pass " + pass.name + " needs " + resource.name + " in two layouts");
+				}
+				merged->stages |= info.stages;
+				merged->access |= info.access;
+				merged->write = merged->write || info.write;
+			}
+			resource.firstUse = std::min(resource.firstUse, position);
+			resource.lastUse = std::max(resource.lastUse, position);
+			resource.usage |= info.usage;
+		}
+	}
+
+	retireTransientImages();
+	createTransientImages();
+	dirty = false;
+}
+
+void RenderGraph::orderPasses(std::vector<uint32_t>& livePasses)
+{
+	//the order passes were added in is always valid, it only decides what depends on what
+	size_t passCount = livePasses.size();
+	std::vector<std::vector<uint32_t>> dependents(passCount);
+	std::vector<uint32_t> dependencyCount(passCount, 0);
+	std::vector<std::vector<bool>> dependsOn(passCount, std::vector<bool>(passCount, false));
+	auto addDependency = [&](uint32_t from, uint32_t to) {
+		if (from != to && !dependsOn[to][from]) {
+			dependsOn[to][from] = true;
+			dependents[from].push_back(to);
+			dependencyCount[to]++;
+		}
+	};
+	for (RenderGraphResource resource = 0; resource < resources.size(); resource++) {
+		uint32_t lastWriter = UINT32_MAX;
+		std::vector<uint32_t> readers;
+		for (uint32_t i = 0; i < passCount; i++) {
+			bool reads = false, writes = false;
+			for (const auto& access : passes[livePasses[i]].accesses) {
+				if (access.resource == resource) {
+					(describeAccess(access.access).write ? writes : reads) = true;
+				}
+			}
+			if (writes) {
+				if (lastWriter != UINT32_MAX) {
+					addDependency(lastWriter, i);
+				}
+				for (uint32_t reader : readers) {
+					addDependency(reader, i);
+				}
+				lastWriter = i;
+				readers.clear();
+			}
+			else if (reads) {
+				if (lastWriter != UINT32_MAX) {
+					addDependency(lastWriter, i);
+				}
+				readers.push_back(i);
+			}
+		}
+	}
+
+	//among the passes that are ready, prefer one that does not consume what was just
+	//scheduled, the barrier between producer and consumer then has other work to hide behind
+	executionOrder.clear();
+	std::vector<uint32_t> ready;
+	for (uint32_t i = 0; i < passCount; i++) {
+		if (dependencyCount[i] == 0) {
+			ready.push_back(i);
+		}
+	}
+	uint32_t previous = UINT32_MAX;
+	while (!ready.empty()) {
+		auto next = ready.begin();
+		for (auto it = ready.begin(); it != ready.end(); ++it) {
+			bool itIndependent = previous == UINT32_MAX || !dependsOn[*it][previous];
+			bool nextIndependent = previous == UINT32_MAX || !dependsOn[*next][previous];
+			if ((itIndependent && !nextIndependent) || (itIndependent == nextIndependent && *it < *next)) {
+				next = it;
+			}
+		}
+		previous = *next;
+		ready.erase(next);
+		executionOrder.push_back(livePasses[previous]);
+		for (uint32_t dependent : dependents[previous]) {
+			if (--dependencyCount[dependent] == 0) {
+				ready.push_back(dependent);
+			}
+		}
+	}
+}
+
+void RenderGraph::createTransientImages()
+{
+	std::vector<RenderGraphResource> transients;
+	std::vector<VkMemoryRequirements> requirements(resources.size());
+	statistics.transientBytes = 0;
+	statistics.allocatedBytes = 0;
+	for (RenderGraphResource i = 0; i < resources.size(); i++) {
+		Resource& resource = resources[i];
+		if (resource.kind != ResourceKind::Transient || resource.firstUse == UINT32_MAX) {
+			continue;
+		}
+		resource.extent = resource.desc.extent.width != 0 ? resource.desc.extent : swapChainExtent;
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = resource.desc.format;
+		imageInfo.extent = { resource.extent.width, resource.extent.height, 1 };
+		imageInfo.mipLevels = resource.desc.mipLevels;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = resource.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		if (vkCreateImage(vkDevice, &imageInfo, allocationCallbacks, &resource.image) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create render graph image " + resource.name);
+		}
+		vkGetImageMemoryRequirements(vkDevice, resource.image, &requirements[i]);
+		statistics.transientBytes += requirements[i].size;
+		transients.push_back(i);
+	}
+
+	//largest first, each image goes into the first slot whose occupants are all dead
+	//before it is first used or born after it was last used
+	std::sort(transients.begin(), transients.end(), [&](RenderGraphResource a, RenderGraphResource b) {
+		return requirements[a].size > requirements[b].size;
+	});
+	for (RenderGraphResource i : transients) {
+		Resource& resource = resources[i];
+		uint32_t slotIndex = 0;
+		for (; slotIndex < memorySlots.size(); slotIndex++) {
+			MemorySlot& slot = memorySlots[slotIndex];
+			if ((slot.requirements.memoryTypeBits & requirements[i].memoryTypeBits) == 0) {
+				continue;
+			}
+			bool overlaps = std::any_of(slot.occupants.begin(), slot.occupants.end(), [&](RenderGraphResource occupant) {
+				return resources[occupant].firstUse <= resource.lastUse && resource.firstUse <= resources[occupant].lastUse;
+			});
+			if (!overlaps) {
+				break;
+			}
+		}
+		if (slotIndex == memorySlots.size()) {
+			memorySlots.emplace_back();
+			memorySlots.back().requirements = requirements[i];
+		}
+		MemorySlot& slot = memorySlots[slotIndex];
+		slot.requirements.size = std::max(slot.requirements.size, requirements[i].size);
+		slot.requirements.alignment = std::max(slot.requirements.alignment, requirements[i].alignment);
+		slot.requirements.memoryTypeBits &= requirements[i].memoryTypeBits;
+		slot.occupants.push_back(i);
+		resource.memorySlot = slotIndex;
+	}
+
+	for (auto& slot : memorySlots) {
+		slot.allocation = allocator->allocate(slot.requirements, MemoryUsage::GpuOnly, false);
+		statistics.allocatedBytes += slot.requirements.size;
+		std::sort(slot.occupants.begin(), slot.occupants.end(), [&](RenderGraphResource a, RenderGraphResource b) {
+			return resources[a].firstUse < resources[b].firstUse;
+		});
+		for (RenderGraphResource occupant : slot.occupants) {
+			Resource& resource = resources[occupant];
+			vkBindImageMemory(vkDevice, resource.image, slot.allocation.memory, slot.allocation.offset);
+
+			VkImageViewCreateInfo viewInfo{};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = resource.image;
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = resource.desc.format;
+			viewInfo.subresourceRange.aspectMask = resource.desc.aspect;
+			viewInfo.subresourceRange.levelCount = resource.desc.mipLevels;
+			viewInfo.subresourceRange.layerCount = 1;
+			if (vkCreateImageView(vkDevice, &viewInfo, allocationCallbacks, &resource.imageView) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create render graph image view " + resource.name);
+			}
+			resource.state = ResourceState{};
+		}
+	}
+}
+
+void RenderGraph::retireTransientImages()
+{
+	Retired old;
+	old.retireSerial = lastFrameSerial;
+	for (auto& resource : resources) {
+		if (resource.kind == ResourceKind::Transient && resource.image != VK_NULL_HANDLE) {
+			old.images.push_back(resource.image);
+			old.imageViews.push_back(resource.imageView);
+			resource.image = VK_NULL_HANDLE;
+			resource.imageView = VK_NULL_HANDLE;
+			resource.memorySlot = UINT32_MAX;
+		}
+	}
+	for (const auto& slot : memorySlots) {
+		old.allocations.push_back(slot.allocation);
+	}
+	memorySlots.clear();
+	if (!old.images.empty()) {
+		retired.push_back(old);
+	}
+}
+
+void RenderGraph::releaseRetired(uint64_t completedSerial)
+{
+	auto it = retired.begin();
+	while (it != retired.end()) {
+		if (completedSerial >= it->retireSerial) {
+			for (auto imageView : it->imageViews) {
+				vkDestroyImageView(vkDevice, imageView, allocationCallbacks);
+			}
+			for (auto image : it->images) {
+				vkDestroyImage(vkDevice, image, allocationCallbacks);
+			}
+			for (const auto& allocation : it->allocations) {
+				allocator->free(allocation);
+			}
+			it = retired.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void RenderGraph::addBarrier(Resource& resource, VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access,
+	VkImageLayout layout, bool write)
+{
+	ResourceState& state = resource.state;
+	bool isImage = resource.kind != ResourceKind::ImportedBuffer;
+	bool transition = isImage && layout != state.layout;
+	bool needed;
+	if (transition) {
+		needed = true;
+	}
+	else if (write) {
+		//write after write and write after read
+		needed = (state.writeStages | state.readStages) != 0;
+	}
+	else {
+		//read after write, reads that already waited on the write need nothing new
+		needed = state.writeStages != 0 && (stages & ~state.visibleStages) != 0;
+	}
+
+	if (needed) {
+		VkPipelineStageFlags2KHR srcStages = (write || transition) ? state.writeStages | state.readStages : state.writeStages;
+		if (isImage) {
+			VkImageMemoryBarrier2KHR barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+			barrier.srcStageMask = srcStages;
+			barrier.srcAccessMask = state.writeAccess;
+			barrier.dstStageMask = stages;
+			barrier.dstAccessMask = access;
+			barrier.oldLayout = state.layout;
+			barrier.newLayout = layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = resource.kind == ResourceKind::SwapChain ? swapChainImages[currentImageIndex] : resource.image;
+			barrier.subresourceRange.aspectMask = resource.desc.aspect;
+			barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+			imageBarriers.push_back(barrier);
+		}
+		else {
+			VkBufferMemoryBarrier2KHR barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2_KHR;
+			barrier.srcStageMask = srcStages;
+			barrier.srcAccessMask = state.writeAccess;
+			barrier.dstStageMask = stages;
+			barrier.dstAccessMask = access;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.buffer = resource.buffer;
+			barrier.size = VK_WHOLE_SIZE;
+			bufferBarriers.push_back(barrier);
+		}
+	}
+
+	//a layout transition counts as a write that happens at the destination stages
+	if (write || transition) {
+		state.writeStages = stages;
+		state.writeAccess = write ? access : 0;
+		state.readStages = write ? 0 : stages;
+		state.visibleStages = stages;
+		state.layout = isImage ? layout : state.layout;
+	}
+	else {
+		state.readStages |= stages;
+		if (needed) {
+			state.visibleStages |= stages;
+		}
+	}
+}
+
+void RenderGraph::flushBarriers(VkCommandBuffer commandBuffer)
+{
+	if (imageBarriers.empty() && bufferBarriers.empty()) {
+		return;
+	}
+	statistics.barrierCount += static_cast<uint32_t>(imageBarriers.size() + bufferBarriers.size());
+	statistics.barrierBatchCount++;
+
+	if (synchronization2) {
+		VkDependencyInfoKHR dependencyInfo{};
+		dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+		dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(bufferBarriers.size());
+		dependencyInfo.pBufferMemoryBarriers = bufferBarriers.data();
+		dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(imageBarriers.size());
+		dependencyInfo.pImageMemoryBarriers = imageBarriers.data();
+		dispatch->vkCmdPipelineBarrier2KHR(commandBuffer, &dependencyInfo);
+	}
+	else {
+		//one call takes a single pair of stage masks, the union of all of them
+		VkPipelineStageFlags srcStages = 0;
+		VkPipelineStageFlags dstStages = 0;
+		std::vector<VkImageMemoryBarrier> legacyImageBarriers;
+		std::vector<VkBufferMemoryBarrier> legacyBufferBarriers;
+		for (const auto& barrier : imageBarriers) {
+			srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+			dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+			VkImageMemoryBarrier legacy{};
+			legacy.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+			legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+			legacy.oldLayout = barrier.oldLayout;
+			legacy.newLayout = barrier.newLayout;
+			legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+			legacy.image = barrier.image;
+			legacy.subresourceRange = barrier.subresourceRange;
+			legacyImageBarriers.push_back(legacy);
+		}
+		for (const auto& barrier : bufferBarriers) {
+			srcStages |= static_cast<VkPipelineStageFlags>(barrier.srcStageMask);
+			dstStages |= static_cast<VkPipelineStageFlags>(barrier.dstStageMask);
+			VkBufferMemoryBarrier legacy{};
+			legacy.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			legacy.srcAccessMask = static_cast<VkAccessFlags>(barrier.srcAccessMask);
+			legacy.dstAccessMask = static_cast<VkAccessFlags>(barrier.dstAccessMask);
+			legacy.srcQueueFamilyIndex = barrier.srcQueueFamilyIndex;
+			legacy.dstQueueFamilyIndex = barrier.dstQueueFamilyIndex;
+			legacy.buffer = barrier.buffer;
+			legacy.offset = barrier.offset;
+			legacy.size = barrier.size;
+			legacyBufferBarriers.push_back(legacy);
+		}
+		dispatch->vkCmdPipelineBarrier(commandBuffer, srcStages != 0 ? srcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			dstStages != 0 ? dstStages : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+			static_cast<uint32_t>(legacyBufferBarriers.size()), legacyBufferBarriers.data(),
+			static_cast<uint32_t>(legacyImageBarriers.size()), legacyImageBarriers.data());
+	}
+
+	imageBarriers.clear();
+	bufferBarriers.clear();
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint64_t frameSerial)
+{
+	if (dirty) {
+		compile();
+	}
+	currentImageIndex = imageIndex;
+	lastFrameSerial = frameSerial;
+	statistics.barrierCount = 0;
+	statistics.barrierBatchCount = 0;
+
+	//the acquired image's previous contents are discarded, the transition out of
+	//undefined waits on the stages the acquire semaphore is waited on at
+	Resource& swapChain = resources[swapChainResource];
+	swapChain.state = ResourceState{};
+	swapChain.state.writeStages = acquireStages;
+
+	for (uint32_t position = 0; position < executionOrder.size(); position++) {
+		for (const auto& merged : passAccesses[position]) {
+			Resource& resource = resources[merged.resource];
+			//a transient image starts out undefined and after whatever last used its
+			//memory, the previous occupant of its slot or, for the first, the last one
+			//of the previous frame
+			if (resource.kind == ResourceKind::Transient && resource.firstUse == position) {
+				const MemorySlot& slot = memorySlots[resource.memorySlot];
+				auto occupant = std::find(slot.occupants.begin(), slot.occupants.end(), merged.resource);
+				RenderGraphResource predecessor = occupant == slot.occupants.begin() ? slot.occupants.back() : *(occupant - 1);
+				const ResourceState& previous = resources[predecessor].state;
+				ResourceState fresh;
+				fresh.writeStages = previous.writeStages | previous.readStages;
+				fresh.writeAccess = previous.writeAccess;
+				resource.state = fresh;
+			}
+			addBarrier(resource, merged.stages, merged.access, merged.layout, merged.write);
+		}
+		//everything the pass needs goes out in one call
+		flushBarriers(commandBuffer);
+		const RenderGraphPass& pass = passes[executionOrder[position]];
+		pass.execute(commandBuffer, *this);
+	}
+
+	//hand the swapchain image to presentation and imported images back in their layouts
+	addBarrier(swapChain, swapChainPresentable ? VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT_KHR : VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR,
+		swapChainPresentable ? 0 : VK_ACCESS_2_TRANSFER_READ_BIT_KHR,
+		swapChainPresentable ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false);
+	for (auto& resource : resources) {
+		if (resource.kind == ResourceKind::ImportedImage && resource.state.layout != resource.importedLayout) {
+			addBarrier(resource, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT_KHR,
+				VK_ACCESS_2_MEMORY_READ_BIT_KHR | VK_ACCESS_2_MEMORY_WRITE_BIT_KHR, resource.importedLayout, false);
+		}
+	}
+	flushBarriers(commandBuffer);
+}
+
+VkImage RenderGraph::getImage(RenderGraphResource resource) const
+{
+	return resources[resource].kind == ResourceKind::SwapChain ? swapChainImages[currentImageIndex] : resources[resource].image;
+}
+
+VkImageView RenderGraph::getImageView(RenderGraphResource resource) const
+{
+	return resources[resource].kind == ResourceKind::SwapChain ? swapChainImageViews[currentImageIndex] : resources[resource].imageView;
+}
+
+VkBuffer RenderGraph::getBuffer(RenderGraphResource resource) const
+{
+	return resources[resource].buffer;
+}
+
+VkExtent2D RenderGraph::getExtent(RenderGraphResource resource) const
+{
+	return resources[resource].extent;
+}
@@ -0,0 +1,213 @@
+﻿// render_graph.h : passes declare the images and buffers they touch, the graph orders them,
+// derives every barrier and layout transition, and lets transient attachments share memory.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include "memory_allocator.h"
+#include "device_dispatch.h"
+
+using RenderGraphResource = uint32_t;
+const RenderGraphResource invalidRenderGraphResource = UINT32_MAX;
+
+//what a pass does with a resource, each maps to the stages, access mask and image
+//layout the barriers are derived from
+enum class RenderGraphAccess {
+	ColorAttachmentWrite,
+	DepthAttachmentWrite,
+	DepthAttachmentRead,
+	SampledRead,
+	StorageRead,
+	StorageWrite,
+	TransferRead,
+	TransferWrite,
+	IndirectRead
+};
+
+//an image the graph owns, its contents do not survive from one frame to the next
+struct TransientImageDesc {
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	//a zero extent follows the swapchain and is recreated along with it
+	VkExtent2D extent = { 0, 0 };
+	VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+	uint32_t mipLevels = 1;
+};
+
+struct RenderGraphStatistics {
+	uint32_t passCount = 0;
+	//passes dropped because nothing they write is ever used
+	uint32_t culledPassCount = 0;
+	//barriers and the pipeline barrier calls they were batched into, for the last execute
+	uint32_t barrierCount = 0;
+	uint32_t barrierBatchCount = 0;
+	//what the transient images would take on their own and what they take aliased
+	VkDeviceSize transientBytes = 0;
+	VkDeviceSize allocatedBytes = 0;
+};
+
+class RenderGraph;
+using RenderGraphExecute = std::function<void(VkCommandBuffer commandBuffer, const RenderGraph& graph)>;
+
+class RenderGraphPass {
+public:
+	RenderGraphPass& access(RenderGraphResource resource, RenderGraphAccess access);
+	//keeps the pass even when nothing reads what it writes, e.g. a readback
+	RenderGraphPass& setSideEffects() { sideEffects = true; return *this; }
+
+private:
+	friend class RenderGraph;
+	struct ResourceAccess {
+		RenderGraphResource resource;
+		RenderGraphAccess access;
+	};
+
+	std::string name;
+	RenderGraphExecute execute;
+	std::vector<ResourceAccess> accesses;
+	bool sideEffects = false;
+};
+
+//passes render into attachments the graph has already transitioned, so their render
+//passes should keep the layout the access implies as both initial and final layout
+//and leave the external subpass dependencies to the graph
+class RenderGraph {
+public:
+	//barriers go through vkCmdPipelineBarrier2KHR when the device was created with
+	//VK_KHR_synchronization2, otherwise the same barriers go through vkCmdPipelineBarrier
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+
+	RenderGraphResource createImage(const std::string& name, const TransientImageDesc& desc);
+	//layout is what the image is in before the first pass and is restored after the last
+	RenderGraphResource importImage(const std::string& name, VkImage image, VkImageView imageView,
+		VkFormat format, VkExtent2D extent, VkImageAspectFlags aspect, VkImageLayout layout);
+	RenderGraphResource importBuffer(const std::string& name, VkBuffer buffer);
+	//the image being presented this frame, ends up in PRESENT_SRC_KHR or, when it is not
+	//presentable because it is offscreen or copied out first, in TRANSFER_SRC_OPTIMAL
+	//behind a barrier to transfer reads
+	RenderGraphResource getSwapChainImage() const { return swapChainResource; }
+	//called whenever createSwapChain and createImageViews ran, swapchain sized transient
+	//images are recreated and the old ones released once the last frame using them completed
+	void setSwapChain(const std::vector<VkImage>& images, const std::vector<VkImageView>& imageViews,
+		VkFormat format, VkExtent2D extent, bool presentable);
+
+	//passes are executed in an order that respects what they read and write, not
+	//necessarily the order they were added in
+	RenderGraphPass& addPass(const std::string& name, RenderGraphExecute execute);
+	bool empty() const { return passes.empty(); }
+	//records every live pass into the frame's command buffer, compiling first when passes
+	//or resources changed, the swapchain image must already be acquired
+	void execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint64_t frameSerial);
+	void releaseRetired(uint64_t completedSerial);
+
+	VkImage getImage(RenderGraphResource resource) const;
+	VkImageView getImageView(RenderGraphResource resource) const;
+	VkBuffer getBuffer(RenderGraphResource resource) const;
+	VkExtent2D getExtent(RenderGraphResource resource) const;
+	const RenderGraphStatistics& getStatistics() const { return statistics; }
+
+private:
+	enum class ResourceKind {
+		Transient,
+		ImportedImage,
+		ImportedBuffer,
+		SwapChain
+	};
+
+	//where the last write and the reads since then happened, enough to derive
+	//the next barrier without looking back at the passes
+	struct ResourceState {
+		VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags2KHR writeStages = 0;
+		VkAccessFlags2KHR writeAccess = 0;
+		VkPipelineStageFlags2KHR readStages = 0;
+		//stages that have already waited on the last write
+		VkPipelineStageFlags2KHR visibleStages = 0;
+	};
+
+	struct Resource {
+		std::string name;
+		ResourceKind kind;
+		TransientImageDesc desc;
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView imageView = VK_NULL_HANDLE;
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkExtent2D extent = { 0, 0 };
+		VkImageLayout importedLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageUsageFlags usage = 0;
+		ResourceState state;
+		//execution order index of the first and last live pass touching it
+		uint32_t firstUse = UINT32_MAX;
+		uint32_t lastUse = 0;
+		//transient images only, the memory slot they share with others
+		uint32_t memorySlot = UINT32_MAX;
+	};
+
+	//one allocation shared by transient images whose lifetimes do not overlap
+	struct MemorySlot {
+		VkMemoryRequirements requirements{};
+		MemoryAllocation allocation;
+		//occupants in execution order, each one inherits the previous one's last access
+		std::vector<RenderGraphResource> occupants;
+	};
+
+	struct MergedAccess {
+		RenderGraphResource resource;
+		VkPipelineStageFlags2KHR stages;
+		VkAccessFlags2KHR access;
+		VkImageLayout layout;
+		bool write;
+	};
+
+	struct Retired {
+		std::vector<VkImage> images;
+		std::vector<VkImageView> imageViews;
+		std::vector<MemoryAllocation> allocations;
+		uint64_t retireSerial;
+	};
+
+	RenderGraphResource addResource(const std::string& name, ResourceKind kind);
+	void compile();
+	void orderPasses(std::vector<uint32_t>& livePasses);
+	void createTransientImages();
+	void retireTransientImages();
+	void addBarrier(Resource& resource, VkPipelineStageFlags2KHR stages, VkAccessFlags2KHR access,
+		VkImageLayout layout, bool write);
+	void flushBarriers(VkCommandBuffer commandBuffer);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	MemoryAllocator* allocator = nullptr;
+	bool synchronization2 = false;
+
+	std::vector<Resource> resources;
+	//a deque so the references addPass hands out stay valid
+	std::deque<RenderGraphPass> passes;
+	//indices into passes in execution order, dead passes left out
+	std::vector<uint32_t> executionOrder;
+	//what each pass in executionOrder does with its resources, one entry per resource
+	std::vector<std::vector<MergedAccess>> passAccesses;
+	std::vector<MemorySlot> memorySlots;
+	std::vector<Retired> retired;
+	bool dirty = true;
+	//frame that last used the current transient images
+	uint64_t lastFrameSerial = 0;
+
+	RenderGraphResource swapChainResource = invalidRenderGraphResource;
+	std::vector<VkImage> swapChainImages;
+	std::vector<VkImageView> swapChainImageViews;
+	VkExtent2D swapChainExtent = { 0, 0 };
+	bool swapChainPresentable = true;
+	uint32_t currentImageIndex = 0;
+
+	std::vector<VkImageMemoryBarrier2KHR> imageBarriers;
+	std::vector<VkBufferMemoryBarrier2KHR> bufferBarriers;
+	RenderGraphStatistics statistics;
+};
@@ -0,0 +1,531 @@
+﻿// shader_manager.cpp : module sharing, the inotify watcher and the pipeline swaps
+//
+
+#include "shader_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#ifdef __linux__
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+//editors tend to write a file several times per save, compile once it has settled
+static const std::chrono::milliseconds reloadSettleTime(100);
+
+void ShaderManager::init(VkDevice device, PipelineManager& pipelineManager, const std::string& spirvDirectory,
+	const std::string& sourceDirectory, const std::string& compilerPath, bool hotReload, const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->allocationCallbacks = allocationCallbacks;
+	this->pipelineManager = &pipelineManager;
+	this->spirvDirectory = spirvDirectory;
+	this->sourceDirectory = sourceDirectory;
+	this->compilerPath = compilerPath;
+	if (!hotReload) {
+		return;
+	}
+
+#ifdef __linux__
+	inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	wakeFd = eventfd(0, EFD_CLOEXEC);
+	//whole files only, a rename covers editors that save through a temporary
+	if (inotifyFd < 0 || wakeFd < 0 ||
+		inotify_add_watch(inotifyFd, sourceDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		std::cerr << "[Vulkan Log] : cannot watch " << sourceDirectory << ", shader hot reload disabled" << std::endl;
+		if (inotifyFd >= 0) {
+			close(inotifyFd);
+		}
+		if (wakeFd >= 0) {
+			close(wakeFd);
+		}
+		inotifyFd = -1;
+		wakeFd = -1;
+		return;
+	}
+	stopWatching = false;
+	watcher = std::thread(&ShaderManager::watch, this);
+#else
+	std::cerr << "[Vulkan Log] : shader hot reload needs inotify, disabled on this platform" << std::endl;
+#endif
+}
+
+void ShaderManager::destroy()
+{
+	if (vkDevice == VK_NULL_HANDLE) {
+		return;
+	}
+
+#ifdef __linux__
+	if (watcher.joinable()) {
+		stopWatching = true;
+		uint64_t wake = 1;
+		if (write(wakeFd, &wake, sizeof(wake)) < 0) {
+			std::cerr << "[Vulkan Log] : failed to wake the shader watcher" << std::endl;
+		}
+		watcher.join();
+		close(inotifyFd);
+		close(wakeFd);
+		inotifyFd = -1;
+		wakeFd = -1;
+	}
+#endif
+
+	{
+		std::lock_guard<std::mutex> lock(pipelineMutex);
+		for (const auto& reload : reloads) {
+			pipelineManager->destroyPipeline(reload.replacement);
+		}
+		for (const auto& pipeline : retired) {
+			pipelineManager->destroyPipeline(pipeline.pipeline);
+		}
+		for (const auto& pipeline : pipelines) {
+			if (pipeline.live) {
+				pipelineManager->destroyPipeline(pipeline.pipeline);
+			}
+		}
+		reloads.clear();
+		retired.clear();
+		pipelines.clear();
+		dependencies.clear();
+	}
+
+	//references still held by callers die with the device
+	std::lock_guard<std::mutex> lock(moduleMutex);
+	for (const auto& entry : modules) {
+		vkDestroyShaderModule(vkDevice, entry.second.module, allocationCallbacks);
+	}
+	modules.clear();
+	namedModules.clear();
+	vkDevice = VK_NULL_HANDLE;
+}
+
+uint64_t ShaderManager::hashCode(const std::vector<uint32_t>& code)
+{
+	//FNV-1a over the words' bytes
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(code.data());
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < code.size() * sizeof(uint32_t); i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+std::vector<uint32_t> ShaderManager::readSpirv(const std::string& name)
+{
+	std::string path = spirvDirectory + "/" + name + ".spv";
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open shader " + path);
+	}
+	size_t size = static_cast<size_t>(file.tellg());
+	if (size == 0 || size % sizeof(uint32_t) != 0) {
+		throw std::runtime_error("shader " + path + " is not SPIR-V");
+	}
+	std::vector<uint32_t> code(size / sizeof(uint32_t));
+	file.seekg(0);
+	file.read(reinterpret_cast<char*>(code.data()), size);
+	return code;
+}
+
+VkShaderModule ShaderManager::acquireCode(std::vector<uint32_t>&& code)
+{
+	uint64_t hash = hashCode(code);
+	auto range = modules.equal_range(hash);
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second.code == code) {
+			it->second.references++;
+			statistics.moduleHits++;
+			return it->second.module;
+		}
+	}
+
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = code.size() * sizeof(uint32_t);
+	createInfo.pCode = code.data();
+	VkShaderModule module;
+	if (vkCreateShaderModule(vkDevice, &createInfo, allocationCallbacks, &module) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create shader module");
+	}
+	modules.emplace(hash, Module{ module, std::move(code), 1 });
+	return module;
+}
+
+VkShaderModule ShaderManager::acquireModule(const std::string& name)
+{
+	std::lock_guard<std::mutex> lock(moduleMutex);
+	auto named = namedModules.find(name);
+	if (named == namedModules.end()) {
+		//the name keeps a reference of its own until the file is recompiled
+		VkShaderModule module = acquireCode(readSpirv(name));
+		named = namedModules.emplace(name, module).first;
+	}
+	else {
+		statistics.moduleHits++;
+	}
+
+	for (auto& entry : modules) {
+		if (entry.second.module == named->second) {
+			entry.second.references++;
+			break;
+		}
+	}
+	return named->second;
+}
+
+void ShaderManager::releaseModule(VkShaderModule module)
+{
+	std::lock_guard<std::mutex> lock(moduleMutex);
+	releaseLocked(module);
+}
+
+void ShaderManager::releaseLocked(VkShaderModule module)
+{
+	for (auto it = modules.begin(); it != modules.end(); ++it) {
+		if (it->second.module != module) {
+			continue;
+		}
+		//pipelines keep what they need from a module, it can go as soon as nobody builds from it
+		if (--it->second.references == 0) {
+			vkDestroyShaderModule(vkDevice, module, allocationCallbacks);
+			modules.erase(it);
+		}
+		return;
+	}
+}
+
+std::set<std::string> ShaderManager::scanIncludes(const std::string& name)
+{
+	std::set<std::string> files;
+	std::vector<std::string> pending = { name };
+	while (!pending.empty()) {
+		std::string file = pending.back();
+		pending.pop_back();
+		if (!files.insert(file).second) {
+			continue;
+		}
+
+		//only quoted includes next to the shader, which is all glslc resolves without -I
+		std::ifstream source(sourceDirectory + "/" + file);
+		std::string line;
+		while (std::getline(source, line)) {
+			size_t start = line.find_first_not_of(" \t");
+			if (start == std::string::npos || line.compare(start, 8, "#include") != 0) {
+				continue;
+			}
+			size_t first = line.find('"', start + 8);
+			size_t last = first == std::string::npos ? std::string::npos : line.find('"', first + 1);
+			if (last != std::string::npos) {
+				pending.push_back(line.substr(first + 1, last - first - 1));
+			}
+		}
+	}
+
+	return files;
+}
+
+ShaderPipeline ShaderManager::createPipeline(const std::vector<std::string>& shaders, ShaderPipelineBuilder builder)
+{
+	Pipeline pipeline;
+	pipeline.shaders = shaders;
+	for (const auto& shader : shaders) {
+		pipeline.modules.push_back(acquireModule(shader));
+	}
+	try {
+		pipeline.pipeline = builder(pipeline.modules);
+	}
+	catch (...) {
+		for (auto module : pipeline.modules) {
+			releaseModule(module);
+		}
+		throw;
+	}
+	pipeline.builder = std::move(builder);
+	pipeline.live = true;
+
+	std::map<std::string, std::set<std::string>> shaderDependencies;
+	if (isWatching()) {
+		for (const auto& shader : shaders) {
+			shaderDependencies.emplace(shader, scanIncludes(shader));
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(pipelineMutex);
+	dependencies.insert(shaderDependencies.begin(), shaderDependencies.end());
+	pipelines.push_back(std::move(pipeline));
+	return static_cast<ShaderPipeline>(pipelines.size() - 1);
+}
+
+VkPipeline ShaderManager::getPipeline(ShaderPipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(pipelineMutex);
+	return pipelines[pipeline].pipeline;
+}
+
+void ShaderManager::destroyPipeline(ShaderPipeline pipeline, uint64_t retireSerial)
+{
+	std::lock_guard<std::mutex> lock(pipelineMutex);
+	Pipeline& entry = pipelines[pipeline];
+	if (!entry.live) {
+		return;
+	}
+
+	retired.push_back({ entry.pipeline, retireSerial });
+	entry.pipeline = VK_NULL_HANDLE;
+	entry.live = false;
+	for (auto module : entry.modules) {
+		releaseModule(module);
+	}
+	entry.modules.clear();
+}
+
+uint32_t ShaderManager::applyReloads(uint64_t frameSerial)
+{
+	std::lock_guard<std::mutex> lock(pipelineMutex);
+	uint32_t applied = 0;
+	for (auto& reload : reloads) {
+		Pipeline& entry = pipelines[reload.pipeline];
+		if (!entry.live) {
+			//destroyed while it was being rebuilt, the replacement never reached a command buffer
+			pipelineManager->destroyPipeline(reload.replacement);
+			for (auto module : reload.modules) {
+				releaseModule(module);
+			}
+			continue;
+		}
+
+		//frames already recorded keep binding the old pipeline until they complete
+		retired.push_back({ entry.pipeline, frameSerial });
+		for (auto module : entry.modules) {
+			releaseModule(module);
+		}
+		entry.pipeline = reload.replacement;
+		entry.modules = std::move(reload.modules);
+		applied++;
+	}
+	reloads.clear();
+
+	if (applied > 0) {
+		std::lock_guard<std::mutex> moduleLock(moduleMutex);
+		statistics.reloadCount += applied;
+	}
+	return applied;
+}
+
+void ShaderManager::releaseRetired(uint64_t completedSerial)
+{
+	std::lock_guard<std::mutex> lock(pipelineMutex);
+	auto it = retired.begin();
+	while (it != retired.end()) {
+		if (completedSerial >= it->retireSerial) {
+			pipelineManager->destroyPipeline(it->pipeline);
+			it = retired.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+ShaderStatistics ShaderManager::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(moduleMutex);
+	ShaderStatistics current = statistics;
+	current.moduleCount = static_cast<uint32_t>(modules.size());
+	return current;
+}
+
+bool ShaderManager::compile(const std::string& name)
+{
+#ifdef __linux__
+	//same compiler and target as the build, written next to the old SPIR-V and renamed
+	//over it so a failed compile never leaves a half written module behind
+	std::string output = spirvDirectory + "/" + name + ".spv";
+	std::string temporary = output + ".tmp";
+	std::string command = "\"" + compilerPath + "\" --target-env=vulkan1.2 \"" + sourceDirectory + "/" + name +
+		"\" -o \"" + temporary + "\" 2>&1";
+	FILE* pipe = popen(command.c_str(), "r");
+	if (pipe == nullptr) {
+		std::cerr << "[Vulkan Log] : failed to run shader compiler " << compilerPath << std::endl;
+		return false;
+	}
+	std::string messages;
+	char buffer[256];
+	while (fgets(buffer, sizeof(buffer), pipe) != nullptr) {
+		messages += buffer;
+	}
+	if (pclose(pipe) != 0) {
+		std::cerr << "[Vulkan Log] : failed to compile " << name << ", keeping the running pipelines" << std::endl
+			<< messages;
+		std::remove(temporary.c_str());
+		return false;
+	}
+	if (std::rename(temporary.c_str(), output.c_str()) != 0) {
+		std::cerr << "[Vulkan Log] : failed to replace " << output << std::endl;
+		return false;
+	}
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ShaderManager::reload(const std::set<std::string>& changedFiles)
+{
+	std::vector<std::string> affected;
+	{
+		std::lock_guard<std::mutex> lock(pipelineMutex);
+		for (const auto& shader : dependencies) {
+			for (const auto& file : changedFiles) {
+				if (shader.second.count(file) != 0) {
+					affected.push_back(shader.first);
+					break;
+				}
+			}
+		}
+	}
+
+	std::set<std::string> recompiled;
+	for (const auto& shader : affected) {
+		bool compiled = compile(shader);
+		{
+			//includes may have been added or removed by the edit
+			std::set<std::string> shaderDependencies = scanIncludes(shader);
+			std::lock_guard<std::mutex> lock(pipelineMutex);
+			dependencies[shader] = std::move(shaderDependencies);
+		}
+		if (!compiled) {
+			std::lock_guard<std::mutex> lock(moduleMutex);
+			statistics.failedCompileCount++;
+			continue;
+		}
+
+		try {
+			std::lock_guard<std::mutex> lock(moduleMutex);
+			VkShaderModule module = acquireCode(readSpirv(shader));
+			VkShaderModule& current = namedModules[shader];
+			if (module == current) {
+				//whitespace and comment edits compile to the same SPIR-V, nothing to rebuild
+				releaseLocked(module);
+				continue;
+			}
+			if (current != VK_NULL_HANDLE) {
+				releaseLocked(current);
+			}
+			current = module;
+			recompiled.insert(shader);
+		}
+		catch (const std::exception& error) {
+			std::cerr << "[Vulkan Log] : failed to load " << shader << " : " << error.what() << std::endl;
+		}
+	}
+	if (recompiled.empty()) {
+		return;
+	}
+
+	//builders are never touched after createPipeline, so they can run without the lock
+	std::vector<std::pair<ShaderPipeline, const Pipeline*>> rebuilds;
+	{
+		std::lock_guard<std::mutex> lock(pipelineMutex);
+		for (size_t i = 0; i < pipelines.size(); i++) {
+			if (!pipelines[i].live) {
+				continue;
+			}
+			for (const auto& shader : pipelines[i].shaders) {
+				if (recompiled.count(shader) != 0) {
+					rebuilds.push_back({ static_cast<ShaderPipeline>(i), &pipelines[i] });
+					break;
+				}
+			}
+		}
+	}
+
+	for (const auto& rebuild : rebuilds) {
+		Reload reload;
+		reload.pipeline = rebuild.first;
+		reload.replacement = VK_NULL_HANDLE;
+		for (const auto& shader : rebuild.second->shaders) {
+			reload.modules.push_back(acquireModule(shader));
+		}
+		try {
+			reload.replacement = rebuild.second->builder(reload.modules);
+		}
+		catch (const std::exception& error) {
+			std::cerr << "[Vulkan Log] : failed to rebuild pipeline " << rebuild.first << " : " << error.what() << std::endl;
+		}
+		if (reload.replacement == VK_NULL_HANDLE) {
+			for (auto module : reload.modules) {
+				releaseModule(module);
+			}
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(pipelineMutex);
+		//a second save before the frame picked up the first, the older rebuild was never bound
+		for (auto it = reloads.begin(); it != reloads.end(); ++it) {
+			if (it->pipeline == reload.pipeline) {
+				pipelineManager->destroyPipeline(it->replacement);
+				for (auto module : it->modules) {
+					releaseModule(module);
+				}
+				reloads.erase(it);
+				break;
+			}
+		}
+		reloads.push_back(std::move(reload));
+	}
+
+	std::cerr << "[Vulkan Log] : recompiled " << recompiled.size() << " shaders, rebuilt "
+		<< rebuilds.size() << " pipelines" << std::endl;
+}
+
+void ShaderManager::watch()
+{
+#ifdef __linux__
+	std::set<std::string> changedFiles;
+	auto settled = std::chrono::steady_clock::time_point::max();
+	pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { wakeFd, POLLIN, 0 } };
+	while (!stopWatching) {
+		int timeout = -1;
+		if (!changedFiles.empty()) {
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(settled - std::chrono::steady_clock::now());
+			timeout = static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+		}
+		if (poll(fds, 2, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "[Vulkan Log] : shader watcher failed, hot reload stopped" << std::endl;
+			return;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			alignas(inotify_event) char buffer[4096];
+			ssize_t length;
+			while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+				for (ssize_t offset = 0; offset < length;) {
+					const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+					if (event->len > 0) {
+						changedFiles.insert(event->name);
+					}
+					offset += sizeof(inotify_event) + event->len;
+				}
+			}
+			settled = std::chrono::steady_clock::now() + reloadSettleTime;
+		}
+
+		if (!changedFiles.empty() && std::chrono::steady_clock::now() >= settled) {
+			reload(changedFiles);
+			changedFiles.clear();
+		}
+	}
+#endif
+}
@@ -0,0 +1,129 @@
+﻿// shader_manager.h : SPIR-V modules shared by content hash, and pipelines that are rebuilt
+// in the background and swapped in between frames when the GLSL behind them changes.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "pipeline_manager.h"
+
+using ShaderPipeline = uint32_t;
+const ShaderPipeline invalidShaderPipeline = UINT32_MAX;
+
+//creates the pipeline from one module per shader, in the order they were passed to
+//createPipeline, through PipelineManager. hot reload calls it again on the watcher
+//thread, so everything it captures has to outlive the pipeline
+using ShaderPipelineBuilder = std::function<VkPipeline(const std::vector<VkShaderModule>& modules)>;
+
+struct ShaderStatistics {
+	uint32_t moduleCount = 0;
+	//module requests answered with an existing module of identical SPIR-V
+	uint64_t moduleHits = 0;
+	uint64_t reloadCount = 0;
+	uint64_t failedCompileCount = 0;
+};
+
+class ShaderManager {
+public:
+	//shaders are named after their source file, e.g. "cull.comp", and loaded from
+	//spirvDirectory/cull.comp.spv. with hotReload the GLSL in sourceDirectory is watched
+	//and recompiled with compilerPath, a glslc compatible command line compiler
+	void init(VkDevice device, PipelineManager& pipelineManager, const std::string& spirvDirectory,
+		const std::string& sourceDirectory, const std::string& compilerPath, bool hotReload, const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	//stops the watcher and destroys every pipeline and module, the device must be idle
+	void destroy();
+	bool isWatching() const { return watcher.joinable(); }
+
+	//one reference per call, modules with the same SPIR-V are the same handle
+	VkShaderModule acquireModule(const std::string& name);
+	void releaseModule(VkShaderModule module);
+
+	//builds the pipeline right away and again whenever one of its shaders is recompiled
+	ShaderPipeline createPipeline(const std::vector<std::string>& shaders, ShaderPipelineBuilder builder);
+	//changes only inside applyReloads, read it when recording rather than keeping it
+	VkPipeline getPipeline(ShaderPipeline pipeline);
+	//the pipeline is destroyed once releaseRetired sees retireSerial completed
+	void destroyPipeline(ShaderPipeline pipeline, uint64_t retireSerial);
+
+	//swaps in the pipelines rebuilt since the last call, call it between frames before
+	//anything is recorded, the replaced ones retire with frameSerial. never waits on a compile
+	uint32_t applyReloads(uint64_t frameSerial);
+	void releaseRetired(uint64_t completedSerial);
+
+	ShaderStatistics getStatistics();
+
+private:
+	struct Module {
+		VkShaderModule module;
+		std::vector<uint32_t> code;
+		uint32_t references;
+	};
+
+	struct Pipeline {
+		std::vector<std::string> shaders;
+		ShaderPipelineBuilder builder;
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		//one reference held for each shader, so unchanged stages are not reloaded
+		std::vector<VkShaderModule> modules;
+		bool live = false;
+	};
+
+	//built on the watcher thread, waiting for applyReloads
+	struct Reload {
+		ShaderPipeline pipeline;
+		VkPipeline replacement;
+		std::vector<VkShaderModule> modules;
+	};
+
+	struct RetiredPipeline {
+		VkPipeline pipeline;
+		uint64_t retireSerial;
+	};
+
+	static uint64_t hashCode(const std::vector<uint32_t>& code);
+	std::vector<uint32_t> readSpirv(const std::string& name);
+	//expects moduleMutex to be held
+	VkShaderModule acquireCode(std::vector<uint32_t>&& code);
+	void releaseLocked(VkShaderModule module);
+	std::set<std::string> scanIncludes(const std::string& name);
+	bool compile(const std::string& name);
+	void reload(const std::set<std::string>& changedFiles);
+	void watch();
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	PipelineManager* pipelineManager = nullptr;
+	std::string spirvDirectory;
+	std::string sourceDirectory;
+	std::string compilerPath;
+
+	std::mutex moduleMutex;
+	//keyed by the hash of the SPIR-V, colliding entries are told apart by their code
+	std::unordered_multimap<uint64_t, Module> modules;
+	//the module each shader name currently loads to, holding a reference of its own
+	std::map<std::string, VkShaderModule> namedModules;
+	ShaderStatistics statistics;
+
+	std::mutex pipelineMutex;
+	//a deque so the builders stay put while the watcher runs them
+	std::deque<Pipeline> pipelines;
+	std::vector<Reload> reloads;
+	std::vector<RetiredPipeline> retired;
+	//source files, includes among them, that each watched shader is compiled from
+	std::map<std::string, std::set<std::string>> dependencies;
+
+	std::thread watcher;
+	std::atomic<bool> stopWatching{ false };
+	int inotifyFd = -1;
+	int wakeFd = -1;
+};
@@ -0,0 +1,16 @@
+#version 450
+
+//one small triangle per draw, the push constant spreads them over the target
+layout(push_constant) uniform Push {
+	vec2 offset;
+} push;
+
+vec2 positions[3] = vec2[](
+	vec2(-0.02, -0.02),
+	vec2(0.02, -0.02),
+	vec2(0.0, 0.02)
+);
+
+void main() {
+	gl_Position = vec4(positions[gl_VertexIndex] + push.offset, 0.0, 1.0);
+}
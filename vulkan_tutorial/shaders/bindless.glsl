@@ -0,0 +1,14 @@
+// bindless.glsl : declarations matching DescriptorManager, include after #version.
+// resources are addressed by the slots register* returned, passed in push constants.
+
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(set = 0, binding = 0) uniform texture2D bindlessTextures[];
+layout(set = 0, binding = 1) buffer BindlessBuffer { uint words[]; } bindlessBuffers[];
+layout(set = 0, binding = 2) uniform sampler bindlessSamplers[];
+
+//wrap an index with nonuniformEXT whenever it may differ between invocations
+vec4 sampleBindless(uint textureSlot, uint samplerSlot, vec2 uv)
+{
+	return texture(sampler2D(bindlessTextures[nonuniformEXT(textureSlot)], bindlessSamplers[nonuniformEXT(samplerSlot)]), uv);
+}
@@ -0,0 +1,61 @@
+﻿// timeline_queue.cpp : queue submission ordered by timeline semaphores
+//
+
+#include "timeline_queue.h"
+#include <stdexcept>
+
+uint64_t TimelineQueue::submit(const std::vector<VkCommandBuffer>& commandBuffers, const std::vector<TimelineWait>& waits, VkFence fence)
+{
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+	for (const auto& timelineWait : waits) {
+		waitSemaphores.push_back(timelineWait.timeline);
+		waitValues.push_back(timelineWait.value);
+		waitStages.push_back(timelineWait.stage);
+	}
+	uint64_t signalValue = value + 1;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.commandBufferCount = static_cast<uint32_t>(commandBuffers.size());
+	submitInfo.pCommandBuffers = commandBuffers.data();
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline;
+	if (dispatch->vkQueueSubmit(queue, 1, &submitInfo, fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit to queue timeline");
+	}
+
+	value = signalValue;
+	return signalValue;
+}
+
+bool TimelineQueue::isComplete(uint64_t waitValue) const
+{
+	uint64_t currentValue = 0;
+	dispatch->vkGetSemaphoreCounterValue(device, timeline, &currentValue);
+	return currentValue >= waitValue;
+}
+
+void TimelineQueue::wait(uint64_t waitValue) const
+{
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &timeline;
+	waitInfo.pValues = &waitValue;
+	if (dispatch->vkWaitSemaphores(device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("failed to wait on queue timeline");
+	}
+}
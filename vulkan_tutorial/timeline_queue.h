@@ -0,0 +1,35 @@
+﻿// timeline_queue.h : a queue paired with the timeline semaphore that orders the work
+// submitted to it, shared by the frame loop and the upload and compute subsystems.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include "device_dispatch.h"
+
+struct TimelineWait {
+	VkSemaphore timeline;
+	uint64_t value;
+	VkPipelineStageFlags stage;
+};
+
+//other queues synchronize with this one by waiting on a timeline value,
+//the host does the same through isComplete and wait
+struct TimelineQueue {
+	VkDevice device = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t family = 0;
+	//false when the queue is shared with graphics because no dedicated family exists
+	bool dedicated = false;
+	VkSemaphore timeline = VK_NULL_HANDLE;
+	//last value a submission to this queue will signal
+	uint64_t value = 0;
+
+	//submits the command buffers and signals the next timeline value, which is returned
+	uint64_t submit(const std::vector<VkCommandBuffer>& commandBuffers,
+		const std::vector<TimelineWait>& waits = {}, VkFence fence = VK_NULL_HANDLE);
+	bool isComplete(uint64_t waitValue) const;
+	void wait(uint64_t waitValue) const;
+};
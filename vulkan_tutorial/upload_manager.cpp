@@ -0,0 +1,342 @@
+﻿// upload_manager.cpp : staging ring and batched transfer submissions
+//
+
+#include "upload_manager.h"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+
+void UploadManager::init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+	TimelineQueue& transferQueue, uint32_t graphicsFamily, VkDeviceSize ringSize, uint32_t maxBatchesInFlight,
+	const VkAllocationCallbacks* allocationCallbacks)
+{
+	this->vkDevice = device;
+	this->dispatch = &deviceDispatch;
+	this->allocationCallbacks = allocationCallbacks;
+	this->allocator = &allocator;
+	this->transferQueue = &transferQueue;
+	this->graphicsFamily = graphicsFamily;
+	this->ringSize = ringSize;
+	ownershipTransfer = transferQueue.family != graphicsFamily;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = ringSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	allocator.createBuffer(bufferInfo, MemoryUsage::CpuToGpu, ringBuffer, ringAllocation);
+
+	batches.resize(maxBatchesInFlight);
+	for (auto& batch : batches) {
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = transferQueue.family;
+		if (vkCreateCommandPool(vkDevice, &poolInfo, allocationCallbacks, &batch.commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload command pool");
+		}
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = batch.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (dispatch->vkAllocateCommandBuffers(vkDevice, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer");
+		}
+	}
+}
+
+void UploadManager::destroy()
+{
+	if (flushedValue > 0) {
+		transferQueue->wait(flushedValue);
+	}
+	for (auto& batch : batches) {
+		vkDestroyCommandPool(vkDevice, batch.commandPool, allocationCallbacks);
+	}
+	batches.clear();
+	allocator->destroyBuffer(ringBuffer, ringAllocation);
+	ringBuffer = VK_NULL_HANDLE;
+}
+
+void UploadManager::reclaim()
+{
+	//regions complete in submission order, so only the front needs checking
+	while (!inFlightRegions.empty() && transferQueue->isComplete(inFlightRegions.front().value)) {
+		usedBytes -= inFlightRegions.front().bytes;
+		inFlightRegions.pop_front();
+	}
+}
+
+bool UploadManager::tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	//not necessarily a power of two, copies of 3 byte texels align to 12
+	VkDeviceSize alignedHead = (head + alignment - 1) / alignment * alignment;
+	VkDeviceSize consumed = alignedHead - head + size;
+	if (alignedHead + size > ringSize) {
+		//not enough room before the end, skip the tail of the ring and start over at 0
+		alignedHead = 0;
+		consumed = ringSize - head + size;
+	}
+	if (usedBytes + consumed > ringSize) {
+		return false;
+	}
+
+	offset = alignedHead;
+	head = alignedHead + size;
+	usedBytes += consumed;
+	batchBytes += consumed;
+	return true;
+}
+
+StagingRange UploadManager::reserve(VkDeviceSize size, VkDeviceSize alignment)
+{
+	if (size > ringSize) {
+		throw std::runtime_error("upload is larger than the staging ring");
+	}
+
+	VkDeviceSize offset;
+	reclaim();
+	if (!tryAllocate(size, alignment, offset)) {
+		//the ring is full of data the gpu has not consumed yet, push out what is
+		//queued and block on the oldest batches until enough space comes back
+		submitBatch(false);
+		while (!tryAllocate(size, alignment, offset)) {
+			if (inFlightRegions.empty()) {
+				throw std::runtime_error("staging ring exhausted");
+			}
+			transferQueue->wait(inFlightRegions.front().value);
+			reclaim();
+		}
+	}
+
+	StagingRange range;
+	range.buffer = ringBuffer;
+	range.offset = offset;
+	range.size = size;
+	range.mapped = static_cast<char*>(ringAllocation.mapped) + offset;
+	return range;
+}
+
+void UploadManager::copyToBuffer(const StagingRange& source, VkBuffer dstBuffer, VkDeviceSize dstOffset, bool concurrent)
+{
+	VkBufferCopy region{};
+	region.srcOffset = source.offset;
+	region.dstOffset = dstOffset;
+	region.size = source.size;
+	pendingBufferCopies.push_back({ dstBuffer, region, concurrent });
+}
+
+void UploadManager::copyToImage(const StagingRange& source, VkImage dstImage, VkBufferImageCopy region, VkImageLayout finalLayout)
+{
+	region.bufferOffset = source.offset;
+	pendingImageCopies.push_back({ dstImage, region, finalLayout });
+}
+
+void UploadManager::uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+	bool concurrent)
+{
+	StagingRange range = reserve(size, 4);
+	memcpy(range.mapped, data, static_cast<size_t>(size));
+	copyToBuffer(range, dstBuffer, dstOffset, concurrent);
+}
+
+void UploadManager::uploadImage(VkImage dstImage, const VkBufferImageCopy& region, const void* data, VkDeviceSize size,
+	VkDeviceSize texelBlockSize, VkImageLayout finalLayout)
+{
+	//bufferOffset has to be a multiple of the texel block size and of 4
+	StagingRange range = reserve(size, std::lcm(texelBlockSize, VkDeviceSize(4)));
+	memcpy(range.mapped, data, static_cast<size_t>(size));
+	copyToImage(range, dstImage, region, finalLayout);
+}
+
+UploadManager::SubresourceKey UploadManager::keyForCopy(VkImage image, const VkBufferImageCopy& region)
+{
+	return { image, region.imageSubresource.aspectMask, region.imageSubresource.mipLevel,
+		region.imageSubresource.baseArrayLayer, region.imageSubresource.layerCount };
+}
+
+static VkImageSubresourceRange rangeForKey(VkImageAspectFlags aspectMask, uint32_t mipLevel, uint32_t baseArrayLayer,
+	uint32_t layerCount)
+{
+	VkImageSubresourceRange range{};
+	range.aspectMask = aspectMask;
+	range.baseMipLevel = mipLevel;
+	range.levelCount = 1;
+	range.baseArrayLayer = baseArrayLayer;
+	range.layerCount = layerCount;
+	return range;
+}
+
+void UploadManager::waitBeforeCopies(const TimelineWait& wait)
+{
+	for (auto& batchWait : batchWaits) {
+		if (batchWait.timeline == wait.timeline) {
+			batchWait.value = std::max(batchWait.value, wait.value);
+			batchWait.stage |= wait.stage;
+			return;
+		}
+	}
+	batchWaits.push_back(wait);
+}
+
+uint64_t UploadManager::flush()
+{
+	return submitBatch(true);
+}
+
+uint64_t UploadManager::submitBatch(bool release)
+{
+	bool releasePending = release && (!unreleasedBuffers.empty() || !unreleasedImages.empty());
+	if (pendingBufferCopies.empty() && pendingImageCopies.empty() && !releasePending) {
+		return 0;
+	}
+
+	//the batch slot is reused round robin, its previous submission has to be done first
+	UploadBatch& batch = batches[nextBatch];
+	nextBatch = (nextBatch + 1) % static_cast<uint32_t>(batches.size());
+	if (batch.value > 0) {
+		transferQueue->wait(batch.value);
+	}
+	dispatch->vkResetCommandPool(vkDevice, batch.commandPool, 0);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (dispatch->vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording upload command buffer");
+	}
+
+	//copies into the same buffer are merged into a single vkCmdCopyBuffer
+	std::map<VkBuffer, std::vector<VkBufferCopy>> bufferRegions;
+	for (const auto& copy : pendingBufferCopies) {
+		bufferRegions[copy.dstBuffer].push_back(copy.region);
+		//a concurrent buffer needs no barrier at all, the transfer timeline wait the
+		//consuming submission makes already covers the writes
+		if (!copy.concurrent) {
+			unreleasedBuffers.insert(copy.dstBuffer);
+		}
+	}
+	for (const auto& entry : bufferRegions) {
+		dispatch->vkCmdCopyBuffer(batch.commandBuffer, ringBuffer, entry.first, static_cast<uint32_t>(entry.second.size()), entry.second.data());
+	}
+
+	//only the first write to a subresource since its last release may discard the
+	//contents, later ones find it in TRANSFER_DST already
+	std::vector<VkImageMemoryBarrier> toTransfer;
+	for (const auto& copy : pendingImageCopies) {
+		SubresourceKey key = keyForCopy(copy.dstImage, copy.region);
+		if (!unreleasedImages.emplace(key, copy.finalLayout).second) {
+			continue;
+		}
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = copy.dstImage;
+		barrier.subresourceRange = rangeForKey(key.aspectMask, key.mipLevel, key.baseArrayLayer, key.layerCount);
+		toTransfer.push_back(barrier);
+	}
+	if (!toTransfer.empty()) {
+		dispatch->vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(toTransfer.size()), toTransfer.data());
+	}
+	for (const auto& copy : pendingImageCopies) {
+		dispatch->vkCmdCopyBufferToImage(batch.commandBuffer, ringBuffer, copy.dstImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy.region);
+	}
+	if (release) {
+		recordRelease(batch.commandBuffer);
+	}
+
+	if (dispatch->vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record upload command buffer");
+	}
+
+	batch.value = transferQueue->submit({ batch.commandBuffer }, batchWaits);
+	batchWaits.clear();
+	inFlightRegions.push_back({ batchBytes, batch.value });
+	batchBytes = 0;
+	pendingBufferCopies.clear();
+	pendingImageCopies.clear();
+	flushedValue = batch.value;
+	return batch.value;
+}
+
+void UploadManager::recordRelease(VkCommandBuffer commandBuffer)
+{
+	if (unreleasedBuffers.empty() && unreleasedImages.empty()) {
+		return;
+	}
+
+	//on a dedicated transfer family the barriers below are the release half of a queue
+	//family ownership transfer, recordAcquireBarriers records the matching acquire
+	uint32_t srcFamily = ownershipTransfer ? transferQueue->family : VK_QUEUE_FAMILY_IGNORED;
+	uint32_t dstFamily = ownershipTransfer ? graphicsFamily : VK_QUEUE_FAMILY_IGNORED;
+	std::vector<VkBufferMemoryBarrier> releaseBuffers;
+	for (VkBuffer buffer : unreleasedBuffers) {
+		VkBufferMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.buffer = buffer;
+		barrier.offset = 0;
+		barrier.size = VK_WHOLE_SIZE;
+		releaseBuffers.push_back(barrier);
+	}
+	std::vector<VkImageMemoryBarrier> releaseImages;
+	for (const auto& entry : unreleasedImages) {
+		const SubresourceKey& key = entry.first;
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = 0;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = entry.second;
+		barrier.srcQueueFamilyIndex = srcFamily;
+		barrier.dstQueueFamilyIndex = dstFamily;
+		barrier.image = key.image;
+		barrier.subresourceRange = rangeForKey(key.aspectMask, key.mipLevel, key.baseArrayLayer, key.layerCount);
+		releaseImages.push_back(barrier);
+	}
+	dispatch->vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+		0, 0, nullptr, static_cast<uint32_t>(releaseBuffers.size()), releaseBuffers.data(),
+		static_cast<uint32_t>(releaseImages.size()), releaseImages.data());
+
+	if (ownershipTransfer) {
+		for (auto barrier : releaseBuffers) {
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			acquireBufferBarriers.push_back(barrier);
+		}
+		for (auto barrier : releaseImages) {
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+			acquireImageBarriers.push_back(barrier);
+		}
+	}
+	unreleasedBuffers.clear();
+	unreleasedImages.clear();
+}
+
+void UploadManager::recordAcquireBarriers(VkCommandBuffer graphicsCommandBuffer)
+{
+	if (acquireBufferBarriers.empty() && acquireImageBarriers.empty()) {
+		return;
+	}
+
+	//the graphics submission waits on the transfer timeline at ALL_COMMANDS,
+	//which chains with the source stage used here
+	dispatch->vkCmdPipelineBarrier(graphicsCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0, 0, nullptr, static_cast<uint32_t>(acquireBufferBarriers.size()), acquireBufferBarriers.data(),
+		static_cast<uint32_t>(acquireImageBarriers.size()), acquireImageBarriers.data());
+	acquireBufferBarriers.clear();
+	acquireImageBarriers.clear();
+}
@@ -0,0 +1,144 @@
+﻿// upload_manager.h : streams buffer and image data to the gpu through a persistently
+// mapped staging ring, all copies queued during a frame go out in one transfer submission.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <set>
+#include <tuple>
+#include <vector>
+#include "memory_allocator.h"
+#include "timeline_queue.h"
+#include "device_dispatch.h"
+
+//a range of the staging ring the caller may write into directly
+struct StagingRange {
+	VkBuffer buffer = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+	void* mapped = nullptr;
+};
+
+//not thread safe, queue uploads and flush from the thread that runs the frame loop
+class UploadManager {
+public:
+	void init(VkDevice device, const DeviceDispatch& deviceDispatch, MemoryAllocator& allocator,
+		TimelineQueue& transferQueue, uint32_t graphicsFamily, VkDeviceSize ringSize, uint32_t maxBatchesInFlight,
+		const VkAllocationCallbacks* allocationCallbacks = nullptr);
+	void destroy();
+
+	//concurrent destinations are shared with the transfer family, or live on the same
+	//family, and skip the queue family ownership transfer that exclusive ones go through
+	void uploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size,
+		bool concurrent = false);
+	//region.bufferOffset is ignored, the data is placed in the ring and the offset filled in.
+	//texelBlockSize is the bytes per texel, or per block of a compressed format
+	void uploadImage(VkImage dstImage, const VkBufferImageCopy& region, const void* data, VkDeviceSize size,
+		VkDeviceSize texelBlockSize, VkImageLayout finalLayout);
+
+	//lets the caller write straight into staging memory, e.g. from a mapped file,
+	//the range must be handed to copyToBuffer or copyToImage before reserving again
+	//since a full ring flushes whatever copies are queued at that point. image copies
+	//need an alignment that is a multiple of both 4 and the format's texel block size
+	StagingRange reserve(VkDeviceSize size, VkDeviceSize alignment);
+	void copyToBuffer(const StagingRange& source, VkBuffer dstBuffer, VkDeviceSize dstOffset, bool concurrent = false);
+	void copyToImage(const StagingRange& source, VkImage dstImage, VkBufferImageCopy region, VkImageLayout finalLayout);
+	//makes the next submitted batch wait on a timeline value, for destinations that
+	//work already submitted to another queue may still be reading. call it before
+	//queueing the copies, a full ring can push them out before the next flush
+	void waitBeforeCopies(const TimelineWait& wait);
+
+	//submits every queued copy as one batch and returns the transfer timeline value
+	//that signals its completion, or 0 when nothing was queued. a subresource written
+	//by several copies, in this batch or in batches a full ring pushed out early, keeps
+	//the data of all of them
+	uint64_t flush();
+	//records the queue family ownership acquire for everything flushed so far,
+	//the command buffer must be submitted after waiting on the flushed timeline value
+	void recordAcquireBarriers(VkCommandBuffer graphicsCommandBuffer);
+	//value of the most recent flush, wait on it before using uploaded data
+	uint64_t lastFlushValue() const { return flushedValue; }
+	VkDeviceSize getRingSize() const { return ringSize; }
+
+private:
+	struct PendingBufferCopy {
+		VkBuffer dstBuffer;
+		VkBufferCopy region;
+		bool concurrent;
+	};
+
+	struct PendingImageCopy {
+		VkImage dstImage;
+		VkBufferImageCopy region;
+		VkImageLayout finalLayout;
+	};
+
+	//an image subresource range as copies address it, to transition each one once
+	struct SubresourceKey {
+		VkImage image;
+		VkImageAspectFlags aspectMask;
+		uint32_t mipLevel;
+		uint32_t baseArrayLayer;
+		uint32_t layerCount;
+
+		bool operator<(const SubresourceKey& other) const
+		{
+			return std::tie(image, aspectMask, mipLevel, baseArrayLayer, layerCount) <
+				std::tie(other.image, other.aspectMask, other.mipLevel, other.baseArrayLayer, other.layerCount);
+		}
+	};
+
+	//one submitted batch, its staging bytes are reclaimed once the timeline reaches value
+	struct RingRegion {
+		VkDeviceSize bytes;
+		uint64_t value;
+	};
+
+	struct UploadBatch {
+		VkCommandPool commandPool = VK_NULL_HANDLE;
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		uint64_t value = 0;
+	};
+
+	bool tryAllocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void reclaim();
+	//release only when the caller flushes, a batch pushed out by a full ring leaves its
+	//destinations in TRANSFER_DST on the transfer queue for the copies that follow
+	uint64_t submitBatch(bool release);
+	void recordRelease(VkCommandBuffer commandBuffer);
+	static SubresourceKey keyForCopy(VkImage image, const VkBufferImageCopy& region);
+
+	VkDevice vkDevice = VK_NULL_HANDLE;
+	const DeviceDispatch* dispatch = nullptr;
+	const VkAllocationCallbacks* allocationCallbacks = nullptr;
+	MemoryAllocator* allocator = nullptr;
+	TimelineQueue* transferQueue = nullptr;
+	uint32_t graphicsFamily = 0;
+	//copies on a dedicated transfer family must hand the resources over to graphics
+	bool ownershipTransfer = false;
+
+	VkBuffer ringBuffer = VK_NULL_HANDLE;
+	MemoryAllocation ringAllocation;
+	VkDeviceSize ringSize = 0;
+	VkDeviceSize head = 0;
+	//bytes between the oldest in flight region and head, including wrap padding
+	VkDeviceSize usedBytes = 0;
+	VkDeviceSize batchBytes = 0;
+	std::deque<RingRegion> inFlightRegions;
+
+	std::vector<UploadBatch> batches;
+	uint32_t nextBatch = 0;
+	std::vector<PendingBufferCopy> pendingBufferCopies;
+	std::vector<PendingImageCopy> pendingImageCopies;
+	//one entry per timeline, the latest value asked for
+	std::vector<TimelineWait> batchWaits;
+	//written since the last release, images with the layout they are released into
+	std::set<VkBuffer> unreleasedBuffers;
+	std::map<SubresourceKey, VkImageLayout> unreleasedImages;
+	std::vector<VkBufferMemoryBarrier> acquireBufferBarriers;
+	std::vector<VkImageMemoryBarrier> acquireImageBarriers;
+	uint64_t flushedValue = 0;
+};
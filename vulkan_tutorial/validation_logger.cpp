@@ -0,0 +1,141 @@
+﻿// validation_logger.cpp : message filtering on the callback thread and the writer thread
+//
+
+#include "validation_logger.h"
+#include <iostream>
+
+//how often repeat counts are written and the rate limit window starts over
+static const std::chrono::seconds summaryInterval(1);
+
+static const char* severityName(VkDebugUtilsMessageSeverityFlagBitsEXT severity)
+{
+	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+		return "error";
+	}
+	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT) {
+		return "warning";
+	}
+	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT) {
+		return "info";
+	}
+	return "verbose";
+}
+
+void ValidationLogger::init(uint32_t maxMessagesPerSecond, uint32_t maxQueuedMessages)
+{
+	this->maxMessagesPerSecond = maxMessagesPerSecond;
+	this->maxQueuedMessages = maxQueuedMessages;
+	windowStart = std::chrono::steady_clock::now();
+	stopping = false;
+	writer = std::thread(&ValidationLogger::write, this);
+}
+
+void ValidationLogger::destroy()
+{
+	if (!writer.joinable()) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(logMutex);
+		stopping = true;
+	}
+	logCondition.notify_one();
+	writer.join();
+}
+
+void ValidationLogger::log(VkDebugUtilsMessageSeverityFlagBitsEXT severity, const VkDebugUtilsMessengerCallbackDataEXT& data)
+{
+	const char* text = data.pMessage != nullptr ? data.pMessage : "";
+	//the layers put the hash of the VUID in messageIdNumber, so one broken call made every
+	//frame, or for every object, counts as one message. the few messages without an id
+	//are told apart by an FNV-1a hash of their text, kept out of the 32 bit id range
+	uint64_t key = static_cast<uint32_t>(data.messageIdNumber);
+	if (data.messageIdNumber == 0) {
+		key = 14695981039346656037ull;
+		for (const char* c = text; *c != '\0'; c++) {
+			key ^= static_cast<unsigned char>(*c);
+			key *= 1099511628211ull;
+		}
+		key |= 1ull << 63;
+	}
+
+	std::lock_guard<std::mutex> lock(logMutex);
+	statistics.received++;
+	Occurrences& entry = occurrences[key];
+	if (entry.count++ > 0) {
+		entry.unreported++;
+		statistics.repeated++;
+		return;
+	}
+
+	auto now = std::chrono::steady_clock::now();
+	if (now - windowStart >= summaryInterval) {
+		windowStart = now;
+		windowMessages = 0;
+	}
+	if (windowMessages >= maxMessagesPerSecond || queue.size() >= maxQueuedMessages) {
+		//forgotten again, so it is written if it shows up after the burst
+		occurrences.erase(key);
+		statistics.dropped++;
+		unreportedDrops++;
+		return;
+	}
+
+	entry.name = data.pMessageIdName != nullptr ? data.pMessageIdName : std::string(text).substr(0, 80);
+	windowMessages++;
+	statistics.logged++;
+	queue.push_back({ severity, text });
+	logCondition.notify_one();
+}
+
+ValidationStatistics ValidationLogger::getStatistics()
+{
+	std::lock_guard<std::mutex> lock(logMutex);
+	return statistics;
+}
+
+void ValidationLogger::write()
+{
+	std::unique_lock<std::mutex> lock(logMutex);
+	auto nextSummary = std::chrono::steady_clock::now() + summaryInterval;
+	while (true) {
+		logCondition.wait_until(lock, nextSummary, [this]() { return stopping || !queue.empty(); });
+		std::vector<Message> messages;
+		messages.swap(queue);
+
+		std::vector<std::string> summaries;
+		bool done = stopping;
+		auto now = std::chrono::steady_clock::now();
+		if (done || now >= nextSummary) {
+			for (auto& entry : occurrences) {
+				if (entry.second.unreported > 0) {
+					summaries.push_back(entry.second.name + " repeated " + std::to_string(entry.second.unreported) +
+						" times, " + std::to_string(entry.second.count) + " in total");
+					entry.second.unreported = 0;
+				}
+			}
+			if (unreportedDrops > 0) {
+				summaries.push_back(std::to_string(unreportedDrops) + " messages dropped by the rate limit");
+				unreportedDrops = 0;
+			}
+			nextSummary = now + summaryInterval;
+		}
+
+		//the callbacks only wait for the swap above, never for the stream
+		lock.unlock();
+		for (const auto& message : messages) {
+			std::cerr << "[Vulkan Log] : validation " << severityName(message.severity) << " : " << message.text << '\n';
+		}
+		for (const auto& summary : summaries) {
+			std::cerr << "[Vulkan Log] : validation " << summary << '\n';
+		}
+		if (!messages.empty() || !summaries.empty()) {
+			std::cerr.flush();
+		}
+		if (done) {
+			return;
+		}
+		lock.lock();
+	}
+}
@@ -0,0 +1,69 @@
+﻿// validation_logger.h : debug messenger output deduplicated, rate limited and written
+// to std::cerr from a thread of its own instead of from inside the driver call.
+
+#pragma once
+
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct ValidationStatistics {
+	//every message the messenger delivered
+	uint64_t received = 0;
+	//distinct messages written out
+	uint64_t logged = 0;
+	//repeats of a message already written, reported as counts
+	uint64_t repeated = 0;
+	//distinct messages dropped by the rate limit or a full queue
+	uint64_t dropped = 0;
+};
+
+class ValidationLogger {
+public:
+	//at most maxMessagesPerSecond distinct messages are written each second, repeats
+	//are only counted and summarized once per second
+	void init(uint32_t maxMessagesPerSecond = 100, uint32_t maxQueuedMessages = 1024);
+	//writes what is still queued and the final repeat counts
+	void destroy();
+
+	//called from debugCallback on whatever thread the driver is on, never touches
+	//std::cerr and only copies the message the first time it is seen
+	void log(VkDebugUtilsMessageSeverityFlagBitsEXT severity, const VkDebugUtilsMessengerCallbackDataEXT& data);
+
+	ValidationStatistics getStatistics();
+
+private:
+	struct Message {
+		VkDebugUtilsMessageSeverityFlagBitsEXT severity;
+		std::string text;
+	};
+
+	struct Occurrences {
+		std::string name;
+		uint64_t count = 0;
+		//repeats since the last summary
+		uint64_t unreported = 0;
+	};
+
+	void write();
+
+	uint32_t maxMessagesPerSecond = 0;
+	uint32_t maxQueuedMessages = 0;
+	std::mutex logMutex;
+	std::condition_variable logCondition;
+	std::vector<Message> queue;
+	//keyed by the message id, or a hash of the text for messages without one
+	std::unordered_map<uint64_t, Occurrences> occurrences;
+	std::chrono::steady_clock::time_point windowStart;
+	uint32_t windowMessages = 0;
+	uint64_t unreportedDrops = 0;
+	ValidationStatistics statistics;
+	std::thread writer;
+	bool stopping = false;
+};
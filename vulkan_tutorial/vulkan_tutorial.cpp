@@ -1,56 +1,185 @@
-﻿// vulkan_tutorial.cpp : Defines the entry point for the application.
+﻿// vulkan_tutorial.cpp : VkApplication setup, frame loop and teardown.
 //
 
 #include "vulkan_tutorial.h"
 
-VkApplication::VkApplication(int32_t height, int32_t width, std::string vkapplicatonname) {
+VkApplication::VkApplication(int32_t height, int32_t width, std::string vkapplicatonname, VkApplicationConfig config) {
 	this->vkheight = height;
 	this->vkwidth = width;
 	this->appname = vkapplicatonname;
+	this->config = config;
+	if (this->config.headless && this->config.frameCount == 0) {
+		this->config.frameCount = defaultHeadlessFrameCount;
+	}
 }
 
 void VkApplication::run() {
-	initWindow();
-	initVulkan();
+	init();
 	mainLoop();
 	cleanup();
 
 }
 
+void VkApplication::init() {
+	startTime = std::chrono::steady_clock::now();
+	startupPhases.clear();
+	//reading the pipeline cache is plain file io, it overlaps with everything up to device creation
+	pipelineManager.prefetchCache(config.pipelineCachePath);
+	initVulkan();
+	startupTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+
+	for (const auto& phase : startupPhases) {
+		std::cerr << "[Vulkan Log] : startup phase " << phase.first << " took " << phase.second << " ms" << std::endl;
+	}
+	std::cerr << "[Vulkan Log] : startup took " << startupTime << " ms" << std::endl;
+}
+
+void VkApplication::shutdown() {
+	vkDeviceWaitIdle(vkDevice);
+	cleanup();
+}
+
+bool VkApplication::rebuildSwapChain() {
+	if (vkSwapChain == VK_NULL_HANDLE) {
+		return false;
+	}
+
+	recreateSwapChain();
+	return true;
+}
+
+void VkApplication::runStartupPhase(const char* name, void (VkApplication::*phase)()) {
+	auto phaseStart = std::chrono::steady_clock::now();
+	(this->*phase)();
+	auto phaseEnd = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(startupPhasesMutex);
+	startupPhases.emplace_back(name, std::chrono::duration<double, std::milli>(phaseEnd - phaseStart).count());
+}
+
+const VkAllocationCallbacks* VkApplication::hostCallbacks(const char* subsystem)
+{
+	return config.trackHostAllocations ? hostAllocator.getCallbacks(subsystem) : nullptr;
+}
+
 void VkApplication::initVulkan() {
 	
-	createInstance();
-	setupDebugMessenger();
-	createSurface();
-	pickPhysicalDevice();
-	createLogicalDevice();
-	createSwapChain();
-	createImageViews();
+	runStartupPhase("initGlfw", &VkApplication::initGlfw);
+	//the instance only needs glfw's extension list, not the window, so it is created on
+	//a worker while this thread, the only one glfw allows to create windows, opens it
+	auto instanceReady = std::async(std::launch::async, [this]() {
+		runStartupPhase("createInstance", &VkApplication::createInstance);
+		runStartupPhase("setupDebugMessenger", &VkApplication::setupDebugMessenger);
+	});
+	runStartupPhase("initWindow", &VkApplication::initWindow);
+	instanceReady.get();
+
+	runStartupPhase("createSurface", &VkApplication::createSurface);
+	runStartupPhase("pickPhysicalDevice", &VkApplication::pickPhysicalDevice);
+	runStartupPhase("createLogicalDevice", &VkApplication::createLogicalDevice);
+
+	//creating the pipeline cache parses the whole blob and the job system spawns its
+	//threads and command pools, neither touches what the swapchain setup below uses
+	auto pipelinesReady = std::async(std::launch::async, [this]() {
+		runStartupPhase("createPipelineManager", &VkApplication::createPipelineManager);
+	});
+	auto jobsReady = std::async(std::launch::async, [this]() {
+		runStartupPhase("createJobSystem", &VkApplication::createJobSystem);
+	});
+	runStartupPhase("createAllocator", &VkApplication::createAllocator);
+	runStartupPhase("createUploadManager", &VkApplication::createUploadManager);
+	runStartupPhase("createProfiler", &VkApplication::createProfiler);
+	runStartupPhase("createDescriptorManager", &VkApplication::createDescriptorManager);
+	runStartupPhase("createObjectCache", &VkApplication::createObjectCache);
+	runStartupPhase("createSwapChain", &VkApplication::createSwapChain);
+	runStartupPhase("createImageViews", &VkApplication::createImageViews);
+	runStartupPhase("createRenderGraph", &VkApplication::createRenderGraph);
+	runStartupPhase("createFrameResources", &VkApplication::createFrameResources);
+	runStartupPhase("createFramePacer", &VkApplication::createFramePacer);
+	runStartupPhase("createFrameCapture", &VkApplication::createFrameCapture);
+	pipelinesReady.get();
+	jobsReady.get();
+	runStartupPhase("createShaderManager", &VkApplication::createShaderManager);
+	runStartupPhase("createGpuCulling", &VkApplication::createGpuCulling);
 }
 
 int32_t VkApplication::rateDeviceSuitability(VkPhysicalDevice device) {
+	//the features, extensions and queues we need are a hard requirement, everything
+	//below only ranks the devices that meet them
+	if (!isDeviceSuitable(device)) {
+		return -1;
+	}
+
 	int32_t score = 0;
-	VkPhysicalDeviceProperties vkDeviceProperties;
-	VkPhysicalDeviceFeatures vkDeviceFeatures;
-	vkGetPhysicalDeviceProperties(device, &vkDeviceProperties);
-	vkGetPhysicalDeviceFeatures(device, &vkDeviceFeatures);
-	if (vkDeviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
+	const DeviceCapabilities& capabilities = getDeviceCapabilities(device);
+	switch (capabilities.properties.deviceType) {
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+		score += 4000;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
 		score += 1000;
-	}
-	else {
-		score += 50;
+		break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+		score += 500;
+		break;
+	default:
+		break;
 	}
 
-	score += vkDeviceProperties.limits.maxImageDimension2D;
+	//integrated gpus report system memory as device local, the cap keeps a large
+	//shared heap from outranking the type bonus of a discrete card
+	VkDeviceSize largestDeviceHeap = 0;
+	for (uint32_t i = 0; i < capabilities.memoryProperties.memoryHeapCount; i++) {
+		const VkMemoryHeap& heap = capabilities.memoryProperties.memoryHeaps[i];
+		if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+			largestDeviceHeap = std::max(largestDeviceHeap, heap.size);
+		}
+	}
+	const VkDeviceSize mebibyte = 1024 * 1024;
+	score += static_cast<int32_t>(std::min<VkDeviceSize>(largestDeviceHeap / mebibyte, 16 * 1024) / 10);
 
-	if (!vkDeviceFeatures.geometryShader) {
-		return 0;
+	//async compute and copy engines let the timeline queues actually run side by side
+	const QueueFamilyIndices& queues = capabilities.queueFamilies;
+	if (queues.computeFamily.has_value()) {
+		score += 300;
+	}
+	if (queues.transferFamily.has_value()) {
+		score += 300;
+	}
+	if (queues.graphicsFamily == queues.presentFamily) {
+		score += 100;
 	}
 
 	return score;
 
 }
 
+bool VkApplication::matchesDeviceOverride(VkPhysicalDevice device, uint32_t index, const std::string& deviceOverride)
+{
+	std::string requested;
+	for (char c : deviceOverride) {
+		if (c != '-') {
+			requested += static_cast<char>(::tolower(static_cast<unsigned char>(c)));
+		}
+	}
+
+	//a uuid is 32 hex digits once the dashes are gone, and may well be all decimal ones,
+	//so it is tried before anything is read as an index
+	if (requested.size() == 2 * VK_UUID_SIZE) {
+		static const char* const hexDigits = "0123456789abcdef";
+		std::string uuid;
+		for (uint8_t byte : getDeviceCapabilities(device).deviceUUID) {
+			uuid += hexDigits[byte >> 4];
+			uuid += hexDigits[byte & 0xf];
+		}
+		return requested == uuid;
+	}
+
+	//anything else has to be a plain index, a value that does not fit matches nothing
+	uint32_t requestedIndex = 0;
+	auto result = std::from_chars(deviceOverride.data(), deviceOverride.data() + deviceOverride.size(), requestedIndex);
+	return result.ec == std::errc() && result.ptr == deviceOverride.data() + deviceOverride.size() && requestedIndex == index;
+}
+
 QueueFamilyIndices VkApplication::findQueueFamilies(VkPhysicalDevice device)
 {
 	QueueFamilyIndices indices;
@@ -59,25 +188,54 @@ QueueFamilyIndices VkApplication::findQueueFamilies(VkPhysicalDevice device)
 	std::vector<VkQueueFamilyProperties> queueFamily(queueFamilyCount);
 	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamily.data());
 	
+	//every family is inspected, a graphics family that can also present is preferred
+	//and the dedicated compute and transfer families usually come after graphics
+	bool graphicsCanPresent = false;
 	uint32_t i = 0;
 	for (const auto& queue : queueFamily) {
-		if (queue.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-			indices.graphicsFamily = i;
-		}
+		bool graphics = (queue.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		bool compute = (queue.queueFlags & VK_QUEUE_COMPUTE_BIT) != 0;
+		bool transfer = (queue.queueFlags & VK_QUEUE_TRANSFER_BIT) != 0;
 
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
+		if (vkSurface != VK_NULL_HANDLE) {
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, vkSurface, &presentSupport);
+		}
 
-		if (presentSupport) {
+		if (graphics && (!indices.graphicsFamily.has_value() || (presentSupport && !graphicsCanPresent))) {
+			indices.graphicsFamily = i;
+			graphicsCanPresent = presentSupport;
+		}
+		if (presentSupport && (!indices.presentFamily.has_value() || graphics)) {
 			indices.presentFamily = i;
 		}
-		if (indices.isComplete()) {
-			break;
+		if (compute && !graphics && !indices.computeFamily.has_value()) {
+			indices.computeFamily = i;
+		}
+		//a transfer only family maps to the copy engines, a compute family works as a fallback
+		if (transfer && !graphics && !compute) {
+			indices.transferFamily = i;
 		}
 
 		i++;
 	}
 
+	if (!indices.transferFamily.has_value()) {
+		for (i = 0; i < queueFamilyCount; i++) {
+			if ((queueFamily[i].queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT)) &&
+				!(queueFamily[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && i != indices.computeFamily) {
+				indices.transferFamily = i;
+				break;
+			}
+		}
+	}
+
+	if (vkSurface == VK_NULL_HANDLE) {
+		//offscreen rendering never presents, the graphics queue stands in
+		//for the present queue so the rest of the setup stays uniform
+		indices.presentFamily = indices.graphicsFamily;
+	}
+
 	return indices;
 }
 
@@ -85,27 +243,67 @@ SwapChainSupportDetails VkApplication::querySwapChainSupport(VkPhysicalDevice de
 {
 	SwapChainSupportDetails swapChainDetails;
 	vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, vkSurface, &swapChainDetails.capabilites);
-	uint32_t formatCount;
-	vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, nullptr);
-	if (formatCount != 0) {
-		swapChainDetails.formats.resize(formatCount);
-		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, swapChainDetails.formats.data());
+	const DeviceCapabilities& capabilities = getDeviceCapabilities(device);
+	swapChainDetails.formats = capabilities.surfaceFormats;
+	swapChainDetails.presentModes = capabilities.presentModes;
+
+	return swapChainDetails;
+}
+
+DeviceCapabilities VkApplication::queryDeviceCapabilities(VkPhysicalDevice device)
+{
+	DeviceCapabilities capabilities;
+	vkGetPhysicalDeviceProperties(device, &capabilities.properties);
+	vkGetPhysicalDeviceMemoryProperties(device, &capabilities.memoryProperties);
+
+	VkPhysicalDeviceIDProperties idProperties{};
+	idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+	VkPhysicalDeviceProperties2 properties2{};
+	properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties2.pNext = &idProperties;
+	vkGetPhysicalDeviceProperties2(device, &properties2);
+	memcpy(capabilities.deviceUUID, idProperties.deviceUUID, VK_UUID_SIZE);
+
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	capabilities.extensions.resize(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, capabilities.extensions.data());
+	//extension feature structs may only be queried when the extension is exposed
+	capabilities.features = DeviceFeatureChain::query(device, capabilities.extensions);
+
+	capabilities.queueFamilies = findQueueFamilies(device);
+
+	if (vkSurface != VK_NULL_HANDLE) {
+		uint32_t formatCount;
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, nullptr);
+		capabilities.surfaceFormats.resize(formatCount);
+		vkGetPhysicalDeviceSurfaceFormatsKHR(device, vkSurface, &formatCount, capabilities.surfaceFormats.data());
+		uint32_t presentCount;
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentCount, nullptr);
+		capabilities.presentModes.resize(presentCount);
+		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentCount, capabilities.presentModes.data());
 	}
-	uint32_t presentCount;
-	vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentCount, nullptr);
-	if (presentCount != 0) {
-		swapChainDetails.presentModes.resize(presentCount);
-		vkGetPhysicalDeviceSurfacePresentModesKHR(device, vkSurface, &presentCount, swapChainDetails.presentModes.data());
+
+	return capabilities;
+}
+
+const DeviceCapabilities& VkApplication::getDeviceCapabilities(VkPhysicalDevice device)
+{
+	auto it = deviceCapabilities.find(device);
+	if (it == deviceCapabilities.end()) {
+		it = deviceCapabilities.emplace(device, queryDeviceCapabilities(device)).first;
 	}
 
-	return swapChainDetails;
+	return it->second;
 }
 
 VkSurfaceFormatKHR VkApplication::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
 {
-	for (const auto& availableFormat : availableFormats) {
-		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
-			return availableFormat;
+	for (const auto& preferredFormat : config.swapChainPolicy.formatPriority) {
+		for (const auto& availableFormat : availableFormats) {
+			if (availableFormat.format == preferredFormat.format && availableFormat.colorSpace == preferredFormat.colorSpace) {
+				return availableFormat;
+			}
 		}
 	}
 
@@ -114,15 +312,62 @@ VkSurfaceFormatKHR VkApplication::chooseSwapSurfaceFormat(const std::vector<VkSu
 
 VkPresentModeKHR VkApplication::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes)
 {
-	for (const auto& availablePresentMode : availablePresentModes) {
-		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-			return availablePresentMode;
+	std::vector<VkPresentModeKHR> preferredModes;
+	switch (config.swapChainPolicy.presentPolicy) {
+	case PresentPolicy::LowestLatency:
+		//immediate may tear but never waits for vblank, mailbox is the tear free runner up
+		preferredModes = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+		break;
+	case PresentPolicy::Throughput:
+		//relaxed fifo presents a late frame right away instead of waiting a whole interval
+		preferredModes = { VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+		break;
+	case PresentPolicy::PowerSaving:
+		break;
+	case PresentPolicy::Balanced:
+		preferredModes = { VK_PRESENT_MODE_MAILBOX_KHR };
+		break;
+	}
+
+	for (const auto& preferredMode : preferredModes) {
+		for (const auto& availablePresentMode : availablePresentModes) {
+			if (availablePresentMode == preferredMode) {
+				return availablePresentMode;
+			}
 		}
 	}
 
+	//fifo is the only mode every implementation is required to support
 	return VK_PRESENT_MODE_FIFO_KHR;
 }
 
+uint32_t VkApplication::chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilites)
+{
+	uint32_t imageCount = config.swapChainPolicy.imageCount;
+	if (imageCount == 0) {
+		switch (config.swapChainPolicy.presentPolicy) {
+		case PresentPolicy::LowestLatency:
+		case PresentPolicy::PowerSaving:
+			imageCount = capabilites.minImageCount;
+			break;
+		case PresentPolicy::Throughput:
+			imageCount = capabilites.minImageCount + 2;
+			break;
+		case PresentPolicy::Balanced:
+			imageCount = capabilites.minImageCount + 1;
+			break;
+		}
+	}
+
+	imageCount = std::max(imageCount, capabilites.minImageCount);
+	//a maxImageCount of 0 means there is no upper limit
+	if (capabilites.maxImageCount > 0 && imageCount > capabilites.maxImageCount) {
+		imageCount = capabilites.maxImageCount;
+	}
+
+	return imageCount;
+}
+
 VkExtent2D VkApplication::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilites)
 {
 	//swapextent is the resolution of the images to be drawn,it is almost always equal
@@ -133,8 +378,10 @@ VkExtent2D VkApplication::chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capab
 		return capabilites.currentExtent;
 	}
 	else {
-		int width, height;
-		glfwGetFramebufferSize(window, &width, &height);
+		int width = vkwidth, height = vkheight;
+		if (window != nullptr) {
+			glfwGetFramebufferSize(window, &width, &height);
+		}
 		VkExtent2D actualExtent = { static_cast<uint32_t>(width),static_cast<uint32_t>(height) };
 		actualExtent.height = std::clamp(actualExtent.height, capabilites.minImageExtent.height, capabilites.maxImageExtent.height);
 		actualExtent.width = std::clamp(actualExtent.width, capabilites.minImageExtent.width, capabilites.maxImageExtent.width);
@@ -148,63 +395,164 @@ void VkApplication::pickPhysicalDevice() {
 	vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
 	std::vector<VkPhysicalDevice> vkPhysicalDevicesV(deviceCount);
 	vkEnumeratePhysicalDevices(instance, &deviceCount, vkPhysicalDevicesV.data());
+	//each device's queries only depend on that device, with several gpus they run side
+	//by side and the results land in the cache the scoring below reads from
+	if (vkPhysicalDevicesV.size() > 1) {
+		std::vector<std::future<DeviceCapabilities>> queries;
+		for (const auto& device : vkPhysicalDevicesV) {
+			queries.push_back(std::async(std::launch::async, [this, device]() {
+				return queryDeviceCapabilities(device);
+			}));
+		}
+		for (size_t i = 0; i < queries.size(); i++) {
+			deviceCapabilities.emplace(vkPhysicalDevicesV[i], queries[i].get());
+		}
+	}
+	if (vkPhysicalDevicesV.empty()) {
+		throw std::runtime_error("couldn't find a device with vulkan support");
+	}
+
+	std::string deviceOverride = config.deviceOverride;
+	if (deviceOverride.empty()) {
+		const char* variable = std::getenv(deviceOverrideVariable);
+		deviceOverride = variable != nullptr ? variable : "";
+	}
+
 	std::multimap<int32_t, VkPhysicalDevice> candidates;
-	for (const auto& device : vkPhysicalDevicesV) {
+	for (uint32_t i = 0; i < vkPhysicalDevicesV.size(); i++) {
+		VkPhysicalDevice device = vkPhysicalDevicesV[i];
 		int32_t score = rateDeviceSuitability(device);
+		std::cerr << "[Vulkan Log] : device " << i << " " << getDeviceCapabilities(device).properties.deviceName
+			<< (score < 0 ? " is unsuitable" : " scored " + std::to_string(score)) << std::endl;
+
+		if (!deviceOverride.empty() && matchesDeviceOverride(device, i, deviceOverride)) {
+			//an explicit choice is never silently replaced by another device
+			if (score < 0) {
+				throw std::runtime_error("device " + deviceOverride + " was requested but lacks required features");
+			}
+			vkPhysicalDevice = device;
+			return;
+		}
 		candidates.insert(std::make_pair(score, device));
 	}
-	if (candidates.rbegin()->first > 0) {
-		if (isDeviceSuitable(candidates.rbegin()->second)) {
-			vkPhysicalDevice = candidates.rbegin()->second;
-		}
-		else {
-			throw std::runtime_error("couldn't find a suitable vulkan device 1");
-		}
-		
-
+	if (!deviceOverride.empty()) {
+		throw std::runtime_error("no vulkan device matches " + deviceOverride);
 	}
-	else {
-		throw std::runtime_error("couldn't find a suitable vulkan device 2");
+
+	//every suitable device has a non negative score, so the best one is the first in
+	//descending order and lower ranked ones are only reached when none above qualifies
+	for (auto it = candidates.rbegin(); it != candidates.rend(); ++it) {
+		if (it->first >= 0) {
+			vkPhysicalDevice = it->second;
+			std::cerr << "[Vulkan Log] : picked " << getDeviceCapabilities(vkPhysicalDevice).properties.deviceName << std::endl;
+			return;
+		}
 	}
 
+	throw std::runtime_error("couldn't find a suitable vulkan device");
 }
 
 bool VkApplication::isDeviceSuitable(VkPhysicalDevice device)
 {
-	QueueFamilyIndices indices = findQueueFamilies(device);
+	QueueFamilyIndices indices = getDeviceCapabilities(device).queueFamilies;
 	bool extensionsSupported = checkDeviceExtensionsSupport(device);
 	bool swapChainAdequate = false;
-	if (extensionsSupported) {
+	if (vkSurface == VK_NULL_HANDLE) {
+		//offscreen images are always available, there is no surface to check against
+		swapChainAdequate = true;
+	}
+	else if (extensionsSupported) {
 		SwapChainSupportDetails swapChainDetails = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainDetails.formats.empty() && !swapChainDetails.presentModes.empty();
 	}
-	return indices.isComplete() && extensionsSupported && swapChainAdequate;
+	return indices.isComplete() && extensionsSupported && swapChainAdequate && checkDeviceFeatureSupport(device);
+}
+
+bool VkApplication::checkDeviceFeatureSupport(VkPhysicalDevice device)
+{
+	return getDeviceCapabilities(device).features.contains(getRequiredFeatures());
+}
+
+DeviceFeatureChain VkApplication::getRequiredFeatures()
+{
+	DeviceFeatureChain required;
+	//timeline semaphores order work between the graphics, compute and transfer queues
+	required.vulkan12.timelineSemaphore = VK_TRUE;
+	//the bindless set: one runtime sized array per descriptor type, written while
+	//frames are in flight and indexed with values that differ across a draw
+	required.vulkan12.descriptorIndexing = VK_TRUE;
+	required.vulkan12.runtimeDescriptorArray = VK_TRUE;
+	required.vulkan12.descriptorBindingPartiallyBound = VK_TRUE;
+	required.vulkan12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	required.vulkan12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	required.vulkan12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	required.vulkan12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	required.vulkan12.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+	required.features2.features.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+	required.features2.features.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+	//the culling pass writes one command per surviving instance, firstInstance being its index
+	if (config.gpuCulling) {
+		required.vulkan12.drawIndirectCount = VK_TRUE;
+		required.features2.features.multiDrawIndirect = VK_TRUE;
+		required.features2.features.drawIndirectFirstInstance = VK_TRUE;
+	}
+	return required;
 }
 
 void VkApplication::createLogicalDevice()
 {
-	QueueFamilyIndices indices = findQueueFamilies(vkPhysicalDevice);
+	QueueFamilyIndices indices = getDeviceCapabilities(vkPhysicalDevice).queueFamilies;
 	std::set<uint32_t> uniqueGraphicsFamily = { indices.graphicsFamily.value(),indices.presentFamily.value() };
+	if (indices.computeFamily.has_value()) {
+		uniqueGraphicsFamily.insert(indices.computeFamily.value());
+	}
+	if (indices.transferFamily.has_value()) {
+		uniqueGraphicsFamily.insert(indices.transferFamily.value());
+	}
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfosV;
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueGraphicsFamily) {
 		VkDeviceQueueCreateInfo queueCreateInfo{};
 		queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-		queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
+		queueCreateInfo.queueFamilyIndex = queueFamily;
 		queueCreateInfo.queueCount = 1;
 		queueCreateInfo.pQueuePriorities = &queuePriority;
 		queueCreateInfosV.push_back(queueCreateInfo);
 	}
-	VkPhysicalDeviceFeatures vkDeviceFeatures{};
+	const DeviceFeatureChain& supportedFeatures = getDeviceCapabilities(vkPhysicalDevice).features;
+	//isDeviceSuitable already checked the required features are supported
+	enabledFeatures = getRequiredFeatures();
+	//only paid for when profiling asks for it
+	if (config.pipelineStatistics && !config.profileOutputPath.empty()) {
+		enabledFeatures.features2.features.pipelineStatisticsQuery = supportedFeatures.features2.features.pipelineStatisticsQuery;
+	}
+	pipelineStatisticsEnabled = enabledFeatures.features2.features.pipelineStatisticsQuery == VK_TRUE;
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+	//optional, the render graph falls back to vkCmdPipelineBarrier without it
+	if (supportedFeatures.synchronization2.synchronization2) {
+		extensions.push_back(VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME);
+		enabledFeatures.hasSynchronization2 = true;
+		enabledFeatures.synchronization2.synchronization2 = VK_TRUE;
+	}
+	//optional, without it the frame pacer waits on the graphics timeline instead
+	if (vkSurface != VK_NULL_HANDLE && supportedFeatures.presentId.presentId && supportedFeatures.presentWait.presentWait) {
+		extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		enabledFeatures.hasPresentWait = true;
+		enabledFeatures.presentId.presentId = VK_TRUE;
+		enabledFeatures.presentWait.presentWait = VK_TRUE;
+	}
 	VkDeviceCreateInfo vkDeviceCreateInfo{};
 	vkDeviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	//the 1.0 features travel inside VkPhysicalDeviceFeatures2, so pEnabledFeatures stays null
+	vkDeviceCreateInfo.pNext = enabledFeatures.link();
 	vkDeviceCreateInfo.pQueueCreateInfos = queueCreateInfosV.data();
 	vkDeviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfosV.size());
-	vkDeviceCreateInfo.pEnabledFeatures = &vkDeviceFeatures;
-	vkDeviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	vkDeviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	vkDeviceCreateInfo.pEnabledFeatures = nullptr;
+	vkDeviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	vkDeviceCreateInfo.ppEnabledExtensionNames = extensions.data();
 	//lines 132-133 enabled VK_KHR_Swapchain support
-	if (enableValidationLayers) {
+	if (config.validationMode != ValidationMode::Off) {
 		vkDeviceCreateInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
 		vkDeviceCreateInfo.ppEnabledLayerNames = validationLayers.data();
 	}
@@ -212,21 +560,161 @@ void VkApplication::createLogicalDevice()
 		vkDeviceCreateInfo.enabledLayerCount = 0;
 	}
 
-	if (vkCreateDevice(vkPhysicalDevice, &vkDeviceCreateInfo, nullptr, &vkDevice) != VK_SUCCESS) {
+	if (vkCreateDevice(vkPhysicalDevice, &vkDeviceCreateInfo, hostCallbacks("device"), &vkDevice) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create vulkan logical device");
 	}
+	//loaded once here, so a driver missing an entry point of an enabled extension fails
+	//device creation instead of the first frame that calls it
+	deviceDispatch.load(vkDevice, extensions);
 
 	vkGetDeviceQueue(vkDevice, indices.graphicsFamily.value(),0, &vkGraphicsQueue);
 	vkGetDeviceQueue(vkDevice,indices.presentFamily.value(),0,&vkPresentQueue);
+
+	createTimelineQueue(graphicsQueue, indices.graphicsFamily.value(), true);
+	createTimelineQueue(computeQueue, indices.computeFamily.value_or(indices.graphicsFamily.value()), indices.computeFamily.has_value());
+	createTimelineQueue(transferQueue, indices.transferFamily.value_or(indices.graphicsFamily.value()), indices.transferFamily.has_value());
+}
+
+void VkApplication::createAllocator()
+{
+	memoryAllocator.init(vkPhysicalDevice, vkDevice, defaultMemoryBlockSize, hostCallbacks("memory"));
+	memoryAllocator.createFrameArenas(config.maxFramesInFlight, config.transientArenaSize);
+}
+
+void VkApplication::createUploadManager()
+{
+	//one more batch than frames in flight so flushing never waits on the frame being recorded
+	uploadManager.init(vkDevice, deviceDispatch, memoryAllocator, transferQueue, graphicsQueue.family,
+		config.stagingRingSize, config.maxFramesInFlight + 1, hostCallbacks("uploads"));
+}
+
+void VkApplication::createPipelineManager()
+{
+	//the cache header is checked against the device pickPhysicalDevice chose,
+	//a cache from another gpu or driver version is discarded instead of loaded
+	pipelineManager.init(vkPhysicalDevice, vkDevice, config.pipelineCachePath, hostCallbacks("pipelines"));
+}
+
+void VkApplication::createJobSystem()
+{
+	jobSystem.init(config.workerThreadCount);
+	parallelRecorder.init(vkDevice, deviceDispatch, graphicsQueue.family, config.maxFramesInFlight, jobSystem, hostCallbacks("recorder"));
+}
+
+void VkApplication::createProfiler()
+{
+	if (config.profileOutputPath.empty()) {
+		return;
+	}
+
+	//one query pool per frame in flight, a pool is read back right after its frame's
+	//fence wait so collecting results never stalls the cpu on the gpu
+	profiler.init(vkPhysicalDevice, vkDevice, deviceDispatch, graphicsQueue.family, config.maxFramesInFlight,
+		config.maxProfileScopes, pipelineStatisticsEnabled, hostCallbacks("profiler"));
+	if (!profiler.isEnabled()) {
+		std::cerr << "[Vulkan Log] : graphics queue has no valid timestamp bits, profiling disabled" << std::endl;
+		return;
+	}
+	if (!profiler.openOutput(config.profileOutputPath, config.profileFormat)) {
+		throw std::runtime_error("failed to open profile output " + config.profileOutputPath);
+	}
+}
+
+void VkApplication::createDescriptorManager()
+{
+	descriptorManager.init(vkPhysicalDevice, vkDevice, deviceDispatch, config.maxBindlessSampledImages,
+		config.maxBindlessStorageBuffers, config.maxBindlessSamplers, hostCallbacks("descriptors"));
+}
+
+void VkApplication::createGpuCulling()
+{
+	if (!config.gpuCulling) {
+		return;
+	}
+
+	//the buffers are shared by every queue that touches them instead of being handed
+	//back and forth, graphics draws from them and compute or transfer writes them
+	std::set<uint32_t> families = { graphicsQueue.family, computeQueue.family, transferQueue.family };
+	gpuCulling.init(vkDevice, deviceDispatch, memoryAllocator, uploadManager, descriptorManager, pipelineManager, shaderManager,
+		std::vector<uint32_t>(families.begin(), families.end()), computeQueue.family, computeQueue.dedicated,
+		config.maxFramesInFlight, config.maxCullInstances, config.maxCullMeshes, hostCallbacks("culling"));
+}
+
+void VkApplication::createShaderManager()
+{
+	shaderManager.init(vkDevice, pipelineManager, config.shaderDirectory, config.shaderSourceDirectory,
+		config.shaderCompiler, config.hotReloadShaders, hostCallbacks("shaders"));
+}
+
+void VkApplication::createFramePacer()
+{
+	framePacer.init(vkDevice, deviceDispatch, graphicsQueue.timeline, config.maxFrameRate, config.maxQueuedFrames);
+	framePacer.setSwapChain(vkSwapChain, 1);
+	if (!framePacer.getStatistics().presentWait && vkSwapChain != VK_NULL_HANDLE) {
+		std::cerr << "[Vulkan Log] : present wait unsupported, frames are paced on gpu completion" << std::endl;
+	}
+}
+
+void VkApplication::createFrameCapture()
+{
+	if (config.capturePath.empty()) {
+		return;
+	}
+	if (!swapChainSupportsCapture) {
+		std::cerr << "[Vulkan Log] : swapchain images cannot be copied out, capture disabled" << std::endl;
+		return;
+	}
+
+	//a frame's readback is written maxFramesInFlight frames after it was recorded at the
+	//earliest, the queued frames on top of that give the writer room to fall behind
+	uint32_t frameRate = config.maxFrameRate > 0.0 ? static_cast<uint32_t>(config.maxFrameRate + 0.5) : 60;
+	frameCapture.init(vkDevice, deviceDispatch, memoryAllocator, config.capturePath, config.captureFormat,
+		config.maxFramesInFlight + config.maxQueuedCaptureFrames, frameRate);
+}
+
+void VkApplication::createObjectCache()
+{
+	objectCache.init(vkPhysicalDevice, vkDevice, hostCallbacks("object_cache"));
+}
+
+void VkApplication::createRenderGraph()
+{
+	renderGraph.init(vkDevice, deviceDispatch, memoryAllocator, hostCallbacks("render_graph"));
+	renderGraph.setSwapChain(swapChainImages, swapChainImageViews, swapChainImageFormat, swapChainExtent,
+		vkSwapChain != VK_NULL_HANDLE && !capturesSwapChain());
+}
+
+void VkApplication::createTimelineQueue(TimelineQueue& timelineQueue, uint32_t family, bool dedicated)
+{
+	vkGetDeviceQueue(vkDevice, family, 0, &timelineQueue.queue);
+	timelineQueue.device = vkDevice;
+	timelineQueue.dispatch = &deviceDispatch;
+	timelineQueue.family = family;
+	timelineQueue.dedicated = dedicated;
+	timelineQueue.value = 0;
+
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if (vkCreateSemaphore(vkDevice, &semaphoreInfo, hostCallbacks("device"), &timelineQueue.timeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create queue timeline semaphore");
+	}
+}
+
+void VkApplication::addGraphicsWait(const TimelineQueue& source, uint64_t value, VkPipelineStageFlags stage)
+{
+	pendingGraphicsWaits.push_back({ source.timeline, value, stage });
 }
 
 bool VkApplication::checkDeviceExtensionsSupport(VkPhysicalDevice device)
 {
-	uint32_t extensionCount;
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
-	std::vector<VkExtensionProperties> availableProperties(extensionCount);
-	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableProperties.data());
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	const std::vector<VkExtensionProperties>& availableProperties = getDeviceCapabilities(device).extensions;
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+	std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 	for (const auto& extension : availableProperties) {
 		requiredExtensions.erase(extension.extensionName);
 	}
@@ -234,18 +722,28 @@ bool VkApplication::checkDeviceExtensionsSupport(VkPhysicalDevice device)
 	return requiredExtensions.empty();
 }
 
+std::vector<const char*> VkApplication::getRequiredDeviceExtensions()
+{
+	//offscreen rendering has no surface and therefore no use for VK_KHR_swapchain
+	if (vkSurface == VK_NULL_HANDLE) {
+		return {};
+	}
+
+	return deviceExtensions;
+}
+
 void VkApplication::createSwapChain()
 {
+	if (vkSurface == VK_NULL_HANDLE) {
+		createOffscreenImages();
+		return;
+	}
+
 	SwapChainSupportDetails supportDetails = querySwapChainSupport(vkPhysicalDevice);
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(supportDetails.formats);
 	VkPresentModeKHR presentModes = chooseSwapPresentMode(supportDetails.presentModes);
 	VkExtent2D extent = chooseSwapExtent(supportDetails.capabilites);
-	uint32_t minImageCount = supportDetails.capabilites.minImageCount;
-	uint32_t imageCount = minImageCount + 1;
-
-	if (supportDetails.capabilites.maxImageCount > 0 && imageCount > supportDetails.capabilites.maxImageCount) {
-		imageCount = supportDetails.capabilites.maxImageCount;
-	}
+	uint32_t imageCount = chooseSwapImageCount(supportDetails.capabilites);
 
 	VkSwapchainCreateInfoKHR vkCreateInfo{};
 	vkCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -260,8 +758,18 @@ void VkApplication::createSwapChain()
 	vkCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 	//imageUsage is used to directly render the image to swapchain,in order to 
 	//render to an offscreen image use VK_IMAGE_USAGE_TRANSFER_DST_BIT
+	swapChainSupportsClear = (supportDetails.capabilites.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) != 0;
+	if (swapChainSupportsClear) {
+		vkCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	}
+	//capture copies every frame out of the swapchain image, only asked for when it is on
+	swapChainSupportsCapture = !config.capturePath.empty() && FrameCapture::supportsFormat(surfaceFormat.format) &&
+		(supportDetails.capabilites.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0;
+	if (swapChainSupportsCapture) {
+		vkCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 
-	QueueFamilyIndices indices = findQueueFamilies(vkPhysicalDevice);
+	QueueFamilyIndices indices = getDeviceCapabilities(vkPhysicalDevice).queueFamilies;
 	uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(),indices.presentFamily.value() };
 
 	if (indices.graphicsFamily != indices.presentFamily) {
@@ -282,11 +790,15 @@ void VkApplication::createSwapChain()
 	vkCreateInfo.presentMode = presentModes;
 	vkCreateInfo.clipped = VK_TRUE;
 	//clipped mode correlates to if we care about the color of pixels that are not in the view
-	vkCreateInfo.oldSwapchain = nullptr;
+	//handing over the current swapchain lets the driver reuse its resources and keeps
+	//presentation going while the old one drains, it is retired by recreateSwapChain
+	vkCreateInfo.oldSwapchain = vkSwapChain;
 
-	if (vkCreateSwapchainKHR(vkDevice, &vkCreateInfo, nullptr, &vkSwapChain) != VK_SUCCESS) {
+	VkSwapchainKHR newSwapChain;
+	if (vkCreateSwapchainKHR(vkDevice, &vkCreateInfo, hostCallbacks("swapchain"), &newSwapChain) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create swap chain");
 	}
+	vkSwapChain = newSwapChain;
 
 	vkGetSwapchainImagesKHR(vkDevice, vkSwapChain, &imageCount, nullptr);
 	swapChainImages.resize(imageCount);
@@ -295,9 +807,433 @@ void VkApplication::createSwapChain()
 	swapChainExtent = extent;
 }
 
+void VkApplication::createOffscreenImages()
+{
+	//without a surface the "swapchain" is a fixed set of device local images,
+	//they are used exactly like swapchain images but are never presented
+	//take the first preferred format that can be rendered to and copied out of
+	swapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+	VkFormatFeatureFlags requiredFeatures = VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT | VK_FORMAT_FEATURE_TRANSFER_SRC_BIT;
+	for (const auto& preferredFormat : config.swapChainPolicy.formatPriority) {
+		VkFormatProperties formatProperties;
+		vkGetPhysicalDeviceFormatProperties(vkPhysicalDevice, preferredFormat.format, &formatProperties);
+		if ((formatProperties.optimalTilingFeatures & requiredFeatures) == requiredFeatures) {
+			swapChainImageFormat = preferredFormat.format;
+			break;
+		}
+	}
+	swapChainExtent = { static_cast<uint32_t>(vkwidth), static_cast<uint32_t>(vkheight) };
+	swapChainImages.resize(config.offscreenImageCount);
+	offscreenImageMemory.resize(config.offscreenImageCount);
+
+	for (uint32_t i = 0; i < config.offscreenImageCount; i++) {
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = swapChainImageFormat;
+		imageInfo.extent = { swapChainExtent.width, swapChainExtent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		//transfer src lets the rendered frame be read back or copied elsewhere
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		memoryAllocator.createImage(imageInfo, MemoryUsage::GpuOnly, swapChainImages[i], offscreenImageMemory[i]);
+	}
+	swapChainSupportsClear = true;
+	swapChainSupportsCapture = FrameCapture::supportsFormat(swapChainImageFormat);
+}
+
 void VkApplication::createImageViews() {
 	swapChainImageViews.resize(swapChainImages.size());
+	for (size_t i = 0; i < swapChainImages.size(); i++) {
+		VkImageViewCreateInfo viewInfo{};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = swapChainImages[i];
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = swapChainImageFormat;
+		viewInfo.components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY,
+			VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY };
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = 0;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		swapChainImageViews[i] = objectCache.getImageView(viewInfo);
+	}
+}
+
+void VkApplication::createFrameResources()
+{
+	QueueFamilyIndices indices = getDeviceCapabilities(vkPhysicalDevice).queueFamilies;
+	frames.resize(config.maxFramesInFlight);
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+	const VkAllocationCallbacks* callbacks = hostCallbacks("frames");
+
+	for (auto& frame : frames) {
+		VkCommandPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		//transient tells the driver the buffers are short lived, the pool is reset every frame
+		poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+		poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
+		if (vkCreateCommandPool(vkDevice, &poolInfo, callbacks, &frame.commandPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame command pool");
+		}
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.commandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(vkDevice, &allocInfo, &frame.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate frame command buffer");
+		}
+
+		VkSemaphoreCreateInfo semaphoreInfo{};
+		semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+		//created signaled so the very first wait in drawFrame returns immediately
+		fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+		if (vkCreateSemaphore(vkDevice, &semaphoreInfo, callbacks, &frame.imageAvailableSemaphore) != VK_SUCCESS ||
+			vkCreateFence(vkDevice, &fenceInfo, callbacks, &frame.inFlightFence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame synchronization objects");
+		}
+	}
+	createRenderFinishedSemaphores();
+}
+
+void VkApplication::createRenderFinishedSemaphores()
+{
+	//offscreen images are never presented
+	renderFinishedSemaphores.assign(vkSwapChain != VK_NULL_HANDLE ? swapChainImages.size() : 0, VK_NULL_HANDLE);
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	for (auto& semaphore : renderFinishedSemaphores) {
+		if (vkCreateSemaphore(vkDevice, &semaphoreInfo, hostCallbacks("frames"), &semaphore) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create frame synchronization objects");
+		}
+	}
+}
+
+void VkApplication::destroyFrameResources()
+{
+	const VkAllocationCallbacks* callbacks = hostCallbacks("frames");
+	for (auto& frame : frames) {
+		vkDestroyFence(vkDevice, frame.inFlightFence, callbacks);
+		vkDestroySemaphore(vkDevice, frame.imageAvailableSemaphore, callbacks);
+		//destroying the pool frees the command buffers allocated from it
+		vkDestroyCommandPool(vkDevice, frame.commandPool, callbacks);
+	}
+	frames.clear();
+	for (auto semaphore : renderFinishedSemaphores) {
+		vkDestroySemaphore(vkDevice, semaphore, callbacks);
+	}
+	renderFinishedSemaphores.clear();
+}
+
+void VkApplication::drawFrame()
+{
+	FrameData& frame = frames[currentFrame];
+	//only wait for the submission that last used this frame's resources,
+	//the other frames in flight keep the gpu busy while we record the next one
+	deviceDispatch.vkWaitForFences(vkDevice, 1, &frame.inFlightFence, VK_TRUE, UINT64_MAX);
+	//fences signal in submission order, so every earlier frame is done as well
+	completedFrameSerial = std::max(completedFrameSerial, frame.frameSerial);
+	//views go before their swapchain, whose image handles could otherwise be reused
+	objectCache.releaseRetired(completedFrameSerial);
+	releaseRetiredSwapChains(false);
+	//readbacks of the completed frames go to the writer, nothing here waits for the disk
+	frameCapture.collect(completedFrameSerial);
+	descriptorManager.releaseSlots(completedFrameSerial);
+	renderGraph.releaseRetired(completedFrameSerial);
+	shaderManager.releaseRetired(completedFrameSerial);
+	//pipelines rebuilt on the watcher thread take over from this frame on, a compile
+	//still in progress is simply picked up by a later frame
+	shaderManager.applyReloads(frameNumber + 1);
+	memoryAllocator.resetFrameArena(currentFrame);
+	//the fence covers the queries this slot wrote maxFramesInFlight frames ago
+	profiler.collectFrame(currentFrame);
+
+	uint32_t imageIndex;
+	if (vkSwapChain != VK_NULL_HANDLE) {
+		VkResult result = deviceDispatch.vkAcquireNextImageKHR(vkDevice, vkSwapChain, UINT64_MAX, frame.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+			//nothing was submitted, the fence is still signaled and the frame slot can be reused as is
+			recreateSwapChain();
+			return;
+		}
+		if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+			throw std::runtime_error("failed to acquire swap chain image");
+		}
+	}
+	else {
+		imageIndex = static_cast<uint32_t>(frameNumber % swapChainImages.size());
+	}
+
+	//the swapchain may hand images back out of order, so a different frame
+	//in flight could still be rendering into the one we just acquired
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE && imagesInFlight[imageIndex] != frame.inFlightFence) {
+		deviceDispatch.vkWaitForFences(vkDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	}
+	imagesInFlight[imageIndex] = frame.inFlightFence;
+	deviceDispatch.vkResetFences(vkDevice, 1, &frame.inFlightFence);
+
+	//everything queued for upload since the last frame goes out as one transfer
+	//submission, this frame's graphics work waits for it on the transfer timeline
+	uploadManager.flush();
+	if (uploadManager.lastFlushValue() > graphicsUploadValue) {
+		graphicsUploadValue = uploadManager.lastFlushValue();
+		addGraphicsWait(transferQueue, graphicsUploadValue, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+	}
+	//on its own queue the culling pass overlaps the tail of the previous frame,
+	//only the indirect draws of this frame wait for it
+	if (gpuCulling.isEnabled() && gpuCulling.usesAsyncCompute()) {
+		std::vector<TimelineWait> cullWaits;
+		if (uploadManager.lastFlushValue() > 0) {
+			cullWaits.push_back({ transferQueue.timeline, uploadManager.lastFlushValue(), VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT });
+		}
+		//the depth pyramid is written by the previous frame's graphics work
+		if (gpuCulling.usesOcclusion() && graphicsQueue.value > 0) {
+			cullWaits.push_back({ graphicsQueue.timeline, graphicsQueue.value, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT });
+		}
+		uint64_t cullValue = gpuCulling.submit(currentFrame, computeQueue, cullWaits);
+		addGraphicsWait(computeQueue, cullValue, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+	}
+
+	deviceDispatch.vkResetCommandPool(vkDevice, frame.commandPool, 0);
+	parallelRecorder.beginFrame(currentFrame);
+	recordCommandBuffer(frame.commandBuffer, imageIndex);
+
+	//binary and timeline semaphores share one submission, the values of the
+	//binary ones are ignored by the driver
+	std::vector<VkSemaphore> waitSemaphores;
+	std::vector<uint64_t> waitValues;
+	std::vector<VkPipelineStageFlags> waitStages;
+	std::vector<VkSemaphore> signalSemaphores = { graphicsQueue.timeline };
+	std::vector<uint64_t> signalValues = { graphicsQueue.value + 1 };
+	if (vkSwapChain != VK_NULL_HANDLE) {
+		waitSemaphores.push_back(frame.imageAvailableSemaphore);
+		waitValues.push_back(0);
+		waitStages.push_back(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+		signalSemaphores.push_back(renderFinishedSemaphores[imageIndex]);
+		signalValues.push_back(0);
+	}
+	for (const auto& wait : pendingGraphicsWaits) {
+		waitSemaphores.push_back(wait.timeline);
+		waitValues.push_back(wait.value);
+		waitStages.push_back(wait.stage);
+	}
+	pendingGraphicsWaits.clear();
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+	timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.waitSemaphoreCount = static_cast<uint32_t>(waitSemaphores.size());
+	submitInfo.pWaitSemaphores = waitSemaphores.data();
+	submitInfo.pWaitDstStageMask = waitStages.data();
+	submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+	submitInfo.pSignalSemaphores = signalSemaphores.data();
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frame.commandBuffer;
+	if (deviceDispatch.vkQueueSubmit(graphicsQueue.queue, 1, &submitInfo, frame.inFlightFence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit frame command buffer");
+	}
+	graphicsQueue.value++;
+	frame.frameSerial = frameNumber + 1;
+	framePacer.frameSubmitted(frame.frameSerial, graphicsQueue.value);
+	if (gpuCulling.isEnabled()) {
+		gpuCulling.frameSubmitted(graphicsQueue.timeline, graphicsQueue.value);
+	}
+
+	if (vkSwapChain != VK_NULL_HANDLE) {
+		VkPresentInfoKHR presentInfo{};
+		presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+		presentInfo.waitSemaphoreCount = 1;
+		presentInfo.pWaitSemaphores = &renderFinishedSemaphores[imageIndex];
+		presentInfo.swapchainCount = 1;
+		presentInfo.pSwapchains = &vkSwapChain;
+		presentInfo.pImageIndices = &imageIndex;
+		framePacer.chainPresentId(presentInfo, frame.frameSerial);
+		VkResult result = deviceDispatch.vkQueuePresentKHR(vkPresentQueue, &presentInfo);
+		if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || framebufferResized) {
+			framebufferResized = false;
+			recreateSwapChain();
+		}
+		else if (result != VK_SUCCESS) {
+			throw std::runtime_error("failed to present swap chain image");
+		}
+	}
+
+	currentFrame = (currentFrame + 1) % static_cast<uint32_t>(frames.size());
+}
+
+void VkApplication::recreateSwapChain()
+{
+	if (window != nullptr) {
+		//a minimized window has a zero sized framebuffer, there is nothing to
+		//render into until it is restored
+		int width = 0, height = 0;
+		glfwGetFramebufferSize(window, &width, &height);
+		while ((width == 0 || height == 0) && !glfwWindowShouldClose(window)) {
+			glfwWaitEvents();
+			glfwGetFramebufferSize(window, &width, &height);
+		}
+	}
+
+	//no vkDeviceWaitIdle here, frames still in flight keep using the old images
+	//and the old swapchain is destroyed once the last of them has completed
+	RetiredSwapChain retired{};
+	retired.swapChain = vkSwapChain;
+	retired.renderFinishedSemaphores = std::move(renderFinishedSemaphores);
+	retired.retireSerial = frameNumber + 1;
+	for (auto image : swapChainImages) {
+		objectCache.releaseImage(image, retired.retireSerial);
+	}
+
+	createSwapChain();
+	createRenderFinishedSemaphores();
+	//the frame being drawn may already have been presented on the old swapchain, so the
+	//new one is waited on from the frame after it
+	framePacer.setSwapChain(vkSwapChain, frameNumber + 2);
+	createImageViews();
+	renderGraph.setSwapChain(swapChainImages, swapChainImageViews, swapChainImageFormat, swapChainExtent,
+		vkSwapChain != VK_NULL_HANDLE && !capturesSwapChain());
+	retiredSwapChains.push_back(retired);
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+}
+
+void VkApplication::releaseRetiredSwapChains(bool waitedIdle)
+{
+	auto it = retiredSwapChains.begin();
+	while (it != retiredSwapChains.end()) {
+		if (waitedIdle || completedFrameSerial >= it->retireSerial) {
+			vkDestroySwapchainKHR(vkDevice, it->swapChain, hostCallbacks("swapchain"));
+			for (auto semaphore : it->renderFinishedSemaphores) {
+				vkDestroySemaphore(vkDevice, semaphore, hostCallbacks("frames"));
+			}
+			it = retiredSwapChains.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+void VkApplication::framebufferResizeCallback(GLFWwindow* window, int width, int height)
+{
+	auto app = reinterpret_cast<VkApplication*>(glfwGetWindowUserPointer(window));
+	app->framebufferResized = true;
+}
+
+void VkApplication::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	if (deviceDispatch.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording frame command buffer");
+	}
+	profiler.beginFrame(commandBuffer, currentFrame, frameNumber);
+	uint32_t frameScope = profiler.beginScope(commandBuffer, "frame");
+	uploadManager.recordAcquireBarriers(commandBuffer);
+	if (gpuCulling.isEnabled() && !gpuCulling.usesAsyncCompute()) {
+		uint32_t cullScope = profiler.beginScope(commandBuffer, "cull", true);
+		gpuCulling.record(commandBuffer, currentFrame);
+		profiler.endScope(commandBuffer, cullScope);
+	}
+
+	//the workers record into secondary buffers while this thread waits, the primary
+	//buffer then just stitches them together in submission order
+	VkCommandBufferInheritanceInfo inheritance{};
+	inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	uint32_t tasksScope = profiler.beginScope(commandBuffer, "record_tasks");
+	parallelRecorder.record(commandBuffer, frameRecordTasks, inheritance);
+	profiler.endScope(commandBuffer, tasksScope);
+	for (auto& callback : frameCallbacks) {
+		callback(commandBuffer, currentFrame);
+	}
+
+	if (!renderGraph.empty()) {
+		uint32_t graphScope = profiler.beginScope(commandBuffer, "render_graph");
+		renderGraph.execute(commandBuffer, imageIndex, frameNumber + 1);
+		profiler.endScope(commandBuffer, graphScope);
+	}
+	else {
+		recordClear(commandBuffer, imageIndex);
+	}
+	//a format the new swapchain cannot capture in just leaves the frames out
+	if (capturesSwapChain()) {
+		uint32_t captureScope = profiler.beginScope(commandBuffer, "capture");
+		frameCapture.record(commandBuffer, swapChainImages[imageIndex],
+			vkSwapChain != VK_NULL_HANDLE ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			swapChainImageFormat, swapChainExtent, frameNumber + 1);
+		profiler.endScope(commandBuffer, captureScope);
+	}
+
+	profiler.endScope(commandBuffer, frameScope);
+	if (deviceDispatch.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record frame command buffer");
+	}
+}
 
+void VkApplication::recordClear(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	VkImageSubresourceRange range{};
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.levelCount = 1;
+	range.layerCount = 1;
+
+	//the previous contents are discarded, so the image always starts out undefined
+	VkImageMemoryBarrier toTransfer{};
+	toTransfer.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	toTransfer.srcAccessMask = 0;
+	toTransfer.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	toTransfer.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	toTransfer.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toTransfer.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	toTransfer.image = swapChainImages[imageIndex];
+	toTransfer.subresourceRange = range;
+
+	//offscreen images are never presented and captured ones are presented after the
+	//copy, both are left ready to be copied out behind a barrier the copy can chain to
+	bool copiedOut = vkSwapChain == VK_NULL_HANDLE || capturesSwapChain();
+	VkPipelineStageFlags finalStage = copiedOut ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+	VkImageMemoryBarrier toFinal = toTransfer;
+	toFinal.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	toFinal.dstAccessMask = copiedOut ? VK_ACCESS_TRANSFER_READ_BIT : 0;
+	toFinal.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	toFinal.newLayout = copiedOut ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+	if (swapChainSupportsClear) {
+		//the source stage matches the acquire semaphore wait stage so the transition
+		//happens only after the presentation engine has released the image
+		deviceDispatch.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0, 0, nullptr, 0, nullptr, 1, &toTransfer);
+		uint32_t clearScope = profiler.beginScope(commandBuffer, "clear");
+		VkClearColorValue clearColor = { { 0.0f, 0.0f, static_cast<float>(frameNumber % 256) / 255.0f, 1.0f } };
+		deviceDispatch.vkCmdClearColorImage(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &range);
+		profiler.endScope(commandBuffer, clearScope);
+		deviceDispatch.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, finalStage,
+			0, 0, nullptr, 0, nullptr, 1, &toFinal);
+	}
+	else {
+		toFinal.srcAccessMask = 0;
+		toFinal.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		deviceDispatch.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, finalStage,
+			0, 0, nullptr, 0, nullptr, 1, &toFinal);
+	}
 }
 
 void VkApplication::createInstance() {
@@ -305,7 +1241,7 @@ void VkApplication::createInstance() {
 	//library, create an instance that serves as a connection
 	//between the application and vulkan library
 
-	if (enableValidationLayers && !checkValidationLayerSupport()) {
+	if (config.validationMode != ValidationMode::Off && !checkValidationLayerSupport()) {
 		throw std::runtime_error("validation layers requested but not found");
 	}
 	VkApplicationInfo vkAppInfo{};
@@ -325,19 +1261,33 @@ void VkApplication::createInstance() {
 	vkCreateInfo.enabledExtensionCount = static_cast<int32_t>(extensions.size());
 	vkCreateInfo.ppEnabledExtensionNames = extensions.data();
 	VkDebugUtilsMessengerCreateInfoEXT vkDebugCreateInfo{};
-	if (enableValidationLayers) {
+	//the checks on top of core validation, read by the layer from the instance pNext chain
+	const VkValidationFeatureEnableEXT fullValidationFeatures[] = {
+		VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_EXT,
+		VK_VALIDATION_FEATURE_ENABLE_GPU_ASSISTED_RESERVE_BINDING_SLOT_EXT,
+		VK_VALIDATION_FEATURE_ENABLE_BEST_PRACTICES_EXT
+	};
+	VkValidationFeaturesEXT validationFeatures{};
+	validationFeatures.sType = VK_STRUCTURE_TYPE_VALIDATION_FEATURES_EXT;
+	validationFeatures.enabledValidationFeatureCount = static_cast<uint32_t>(std::size(fullValidationFeatures));
+	validationFeatures.pEnabledValidationFeatures = fullValidationFeatures;
+	if (config.validationMode != ValidationMode::Off) {
 		vkCreateInfo.enabledLayerCount = static_cast<int32_t>(validationLayers.size());
 		vkCreateInfo.ppEnabledLayerNames = validationLayers.data();
+		//the instance's own messages go through the same logger as the messenger's
+		validationLogger.init(config.maxValidationMessagesPerSecond);
 		populateDebugMessengerCreateInfo(vkDebugCreateInfo);
-		vkCreateInfo.pNext = (VkDebugUtilsMessengerCreateInfoEXT*) &vkDebugCreateInfo;
-		
+		vkCreateInfo.pNext = &vkDebugCreateInfo;
+		if (validationFeaturesEnabled) {
+			vkDebugCreateInfo.pNext = &validationFeatures;
+		}
 	}
 	else {
 		vkCreateInfo.enabledLayerCount = 0;
 		vkCreateInfo.pNext = nullptr;
 	}
-	vkCreateInfo.enabledLayerCount = 0;
-	if (vkCreateInstance(&vkCreateInfo, nullptr, &instance) != VK_SUCCESS) {
+	if (vkCreateInstance(&vkCreateInfo, hostCallbacks("instance"), &instance) != VK_SUCCESS) {
+		validationLogger.destroy();
 		throw std::runtime_error("failed to create vulkan instance");
 	}
 	
@@ -370,57 +1320,176 @@ bool VkApplication::checkValidationLayerSupport() {
 }
 
 
-void VkApplication::initWindow() {
+void VkApplication::initGlfw() {
 	//glfwinit is called first to initialize 
 	//glfw, the glfwcreatewindow is called with
 	//GLFW_CLIENT_API and GLFW_NO_API ..to support
 	//vulkan
+	if (config.headless) {
+		//render nodes have no display, glfwInit would fail without one
+		return;
+	}
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-	glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);//this prevenets the window form resizing
+	glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);//resizes are handled by recreateSwapChain
+}
+
+void VkApplication::initWindow() {
+	if (config.headless) {
+		return;
+	}
 	window = glfwCreateWindow(vkwidth, vkheight, appname.c_str(), nullptr, nullptr);
+	glfwSetWindowUserPointer(window, this);
+	glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
 }
 
 void VkApplication::mainLoop() {
-	while (!glfwWindowShouldClose(window)) {
+	while (!shouldClose()) {
+		renderFrame();
+	}
+	//let the frames still in flight finish before cleanup starts destroying their resources
+	vkDeviceWaitIdle(vkDevice);
+
+}
+
+void VkApplication::renderFrame() {
+	//waiting for the queue to drain and for the frame rate cap happens before input is
+	//read, so the frame is built from the newest input there is when it starts
+	framePacer.beginFrame(frameNumber + 1);
+	auto frameStart = std::chrono::steady_clock::now();
+	uint32_t frameIndex = currentFrame;
+	if (window != nullptr) {
 		glfwPollEvents();
 	}
+	framePacer.markInput();
+	drawFrame();
+	frameNumber++;
+	//kept with the frame's queries and written out together with its gpu timings
+	auto frameEnd = std::chrono::steady_clock::now();
+	profiler.setCpuFrameTime(frameIndex,
+		std::chrono::duration<double, std::micro>(frameStart - startTime).count(),
+		std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+}
+
+bool VkApplication::shouldClose() {
+	if (config.frameCount > 0 && frameNumber >= config.frameCount) {
+		return true;
+	}
 
+	return window != nullptr && glfwWindowShouldClose(window);
 }
 
 void VkApplication::cleanup() {
-	vkDestroySwapchainKHR(vkDevice, vkSwapChain, nullptr);
-	vkDestroyDevice(vkDevice, nullptr);
-	if (enableValidationLayers) {
-		DestroyDebugUtilsMessengerEXT(instance, vkDebugMessenger, nullptr);
+	parallelRecorder.destroy();
+	jobSystem.shutdown();
+	//the device is idle, so the last frames' queries are ready as well
+	for (uint32_t i = 0; i < config.maxFramesInFlight; i++) {
+		profiler.collectFrame((currentFrame + i) % config.maxFramesInFlight);
+	}
+	profiler.destroy();
+	destroyFrameResources();
+	releaseRetiredSwapChains(true);
+	vkDestroySemaphore(vkDevice, transferQueue.timeline, hostCallbacks("device"));
+	vkDestroySemaphore(vkDevice, computeQueue.timeline, hostCallbacks("device"));
+	vkDestroySemaphore(vkDevice, graphicsQueue.timeline, hostCallbacks("device"));
+	if (vkSwapChain != VK_NULL_HANDLE) {
+		vkDestroySwapchainKHR(vkDevice, vkSwapChain, hostCallbacks("swapchain"));
+	}
+	else {
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			memoryAllocator.destroyImage(swapChainImages[i], offscreenImageMemory[i]);
+		}
+	}
+	//the device is idle, so every frame still waiting for its readback is written out first
+	frameCapture.destroy();
+	CaptureStatistics capture = frameCapture.getStatistics();
+	if (capture.capturedFrames > 0) {
+		std::cerr << "[Vulkan Log] : captured " << capture.writtenFrames << " frames, " << capture.writtenBytes
+			<< " bytes, to " << config.capturePath << ", " << capture.droppedFrames << " dropped" << std::endl;
+	}
+	gpuCulling.destroy();
+	renderGraph.destroy();
+	objectCache.destroy();
+	shaderManager.destroy();
+	uploadManager.destroy();
+	pipelineManager.destroy();
+	descriptorManager.destroy();
+	const FramePacingStatistics& pacing = framePacer.getStatistics();
+	if (pacing.samples > 0) {
+		std::cerr << "[Vulkan Log] : input to " << (pacing.presentWait ? "present" : "gpu completion") << " latency "
+			<< pacing.averageLatency << " ms average, " << pacing.maxLatency << " ms max over " << pacing.samples
+			<< " frames" << std::endl;
+	}
+	MemoryStatistics stats = memoryAllocator.getStatistics();
+	std::cerr << "[Vulkan Log] : device memory " << stats.deviceMemoryCount << " allocations, "
+		<< stats.reservedBytes << " bytes reserved, " << stats.usedBytes << " bytes in use, fragmentation "
+		<< stats.fragmentation << std::endl;
+	memoryAllocator.destroy();
+	vkDestroyDevice(vkDevice, hostCallbacks("device"));
+	if (vkDebugMessenger != VK_NULL_HANDLE) {
+		DestroyDebugUtilsMessengerEXT(instance, vkDebugMessenger, hostCallbacks("instance"));
 	}
 
-	vkDestroySurfaceKHR(instance, vkSurface, nullptr);
-	vkDestroyInstance(instance, nullptr);
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (vkSurface != VK_NULL_HANDLE) {
+		vkDestroySurfaceKHR(instance, vkSurface, hostCallbacks("instance"));
+	}
+	vkDestroyInstance(instance, hostCallbacks("instance"));
+	validationLogger.destroy();
+	//whatever is still live was leaked by the driver or by a missing destroy call,
+	//command scope allocations made every frame are the churn worth chasing
+	for (const auto& subsystem : hostAllocator.getStatistics()) {
+		uint64_t allocations = 0, pooled = 0;
+		for (const auto& scope : subsystem.scopes) {
+			allocations += scope.allocations;
+			pooled += scope.pooledAllocations;
+		}
+		std::cerr << "[Vulkan Log] : host memory " << subsystem.subsystem << " " << allocations << " allocations ("
+			<< subsystem.scopes[VK_SYSTEM_ALLOCATION_SCOPE_COMMAND].allocations << " command scope, " << pooled
+			<< " pooled), " << subsystem.peakBytes << " bytes peak, " << subsystem.bytes << " bytes live" << std::endl;
+	}
+	if (window != nullptr) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 }
 
 void VkApplication::createSurface()
 {
-	if (glfwCreateWindowSurface(instance, window, nullptr, &vkSurface) != VK_SUCCESS) {
+	if (config.headless) {
+		if (!useHeadlessSurface) {
+			//no surface at all, createSwapChain falls back to offscreen images
+			return;
+		}
+		VkHeadlessSurfaceCreateInfoEXT vkHeadlessCreateInfo{};
+		vkHeadlessCreateInfo.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+		//vkCreateHeadlessSurfaceEXT is an extension function, just like the debug
+		//messenger it needs to be loaded using vkGetInstanceProcAddr
+		auto func = (PFN_vkCreateHeadlessSurfaceEXT)
+			vkGetInstanceProcAddr(instance, "vkCreateHeadlessSurfaceEXT");
+		if (func == nullptr || func(instance, &vkHeadlessCreateInfo, hostCallbacks("instance"), &vkSurface) != VK_SUCCESS) {
+			throw std::runtime_error("unable to create headless surface");
+		}
+		return;
+	}
+
+	if (glfwCreateWindowSurface(instance, window, hostCallbacks("instance"), &vkSurface) != VK_SUCCESS) {
 		throw std::runtime_error("unable to create window surface");
 	}
 }
 
 void VkApplication::setupDebugMessenger() {
-	if (!enableValidationLayers) return;
+	if (config.validationMode == ValidationMode::Off) return;
 	VkDebugUtilsMessengerCreateInfoEXT vkDebugCreateInfo;
 	populateDebugMessengerCreateInfo(vkDebugCreateInfo);
 	//the VkDebugUtilsMessengerCreateInfoExt needs to be passed to the function
 	//vkCreateDebugUtilsMessengerEXT , but since it is not loaded by default
 	//it needs to be loaded using vkGetInstanceProcAddr
-	if (CreateDebugUtilsMessengerEXT(instance, &vkDebugCreateInfo, nullptr, &vkDebugMessenger) != VK_SUCCESS) {
+	if (CreateDebugUtilsMessengerEXT(instance, &vkDebugCreateInfo, hostCallbacks("instance"), &vkDebugMessenger) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create debug messenger ext");
 	}
 }
 
-VkResult VkApplication::CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* debugMsgInfo, VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
+VkResult VkApplication::CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* debugMsgInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pDebugMessenger)
 {
 	auto func = (PFN_vkCreateDebugUtilsMessengerEXT)
 		vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
@@ -434,20 +1503,60 @@ VkResult VkApplication::CreateDebugUtilsMessengerEXT(VkInstance instance, const
 }
 
 std::vector<const char*> VkApplication::getRequiredExtensions(){
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
-	if (enableValidationLayers) {
+	std::vector<const char*> extensions;
+	if (config.headless) {
+		//VK_EXT_headless_surface lets us keep the swapchain path without a display,
+		//when it is missing we render into offscreen images instead
+		useHeadlessSurface = checkInstanceExtensionSupport(VK_KHR_SURFACE_EXTENSION_NAME) &&
+			checkInstanceExtensionSupport(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+		if (useHeadlessSurface) {
+			extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+			extensions.push_back(VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME);
+		}
+	}
+	else {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
+	if (config.validationMode != ValidationMode::Off) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
+	//provided by the validation layer itself rather than the loader
+	validationFeaturesEnabled = config.validationMode == ValidationMode::Full &&
+		checkInstanceExtensionSupport(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME, validationLayers[0]);
+	if (validationFeaturesEnabled) {
+		extensions.push_back(VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME);
+	}
+	else if (config.validationMode == ValidationMode::Full) {
+		std::cerr << "[Vulkan Log] : validation layer lacks " << VK_EXT_VALIDATION_FEATURES_EXTENSION_NAME
+			<< ", GPU-assisted and best practices checks disabled" << std::endl;
+	}
 
 	return extensions;
 }
 
+bool VkApplication::checkInstanceExtensionSupport(const char* extensionName, const char* layerName)
+{
+	uint32_t extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(layerName, &extensionCount, availableExtensions.data());
+	for (const auto& extension : availableExtensions) {
+		if (strcmp(extensionName, extension.extensionName) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 VKAPI_ATTR VkBool32 VKAPI_CALL VkApplication::debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData)
 {
-	std::cerr << "validation Layer : " << pCallbackData->pMessage << std::endl;
+	//runs inside whatever vulkan call triggered it, the logger keeps it to a lookup
+	//and, the first time a message is seen, a copy
+	static_cast<ValidationLogger*>(pUserData)->log(messageSeverity, *pCallbackData);
 	//callback should always be false,if callback returns true then
 	//it is aborted with VK_ERROR_VALIDATION_FAILED_EXT
 	return VK_FALSE;
@@ -456,7 +1565,7 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VkApplication::debugCallback(VkDebugUtilsMessageS
 void VkApplication::DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT pDebugMessenger, const VkAllocationCallbacks* pAllocator)
 {
 	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)
-		vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerExt");
+		vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
 	if (func != nullptr) {
 		func(instance, pDebugMessenger, pAllocator);
 	}
@@ -466,23 +1575,17 @@ void VkApplication::DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUt
 void VkApplication::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& vkDebugCreateInfo)
 {
 	vkDebugCreateInfo = {};
-	vkDebugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT;
-	vkDebugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
 	vkDebugCreateInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-	vkDebugCreateInfo.pfnUserCallback = debugCallback;
-	vkDebugCreateInfo.pUserData = nullptr;
-}
-
-
-int main(){
-	VkApplication vkApp(600, 800, "vkapp");
-	try {
-		vkApp.run();
+	//the layer skips building messages nobody asked for, filtering here is cheaper
+	//than filtering in the callback
+	if (config.validationMode == ValidationMode::Full) {
+		vkDebugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		vkDebugCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
 	}
-	catch (const std::exception& e) {
-		std::cerr << e.what() << std::endl;
-		return(EXIT_FAILURE);
+	else {
+		vkDebugCreateInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+		vkDebugCreateInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT;
 	}
-
-	return(EXIT_SUCCESS);
-}
\ No newline at end of file
+	vkDebugCreateInfo.pfnUserCallback = debugCallback;
+	vkDebugCreateInfo.pUserData = &validationLogger;
+}
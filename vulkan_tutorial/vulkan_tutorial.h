@@ -16,10 +16,47 @@
 #include <set>
 #include <algorithm>
 #include <limits>
+#include <cctype>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "memory_allocator.h"
+#include "timeline_queue.h"
+#include "upload_manager.h"
+#include "pipeline_manager.h"
+#include "job_system.h"
+#include "gpu_profiler.h"
+#include "device_features.h"
+#include "device_dispatch.h"
+#include "descriptor_manager.h"
+#include "gpu_culling.h"
+#include "render_graph.h"
+#include "object_cache.h"
+#include "shader_manager.h"
+#include "validation_logger.h"
+#include "frame_pacer.h"
+#include "host_allocator.h"
+#include "frame_capture.h"
+
+enum class ValidationMode {
+	Off,
+	//core validation, only errors reach the log
+	Errors,
+	//adds GPU-assisted validation and the best practices checks, warnings included,
+	//several times slower and takes a descriptor set binding from the application
+	Full
+};
+
 #ifdef NDEBUG
-const bool enableValidationLayers = false;
+const ValidationMode defaultValidationMode = ValidationMode::Off;
 #else
-const bool enableValidationLayers = true;
+const ValidationMode defaultValidationMode = ValidationMode::Errors;
 #endif
 
 const std::vector<const char*> validationLayers = {
@@ -30,10 +67,126 @@ const std::vector<const char*> deviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+//where compiled SPIR-V is loaded from, the build points this at its shader output
+#ifndef VKAPP_SHADER_DIR
+#define VKAPP_SHADER_DIR "shaders"
+#endif
+const char* const defaultShaderDirectory = VKAPP_SHADER_DIR;
+
+//where hot reload finds the GLSL behind that SPIR-V and the compiler it runs, both
+//default to what the build used
+#ifndef VKAPP_SHADER_SOURCE_DIR
+#define VKAPP_SHADER_SOURCE_DIR "shaders"
+#endif
+#ifndef VKAPP_GLSLC
+#define VKAPP_GLSLC "glslc"
+#endif
+const char* const defaultShaderSourceDirectory = VKAPP_SHADER_SOURCE_DIR;
+const char* const defaultShaderCompiler = VKAPP_GLSLC;
+
+//overrides device selection when VkApplicationConfig::deviceOverride is empty
+const char* const deviceOverrideVariable = "VKAPP_DEVICE";
+
+//frames rendered by a headless run when no explicit frame count is given
+const uint32_t defaultHeadlessFrameCount = 1000;
+
+enum class PresentPolicy {
+	//MAILBOX when available, otherwise FIFO, with one image above the surface minimum
+	Balanced,
+	//IMMEDIATE or MAILBOX with the fewest images the surface allows
+	LowestLatency,
+	//FIFO_RELAXED with extra images so the cpu rarely waits on the presentation engine
+	Throughput,
+	//plain FIFO, the gpu idles until the next vertical blank
+	PowerSaving
+};
+
+struct SwapChainPolicy {
+	PresentPolicy presentPolicy = PresentPolicy::Balanced;
+	//requested swapchain image count, 0 lets the present policy decide,
+	//the value is always clamped to what the surface supports
+	uint32_t imageCount = 0;
+	//surface formats in order of preference, the first one the surface supports wins
+	std::vector<VkSurfaceFormatKHR> formatPriority = {
+		{ VK_FORMAT_B8G8R8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR },
+		{ VK_FORMAT_R8G8B8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR }
+	};
+};
+
+//records into the frame's primary command buffer, outside of any render pass
+using FrameCallback = std::function<void(VkCommandBuffer commandBuffer, uint32_t frameIndex)>;
+
+struct VkApplicationConfig {
+	//headless mode never touches glfw, it renders into a VK_EXT_headless_surface
+	//swapchain when the instance supports it and into plain offscreen images otherwise
+	bool headless = false;
+	//number of frames mainLoop runs before returning, 0 runs until the window is closed
+	uint32_t frameCount = 0;
+	//number of images backing the offscreen render target when no surface exists
+	uint32_t offscreenImageCount = 3;
+	//how many frames the cpu may record ahead of the gpu
+	uint32_t maxFramesInFlight = 2;
+	SwapChainPolicy swapChainPolicy;
+	//size of the per frame linear arena for transient data
+	VkDeviceSize transientArenaSize = 4ull * 1024 * 1024;
+	//size of the persistently mapped staging ring used for uploads
+	VkDeviceSize stagingRingSize = 32ull * 1024 * 1024;
+	//where the pipeline cache is loaded from at startup and saved to in cleanup
+	std::string pipelineCachePath = defaultPipelineCachePath;
+	//threads recording secondary command buffers, 0 uses every hardware thread but one
+	uint32_t workerThreadCount = 0;
+	//forces a physical device, either its index in enumeration order or its deviceUUID
+	//as 32 hex digits (dashes ignored), empty falls back to VKAPP_DEVICE and then to scoring
+	std::string deviceOverride;
+	//gpu timings are streamed here when set, empty disables the profiler entirely
+	std::string profileOutputPath;
+	ProfileFormat profileFormat = ProfileFormat::Csv;
+	//adds pipeline statistics queries to the scopes that ask for them
+	bool pipelineStatistics = false;
+	//timestamp pairs available to each frame
+	uint32_t maxProfileScopes = 64;
+	//array sizes of the bindless descriptor set, clamped to the device limits
+	uint32_t maxBindlessSampledImages = 16384;
+	uint32_t maxBindlessStorageBuffers = 4096;
+	uint32_t maxBindlessSamplers = 64;
+	//compiled SPIR-V of the application's own passes, e.g. cull.comp.spv
+	std::string shaderDirectory = defaultShaderDirectory;
+	//recompiles shaders whose GLSL changes while running and swaps the rebuilt pipelines
+	//in between frames, see ShaderManager
+	bool hotReloadShaders = false;
+	std::string shaderSourceDirectory = defaultShaderSourceDirectory;
+	std::string shaderCompiler = defaultShaderCompiler;
+	//culls instances on the gpu and draws the survivors with vkCmdDrawIndexedIndirectCount,
+	//see GpuCulling, runs on the dedicated compute queue when the device has one
+	bool gpuCulling = false;
+	uint32_t maxCullInstances = 131072;
+	uint32_t maxCullMeshes = 4096;
+	//fixed for the lifetime of the instance, anything but Off needs VK_LAYER_KHRONOS_validation
+	ValidationMode validationMode = defaultValidationMode;
+	//distinct validation messages written per second, repeats are counted instead
+	uint32_t maxValidationMessagesPerSecond = 100;
+	//frames per second the frame loop is held to, 0 leaves it to the present mode
+	double maxFrameRate = 0.0;
+	//frames submitted but not yet presented when the next one reads input, fewer means
+	//lower and steadier latency at some cost in throughput, 0 only limits by maxFramesInFlight
+	uint32_t maxQueuedFrames = 0;
+	//passes HostAllocator callbacks to every create and destroy call, off leaves the
+	//driver's cpu allocations to the driver and untracked
+	bool trackHostAllocations = true;
+	//every rendered frame is read back and written here when set, see FrameCapture
+	std::string capturePath;
+	CaptureFormat captureFormat = CaptureFormat::Y4m;
+	//frames read back but not yet written before further frames are dropped
+	uint32_t maxQueuedCaptureFrames = 4;
+};
+
 
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	//families without graphics support, only set when the device exposes them
+	std::optional<uint32_t> computeFamily;
+	std::optional<uint32_t> transferFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() && presentFamily.has_value();
@@ -46,15 +199,124 @@ struct SwapChainSupportDetails {
 	std::vector<VkPresentModeKHR> presentModes;
 };
 
+//what a physical device supports, queried once per device instead of on every
+//findQueueFamilies, extension or swapchain support check
+struct DeviceCapabilities {
+	VkPhysicalDeviceProperties properties;
+	DeviceFeatureChain features;
+	VkPhysicalDeviceMemoryProperties memoryProperties;
+	//stable across runs and processes, unlike the enumeration order
+	uint8_t deviceUUID[VK_UUID_SIZE] = {};
+	std::vector<VkExtensionProperties> extensions;
+	QueueFamilyIndices queueFamilies;
+	//formats and present modes are fixed for the lifetime of the surface, the surface
+	//capabilities follow the window size and are still queried every time
+	std::vector<VkSurfaceFormatKHR> surfaceFormats;
+	std::vector<VkPresentModeKHR> presentModes;
+};
+
+//everything a single frame in flight needs, the pool is reset as a whole once
+//the in flight fence signals instead of freeing its command buffers one by one
+struct FrameData {
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+	VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+	VkSemaphore imageAvailableSemaphore = VK_NULL_HANDLE;
+	VkFence inFlightFence = VK_NULL_HANDLE;
+	//frameNumber + 1 of the last submission made with these resources, 0 if never submitted
+	uint64_t frameSerial = 0;
+};
+
+//a swapchain replaced by recreateSwapChain, it stays alive until every frame
+//that could still reference its images has finished on the gpu
+struct RetiredSwapChain {
+	VkSwapchainKHR swapChain;
+	//presents on the old swapchain may still wait on these
+	std::vector<VkSemaphore> renderFinishedSemaphores;
+	uint64_t retireSerial;
+};
+
 
 class VkApplication {
 public:
-	VkApplication(int32_t height, int32_t width, std::string vkapplicatonname);
+	VkApplication(int32_t height, int32_t width, std::string vkapplicatonname, VkApplicationConfig config = {});
 	void run();
 
+	//the steps of run() for tools that drive the frame loop themselves, e.g. the benchmark,
+	//call vkDeviceWaitIdle and destroy anything created on the device before shutdown
+	void init();
+	void renderFrame();
+	void shutdown();
+	//recreates the swapchain the way a window resize does, false when rendering offscreen
+	bool rebuildSwapChain();
+	VkPhysicalDevice getPhysicalDevice() const { return vkPhysicalDevice; }
+	VkDevice getDevice() const { return vkDevice; }
+	//the device's entry points loaded directly from the driver, record per draw commands
+	//through it rather than through the loader's exports
+	const DeviceDispatch& getDeviceDispatch() const { return deviceDispatch; }
+	//milliseconds spent in window creation and each initVulkan step, in the order they ran
+	//phases running on different threads overlap, so they add up to more than the startup time
+	const std::vector<std::pair<std::string, double>>& getStartupPhases() const { return startupPhases; }
+	//wall clock milliseconds from init() until initVulkan returned
+	double getStartupTime() const { return startupTime; }
+
+	//compute and transfer fall back to the graphics queue when the device has no
+	//dedicated family for them, check TimelineQueue::dedicated to tell them apart
+	TimelineQueue& getGraphicsQueue() { return graphicsQueue; }
+	TimelineQueue& getComputeQueue() { return computeQueue; }
+	TimelineQueue& getTransferQueue() { return transferQueue; }
+
+	//makes the next frame's graphics submission wait for a value of another queue's timeline
+	void addGraphicsWait(const TimelineQueue& source, uint64_t value, VkPipelineStageFlags stage);
+
+	//all buffers, images and staging memory are sub-allocated from here
+	MemoryAllocator& getMemoryAllocator() { return memoryAllocator; }
+	//queued uploads are flushed once per frame and waited on by that frame's graphics submission
+	UploadManager& getUploadManager() { return uploadManager; }
+	//all pipelines must be created here so they share the persistent cache
+	PipelineManager& getPipelineManager() { return pipelineManager; }
+	JobSystem& getJobSystem() { return jobSystem; }
+	//records draws or dispatches on the worker threads, see ParallelRecorder::record
+	ParallelRecorder& getParallelRecorder() { return parallelRecorder; }
+	//tasks recorded in parallel every frame, outside of any render pass and before
+	//the frame's own commands, e.g. compute dispatches and transfers
+	void addFrameRecordTask(RecordTask task) { frameRecordTasks.push_back(std::move(task)); }
+	//called after the frame record tasks, free to begin its own render passes and
+	//use the parallel recorder with render pass inheritance inside them
+	void addFrameCallback(FrameCallback callback) { frameCallbacks.push_back(std::move(callback)); }
+	//index of the frame in flight being recorded, selects the transient arena
+	uint32_t getCurrentFrame() const { return currentFrame; }
+	//open scopes around passes with beginScope/endScope, results arrive maxFramesInFlight frames later
+	GpuProfiler& getProfiler() { return profiler; }
+	//every pipeline should use its pipeline layout, resources are referenced by slot
+	DescriptorManager& getDescriptorManager() { return descriptorManager; }
+	//what createLogicalDevice actually enabled, a subset of the device's features
+	const DeviceFeatureChain& getEnabledFeatures() const { return enabledFeatures; }
+	//serial of the frame being recorded, pass it to DescriptorManager::release when a
+	//resource this frame may still read is destroyed
+	uint64_t getFrameSerial() const { return frameNumber + 1; }
+	//only initialized when VkApplicationConfig::gpuCulling is set, the pass runs every
+	//frame before the record tasks, call drawIndirect from a frame callback's render pass
+	GpuCulling& getGpuCulling() { return gpuCulling; }
+	//once it has passes the graph renders every frame after the frame callbacks and takes
+	//over the swapchain image, otherwise the frame just clears it
+	RenderGraph& getRenderGraph() { return renderGraph; }
+	//get image views and samplers here rather than creating them, identical requests share
+	//one object and views go away with their image through releaseImage
+	ObjectCache& getObjectCache() { return objectCache; }
+	//load shader modules and create pipelines here to have them follow source edits,
+	//see VkApplicationConfig::hotReloadShaders
+	ShaderManager& getShaderManager() { return shaderManager; }
+	//input to present latency, measured from the glfwPollEvents of each frame
+	const FramePacingStatistics& getFramePacingStatistics() const { return framePacer.getStatistics(); }
+	//the driver's cpu allocations by subsystem and VkSystemAllocationScope, empty when
+	//VkApplicationConfig::trackHostAllocations is off
+	std::vector<HostAllocatorStatistics> getHostAllocationStatistics() { return hostAllocator.getStatistics(); }
+	CaptureStatistics getCaptureStatistics() { return frameCapture.getStatistics(); }
+
 private:
 	void initVulkan();
 	bool checkValidationLayerSupport();
+	void initGlfw();
 	void initWindow();
 	void mainLoop();
 	void createInstance();
@@ -63,14 +325,52 @@ private:
 	void setupDebugMessenger();
 	void pickPhysicalDevice();
 	bool isDeviceSuitable(VkPhysicalDevice device);
+	//only reads immutable state, safe to call for several devices at once
+	DeviceCapabilities queryDeviceCapabilities(VkPhysicalDevice device);
+	const DeviceCapabilities& getDeviceCapabilities(VkPhysicalDevice device);
+	bool checkDeviceFeatureSupport(VkPhysicalDevice device);
+	DeviceFeatureChain getRequiredFeatures();
+	void createTimelineQueue(TimelineQueue& timelineQueue, uint32_t family, bool dedicated);
 	void createLogicalDevice();
 	bool checkDeviceExtensionsSupport(VkPhysicalDevice device);
 	void createSwapChain();
+	void createOffscreenImages();
 	void createImageViews();
+	void createFrameResources();
+	void destroyFrameResources();
+	void createRenderFinishedSemaphores();
+	void drawFrame();
+	void recreateSwapChain();
+	void releaseRetiredSwapChains(bool waitedIdle);
+	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
+	void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	bool shouldClose();
+	//layerName looks at the extensions a layer provides instead of the loader and drivers
+	bool checkInstanceExtensionSupport(const char* extensionName, const char* layerName = nullptr);
+	std::vector<const char*> getRequiredDeviceExtensions();
+	void createAllocator();
+	void createUploadManager();
+	void createPipelineManager();
+	void createJobSystem();
+	void createProfiler();
+	void createDescriptorManager();
+	void createGpuCulling();
+	void createRenderGraph();
+	void createObjectCache();
+	void createShaderManager();
+	void createFramePacer();
+	void createFrameCapture();
+	void recordClear(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	//frames end with the image in TRANSFER_SRC_OPTIMAL, visible to transfer reads, and
+	//FrameCapture copies it out and moves it to PRESENT_SRC_KHR
+	bool capturesSwapChain() const { return !config.capturePath.empty() && swapChainSupportsCapture; }
+	void runStartupPhase(const char* name, void (VkApplication::*phase)());
+	//nullptr when host allocations are not tracked
+	const VkAllocationCallbacks* hostCallbacks(const char* subsystem);
 
 	VkResult CreateDebugUtilsMessengerEXT(VkInstance instance,
 		const VkDebugUtilsMessengerCreateInfoEXT* debugMsgInfo,
-		VkAllocationCallbacks* pAllocator,
+		const VkAllocationCallbacks* pAllocator,
 		VkDebugUtilsMessengerEXT* pDebugMessenger);
 
 	std::vector<const char*> getRequiredExtensions();
@@ -88,7 +388,9 @@ private:
 
 	void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& vkDebugCreateInfo);
 
+	//negative for devices that cannot run the application at all
 	int32_t rateDeviceSuitability(VkPhysicalDevice device);
+	bool matchesDeviceOverride(VkPhysicalDevice device, uint32_t index, const std::string& deviceOverride);
 
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 
@@ -100,24 +402,85 @@ private:
 
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR& capabilites);
 
+	uint32_t chooseSwapImageCount(const VkSurfaceCapabilitiesKHR& capabilites);
+
 
 
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
 	int32_t vkheight;
 	int32_t vkwidth;
 	std::string appname;
+	VkApplicationConfig config;
+	bool useHeadlessSurface = false;
+	uint64_t frameNumber = 0;
+	//declared before everything created with its callbacks, the driver may still free
+	//through them until the instance is destroyed
+	HostAllocator hostAllocator;
 	VkInstance instance;
-	VkDebugUtilsMessengerEXT vkDebugMessenger;
+	VkDebugUtilsMessengerEXT vkDebugMessenger = VK_NULL_HANDLE;
+	//the messenger's pUserData, outlives the instance
+	ValidationLogger validationLogger;
+	//Full mode and the layer provides VK_EXT_validation_features
+	bool validationFeaturesEnabled = false;
 	VkPhysicalDevice vkPhysicalDevice = VK_NULL_HANDLE;
 	VkDevice vkDevice;
 	VkQueue vkGraphicsQueue;
-	VkSurfaceKHR vkSurface;
+	TimelineQueue graphicsQueue;
+	TimelineQueue computeQueue;
+	TimelineQueue transferQueue;
+	//timeline waits collected for the next graphics submission
+	std::vector<TimelineWait> pendingGraphicsWaits;
+	VkSurfaceKHR vkSurface = VK_NULL_HANDLE;
 	VkQueue vkPresentQueue;
-	VkSwapchainKHR vkSwapChain;
+	VkSwapchainKHR vkSwapChain = VK_NULL_HANDLE;
+	MemoryAllocator memoryAllocator;
+	UploadManager uploadManager;
+	PipelineManager pipelineManager;
+	JobSystem jobSystem;
+	ParallelRecorder parallelRecorder;
+	std::vector<RecordTask> frameRecordTasks;
+	std::vector<FrameCallback> frameCallbacks;
+	std::vector<std::pair<std::string, double>> startupPhases;
+	//init phases may finish on several threads at once
+	std::mutex startupPhasesMutex;
+	double startupTime = 0.0;
+	std::map<VkPhysicalDevice, DeviceCapabilities> deviceCapabilities;
+	std::chrono::steady_clock::time_point startTime;
+	GpuProfiler profiler;
+	//set by createLogicalDevice when the device feature could be enabled
+	bool pipelineStatisticsEnabled = false;
+	DeviceFeatureChain enabledFeatures;
+	DeviceDispatch deviceDispatch;
+	DescriptorManager descriptorManager;
+	GpuCulling gpuCulling;
+	RenderGraph renderGraph;
+	ObjectCache objectCache;
+	ShaderManager shaderManager;
+	FramePacer framePacer;
+	FrameCapture frameCapture;
+	//highest transfer timeline value a graphics submission has waited on
+	uint64_t graphicsUploadValue = 0;
+	//when there is no surface, swapChainImages are plain images backed by this memory
+	std::vector<MemoryAllocation> offscreenImageMemory;
 	std::vector<VkImage> swapChainImages;
 	std::vector<VkImageView> swapChainImageViews;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
+	bool swapChainSupportsClear = false;
+	//the images can be copied out and have a format FrameCapture understands
+	bool swapChainSupportsCapture = false;
+	std::vector<FrameData> frames;
+	//one per swapchain image rather than per frame, a frame's fence says nothing about
+	//whether the present that waited on its semaphore has run yet, reacquiring the
+	//image does
+	std::vector<VkSemaphore> renderFinishedSemaphores;
+	uint32_t currentFrame = 0;
+	//fence of the frame that last rendered into each swapchain image
+	std::vector<VkFence> imagesInFlight;
+	bool framebufferResized = false;
+	//every frame with a serial up to this one has finished executing
+	uint64_t completedFrameSerial = 0;
+	std::vector<RetiredSwapChain> retiredSwapChains;
 
 
 };